@@ -29,7 +29,8 @@
 #include "pkmCircularRecorder.h"
 #include "pkmAudioFeatures.h"
 #include "pkmMatrix.h"
-#include "pkmEXTAudioFileReader.h"
+#include "pkmAudioFileReader.h"
+#include "pkmAudioFilePrefetcher.h"
 
 class Recording {
 public:
@@ -44,12 +45,18 @@ class Corpus {
 public:
     void setup(int segment_size = 2048){
         analyzer.setup(44100, segment_size);
+        
+            // scratch space for one matching frame: the features of the
+            // incoming audio, reset every time we match
+        frame_arena.setup(13);
     }
     
     float * getNearestRecording(float *buf, int size) {
-        pkmMatrix buffer(1, size, buf);
-        pkmMatrix features(1, 13);
-        analyzer.computeLFCCF(buffer.data, features.data, 13);
+            // called once per audio callback, so anything we drew from the
+            // arena last time is no longer needed
+        frame_arena.reset();
+        pkmMatrix features(1, 13, frame_arena);
+        analyzer.computeLFCCF(buf, features.data, 13);
         
             // look at every single recording's features
             // calculate the distance to it
@@ -76,7 +83,7 @@ public:
         }
     }
     
-    void addRecording(float *buf, int size){
+    void addRecording(const float *buf, int size){
         pkmMatrix buffer(1, size, buf);
         pkmMatrix features(1, 13);
         analyzer.computeLFCCF(buffer.data, features.data, 13);
@@ -89,6 +96,7 @@ public:
     }
 private:
     pkmAudioFeatures analyzer;
+    pkm::Arena frame_arena;
     vector<Recording> corpora;
 };
 
@@ -105,10 +113,24 @@ public:
         reader1.open(ofToDataPath("amen.wav"));
         int total_frames = reader1.mNumSamples / frame_size;
 
-        for (int frame = 0; frame < total_frames; frame++) {
-            pkmMatrix recording(1, frame_size);
-            reader1.read(recording.data, frame * frame_size, frame_size);
-            corpus.addRecording(recording.data, frame_size);
+            // the file is decoded on another thread, 64 frames at a time,
+            // while we analyse the blocks it has already finished
+        pkmAudioFilePrefetcher prefetcher;
+        prefetcher.start(&reader1, 64 * frame_size);
+        pkmAudioFilePrefetcher::Block block;
+        int frame = 0;
+        float reported = 0;
+        while (prefetcher.acquire(block)) {
+            for (long i = 0; i + frame_size <= block.frames && frame < total_frames; i += frame_size) {
+                corpus.addRecording(block.data + i, frame_size);
+                frame++;
+            }
+            prefetcher.release(block);
+            
+            if (prefetcher.getProgress() - reported >= 0.1) {
+                reported = prefetcher.getProgress();
+                cout << "analysed " << (int)(reported * 100) << "%" << endl;
+            }
         }
 
         ofSoundStreamSetup(1, 1, 44100, 2048, 3);
@@ -147,7 +169,7 @@ private:
     
     pkmMatrix buffer;
     
-    pkmEXTAudioFileReader reader1;
+    pkmAudioFileReader reader1;
     
     Corpus corpus;
     
@@ -0,0 +1,831 @@
+/*
+ *  pkmAudioFileReader.h
+ *
+ *  Portable drop-in for pkmEXTAudioFileReader (same open/read/close
+ *  interface and public members) that does not need ExtAudioFile.
+ *
+ *  - WAV (PCM 8/16/24/32 bit, float 32/64, WAVE_FORMAT_EXTENSIBLE) and
+ *    AIFF/AIFC (NONE, twos, sowt, fl32, fl64) are memory-mapped and
+ *    converted straight out of the mapping.  Mono float WAVs (or any float
+ *    WAV read with its own channel count) can be read with no copy at all
+ *    through getFrames().
+ *  - FLAC is decoded in-tree, a run of frames at a time into a cache of
+ *    around kBlockFrames frames, so a sequential run of small read() calls
+ *    costs one block decode per kBlockFrames frames and a copy per call.
+ *    Frame offsets are remembered as they are decoded, so seeking backwards
+ *    restarts at the nearest earlier frame rather than at the top of the
+ *    file.
+ *
+ *  Channels are converted to the count passed to open(): averaged down to
+ *  mono, or repeated up from mono.
+ *
+ *  A file at a different rate from the one passed to open() is converted
+ *  with a pkmResampler as it is read: mNumSamples then counts frames at the
+ *  requested rate (mFrameRate is still the file's own rate), and read()
+ *  positions are in requested-rate frames.  Converted frames are cached
+ *  around kBlockFrames at a time, so reading a file front to back converts
+ *  every frame exactly once.
+ *
+ *  Usage:
+ *
+ *  pkmAudioFileReader reader;
+ *  reader.open(ofToDataPath("amen.wav"));
+ *  float *frame = (float *)malloc(sizeof(float) * 2048);
+ *  for (long i = 0; i + 2048 <= reader.mNumSamples; i += 2048)
+ *      reader.read(frame, i, 2048);
+ *  reader.close();
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "pkmResampler.h"
+
+using namespace std;
+
+class pkmAudioFileReader {
+ public:
+  // frames decoded per FLAC cache fill, and converted per resampler fill
+  static const long kBlockFrames = 1 << 16;
+
+  pkmAudioFileReader() {
+    mFrameRate = mNumChannels = mNumSamples = mBytesPerSample = 0;
+    mMap = NULL;
+    mMapSize = 0;
+    mData = NULL;
+    mOutChannels = 1;
+    close();
+  }
+  ~pkmAudioFileReader() { close(); }
+
+  bool open(string path, int sampleRate = 44100, int channels = 1) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      printf("[pkmAudioFileReader]: could not open '%s'\n", path.c_str());
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+      printf("[pkmAudioFileReader]: '%s' is empty\n", path.c_str());
+      ::close(fd);
+      return false;
+    }
+    mMapSize = (size_t)st.st_size;
+    void *map = mmap(NULL, mMapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      printf("[pkmAudioFileReader]: could not map '%s'\n", path.c_str());
+      mMapSize = 0;
+      return false;
+    }
+    mMap = (const uint8_t *)map;
+    // analysis walks files front to back, let the kernel read ahead
+    madvise(map, mMapSize, MADV_SEQUENTIAL);
+
+    mOutChannels = channels;
+
+    bool ok;
+    if (!memcmp(mMap, "RIFF", 4) && !memcmp(mMap + 8, "WAVE", 4)) {
+      ok = parseWAV();
+    } else if (!memcmp(mMap, "FORM", 4) &&
+               (!memcmp(mMap + 8, "AIFF", 4) || !memcmp(mMap + 8, "AIFC", 4))) {
+      ok = parseAIFF();
+    } else {
+      ok = parseFLAC();
+    }
+    if (!ok) {
+      printf("[pkmAudioFileReader]: unsupported or damaged file '%s'\n",
+             path.c_str());
+      close();
+      return false;
+    }
+
+    printf("[pkmAudioFileReader]: opened %s (%lu hz, %lu ch, %lu samples, %lu bps)\n",
+           path.c_str(), mFrameRate, mNumChannels, mNumSamples,
+           mBytesPerSample * 8);
+
+    mNativeSamples = mNumSamples;
+    if (sampleRate > 0 && (int)mFrameRate != sampleRate) {
+      mResampler.setup(mFrameRate, sampleRate);
+      mResampling = true;
+      mNumSamples = mResampler.outputLength(mNativeSamples);
+      printf("[pkmAudioFileReader]: converting %lu hz to %d hz (%lu samples, "
+             "%d taps)\n", mFrameRate, sampleRate, mNumSamples,
+             mResampler.getTaps());
+    }
+
+    loaded = true;
+    return true;
+  }
+
+  // read count frames starting at frame start into target (count *
+  // channels floats, interleaved).  anything past the end of the file is
+  // filled with zeros.  the last argument is only there so calls written
+  // for pkmEXTAudioFileReader still compile: the rate is fixed in open().
+  bool read(float *target, long start, long count, int /*sampleRate*/ = 44100) {
+    if (!loaded) return false;
+    if (start < 0 || count < 0) return false;
+
+    long available = start < (long)mNumSamples ? (long)mNumSamples - start : 0;
+    long n = count < available ? count : available;
+    if (n < count) {
+      memset(target + n * mOutChannels, 0,
+             sizeof(float) * (count - n) * mOutChannels);
+    }
+
+    if (mResampling) {
+      return readResampled(target, start, n);
+    }
+    return readNative(target, start, n);
+  }
+
+  // frames [start, start + count) straight out of the file mapping, or NULL
+  // when the file is not native-endian float with the requested channel
+  // count and rate (read() then has to convert)
+  const float *getFrames(long start, long count) const {
+    if (!loaded || mEncoding != PCM_FLOAT || mBytesPerSample != 4 ||
+        mBigEndian != hostIsBigEndian() || (int)mNumChannels != mOutChannels ||
+        mResampling ||
+        ((uintptr_t)mData & 3) != 0 || start < 0 ||
+        start + count > (long)mNumSamples) {
+      return NULL;
+    }
+    return (const float *)(mData + start * mFrameBytes);
+  }
+
+  void close() {
+    if (mMap != NULL) {
+      munmap((void *)mMap, mMapSize);
+    }
+    mMap = NULL;
+    mMapSize = 0;
+    mData = NULL;
+    mDataBytes = 0;
+    mFrameBytes = 0;
+    mEncoding = PCM_INT;
+    mBigEndian = false;
+    mBlock.clear();
+    mBlockStart = mBlockFrames = 0;
+    mFlacIndex.clear();
+    mFlacPos = mFlacFirstFrame = 0;
+    mFlacSample = 0;
+    mFlacBitsPerSample = 0;
+    mNativeSamples = 0;
+    mResampling = false;
+    mOut.clear();
+    mOutStart = mOutFrames = 0;
+    loaded = false;
+  }
+
+  // channels per frame handed back by read(), as asked for in open()
+  int getOutputChannels() const { return mOutChannels; }
+
+  unsigned long mFrameRate, mNumChannels, mNumSamples, mBytesPerSample;
+
+  bool loaded = false;
+
+ private:
+  enum Encoding { PCM_INT, PCM_UINT8, PCM_FLOAT, FLAC };
+
+  static bool hostIsBigEndian() {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 0;
+  }
+
+  static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+  static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+  static uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  }
+  static uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+  //////////////////////////////////////////////////////////////////////////
+  // containers
+
+  bool parseWAV() {
+    const uint8_t *end = mMap + mMapSize;
+    const uint8_t *p = mMap + 12;
+    int format = 0, bits = 0;
+    mData = NULL;
+    while (p + 8 <= end) {
+      uint32_t size = le32(p + 4);
+      const uint8_t *body = p + 8;
+      if (!memcmp(p, "fmt ", 4) && size >= 16 && body + 16 <= end) {
+        format = le16(body);
+        mNumChannels = le16(body + 2);
+        mFrameRate = le32(body + 4);
+        bits = le16(body + 14);
+        // WAVE_FORMAT_EXTENSIBLE keeps the real format in the sub-format GUID
+        if (format == 0xFFFE && size >= 40 && body + 26 <= end) {
+          format = le16(body + 24);
+        }
+      } else if (!memcmp(p, "data", 4)) {
+        mData = body;
+        mDataBytes = (size_t)(end - body) < size ? (size_t)(end - body) : size;
+        break;
+      }
+      p = body + size + (size & 1);
+    }
+    if (mData == NULL || mNumChannels == 0 || bits == 0) return false;
+
+    mBigEndian = false;
+    mBytesPerSample = bits / 8;
+    if (format == 1) {
+      mEncoding = bits == 8 ? PCM_UINT8 : PCM_INT;
+    } else if (format == 3) {
+      mEncoding = PCM_FLOAT;
+    } else {
+      return false;
+    }
+    return setupPCM();
+  }
+
+  bool parseAIFF() {
+    const uint8_t *end = mMap + mMapSize;
+    bool aifc = !memcmp(mMap + 8, "AIFC", 4);
+    const uint8_t *p = mMap + 12;
+    int bits = 0;
+    mData = NULL;
+    mEncoding = PCM_INT;
+    mBigEndian = true;
+    while (p + 8 <= end) {
+      uint32_t size = be32(p + 4);
+      const uint8_t *body = p + 8;
+      if (!memcmp(p, "COMM", 4) && size >= 18 && body + 18 <= end) {
+        mNumChannels = be16(body);
+        bits = be16(body + 6);
+        mFrameRate = (unsigned long)(extendedToDouble(body + 8) + 0.5);
+        if (aifc && size >= 22) {
+          const uint8_t *type = body + 18;
+          if (!memcmp(type, "sowt", 4)) {
+            mBigEndian = false;
+          } else if (!memcmp(type, "fl32", 4) || !memcmp(type, "FL32", 4) ||
+                     !memcmp(type, "fl64", 4) || !memcmp(type, "FL64", 4)) {
+            mEncoding = PCM_FLOAT;
+          } else if (memcmp(type, "NONE", 4) && memcmp(type, "twos", 4)) {
+            return false;
+          }
+        }
+      } else if (!memcmp(p, "SSND", 4) && size >= 8) {
+        if (body + 8 > end) return false;
+        // the offset comes straight from the file: the samples it points at
+        // have to start inside both the chunk and the mapping
+        uint32_t offset = be32(body);
+        if (offset > size - 8 || offset > (size_t)(end - body - 8)) return false;
+        mData = body + 8 + offset;
+        size_t bytes = size - 8 - offset;
+        mDataBytes = (size_t)(end - mData) < bytes ? (size_t)(end - mData) : bytes;
+      }
+      p = body + size + (size & 1);
+    }
+    if (mData == NULL || mNumChannels == 0 || bits == 0) return false;
+    mBytesPerSample = (bits + 7) / 8;
+    return setupPCM();
+  }
+
+  // 80-bit IEEE 754 extended, as used for the AIFF sample rate
+  static double extendedToDouble(const uint8_t *p) {
+    int exponent = ((p[0] & 0x7F) << 8) | p[1];
+    uint64_t mantissa = 0;
+    for (int i = 0; i < 8; i++) mantissa = (mantissa << 8) | p[2 + i];
+    double value = ldexp((double)mantissa, exponent - 16383 - 63);
+    return (p[0] & 0x80) ? -value : value;
+  }
+
+  bool setupPCM() {
+    if (mBytesPerSample < 1 || mBytesPerSample > 8) return false;
+    if (mEncoding == PCM_FLOAT && mBytesPerSample != 4 && mBytesPerSample != 8)
+      return false;
+    mFrameBytes = mBytesPerSample * mNumChannels;
+    mNumSamples = mDataBytes / mFrameBytes;
+    return true;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // PCM conversion
+
+  // decode one sample to float
+  inline float pcmSample(const uint8_t *p) const {
+    switch (mEncoding) {
+      case PCM_UINT8:
+        return ((int)p[0] - 128) * (1.0f / 128.0f);
+      case PCM_FLOAT:
+        if (mBytesPerSample == 4) {
+          uint32_t u = mBigEndian ? be32(p) : le32(p);
+          float f;
+          memcpy(&f, &u, 4);
+          return f;
+        } else {
+          uint64_t u = 0;
+          for (int i = 0; i < 8; i++)
+            u |= (uint64_t)p[mBigEndian ? 7 - i : i] << (8 * i);
+          double d;
+          memcpy(&d, &u, 8);
+          return (float)d;
+        }
+      default:
+        break;
+    }
+    // signed integer, left-justified into 32 bits
+    uint32_t u = 0;
+    int n = (int)mBytesPerSample;
+    for (int i = 0; i < n && i < 4; i++) {
+      uint32_t byte = p[mBigEndian ? i : n - 1 - i];
+      u |= byte << (24 - 8 * i);
+    }
+    if (n == 1) {
+      // AIFF 8 bit is signed
+      return (int8_t)p[0] * (1.0f / 128.0f);
+    }
+    return (int32_t)u * (1.0f / 2147483648.0f);
+  }
+
+  // convert n frames starting at src into mOutChannels interleaved floats
+  void convertPCM(const uint8_t *src, long n, float *dst) const {
+    const int in_ch = (int)mNumChannels;
+    const size_t bps = mBytesPerSample;
+
+    // the common cases get their own tight loops
+    if (in_ch == mOutChannels && mBigEndian == hostIsBigEndian()) {
+      if (mEncoding == PCM_FLOAT && bps == 4) {
+        memcpy(dst, src, sizeof(float) * n * in_ch);
+        return;
+      }
+      if (mEncoding == PCM_INT && bps == 2) {
+        const long total = n * in_ch;
+        for (long i = 0; i < total; i++) {
+          int16_t s;
+          memcpy(&s, src + 2 * i, 2);
+          dst[i] = s * (1.0f / 32768.0f);
+        }
+        return;
+      }
+    }
+
+    for (long f = 0; f < n; f++) {
+      const uint8_t *frame = src + f * mFrameBytes;
+      float *out = dst + f * mOutChannels;
+      if (in_ch == mOutChannels) {
+        for (int c = 0; c < in_ch; c++) out[c] = pcmSample(frame + c * bps);
+      } else if (mOutChannels == 1) {
+        float sum = 0;
+        for (int c = 0; c < in_ch; c++) sum += pcmSample(frame + c * bps);
+        out[0] = sum / in_ch;
+      } else {
+        for (int c = 0; c < mOutChannels; c++)
+          out[c] = pcmSample(frame + (c % in_ch) * bps);
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // FLAC
+
+  // MSB-first bit reader over the mapped file
+  struct BitReader {
+    const uint8_t *data;
+    size_t size;
+    size_t bitpos;
+
+    BitReader(const uint8_t *d, size_t s, size_t pos)
+        : data(d), size(s), bitpos(pos) {}
+
+    // next 64 bits starting at bitpos, MSB first (zeros past the end)
+    inline uint64_t peek() const {
+      size_t byte = bitpos >> 3;
+      uint64_t v = 0;
+      if (byte + 8 <= size) {
+        memcpy(&v, data + byte, 8);
+        if (!hostIsBigEndian()) v = __builtin_bswap64(v);
+      } else {
+        for (int i = 0; i < 8; i++)
+          v = (v << 8) | (byte + i < size ? data[byte + i] : 0);
+      }
+      return v << (bitpos & 7);
+    }
+    inline uint32_t bits(int n) {
+      if (n == 0) return 0;
+      uint32_t v = (uint32_t)(peek() >> (64 - n));
+      bitpos += n;
+      return v;
+    }
+    inline int32_t sbits(int n) {
+      if (n == 0) return 0;
+      uint32_t v = bits(n);
+      if (n < 32 && (v & (1u << (n - 1)))) v |= ~0u << n;
+      return (int32_t)v;
+    }
+    // number of 0 bits before the next 1, which is consumed
+    inline uint32_t unary() {
+      uint32_t q = 0;
+      while (bitpos < size * 8) {
+        int valid = 64 - (int)(bitpos & 7);
+        uint64_t v = peek();
+        if (v == 0) {
+          q += valid;
+          bitpos += valid;
+          continue;
+        }
+        int lz = __builtin_clzll(v);
+        q += lz;
+        bitpos += lz + 1;
+        return q;
+      }
+      return q;
+    }
+    inline void alignToByte() { bitpos = (bitpos + 7) & ~(size_t)7; }
+  };
+
+  bool parseFLAC() {
+    size_t pos = 0;
+    // skip an ID3v2 tag
+    if (mMapSize > 10 && !memcmp(mMap, "ID3", 3)) {
+      pos = 10 + (((mMap[6] & 0x7F) << 21) | ((mMap[7] & 0x7F) << 14) |
+                  ((mMap[8] & 0x7F) << 7) | (mMap[9] & 0x7F));
+    }
+    if (pos + 4 > mMapSize || memcmp(mMap + pos, "fLaC", 4)) return false;
+    pos += 4;
+
+    bool have_info = false, last = false;
+    while (!last && pos + 4 <= mMapSize) {
+      last = (mMap[pos] & 0x80) != 0;
+      int type = mMap[pos] & 0x7F;
+      size_t length = (mMap[pos + 1] << 16) | (mMap[pos + 2] << 8) | mMap[pos + 3];
+      pos += 4;
+      if (type == 0 && length >= 34 && pos + 34 <= mMapSize) {
+        BitReader br(mMap, mMapSize, (pos + 10) * 8);
+        mFrameRate = br.bits(20);
+        mNumChannels = br.bits(3) + 1;
+        mFlacBitsPerSample = br.bits(5) + 1;
+        uint64_t total = (uint64_t)br.bits(4) << 32;
+        total |= br.bits(32);
+        mNumSamples = (unsigned long)total;
+        have_info = true;
+      }
+      pos += length;
+    }
+    if (!have_info || pos > mMapSize) return false;
+
+    mEncoding = FLAC;
+    mBytesPerSample = (mFlacBitsPerSample + 7) / 8;
+    mFlacFirstFrame = mFlacPos = pos;
+    mFlacSample = 0;
+    mFlacIndex.push_back(FlacIndexEntry(0, pos));
+
+    // the stream did not record its length: count it once
+    if (mNumSamples == 0) {
+      long frames;
+      while ((frames = decodeFLACFrame(NULL)) > 0) mNumSamples += frames;
+      seekFLAC(0);
+    }
+    return true;
+  }
+
+  // decode the frame at mFlacPos, mapping it to mOutChannels floats appended
+  // to out (if not NULL).  returns the number of frames, or 0 at the end of
+  // the stream or on a damaged frame
+  long decodeFLACFrame(vector<float> *out) {
+    if (mFlacPos + 2 > mMapSize) return 0;
+    BitReader br(mMap, mMapSize, mFlacPos * 8);
+    if (br.bits(14) != 0x3FFE) return 0;
+    br.bits(2);
+    uint32_t bs_code = br.bits(4);
+    uint32_t sr_code = br.bits(4);
+    uint32_t ch_code = br.bits(4);
+    uint32_t ss_code = br.bits(3);
+    br.bits(1);
+
+    // frame or sample number, UTF-8 style
+    uint32_t first = br.bits(8);
+    int ones = 0;
+    while (ones < 8 && (first & (0x80 >> ones))) ones++;
+    for (int i = 1; i < ones; i++) br.bits(8);
+
+    long block;
+    if (bs_code == 1) {
+      block = 192;
+    } else if (bs_code >= 2 && bs_code <= 5) {
+      block = 576 << (bs_code - 2);
+    } else if (bs_code == 6) {
+      block = br.bits(8) + 1;
+    } else if (bs_code == 7) {
+      block = br.bits(16) + 1;
+    } else if (bs_code >= 8) {
+      block = 256 << (bs_code - 8);
+    } else {
+      return 0;
+    }
+    if (sr_code == 12) {
+      br.bits(8);
+    } else if (sr_code == 13 || sr_code == 14) {
+      br.bits(16);
+    }
+    br.bits(8);  // header crc
+
+    static const int sample_sizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    int bps = ss_code == 0 ? mFlacBitsPerSample : sample_sizes[ss_code];
+    if (bps == 0) return 0;
+    int channels = ch_code < 8 ? ch_code + 1 : 2;
+    if (ch_code > 10 || channels != (int)mNumChannels) return 0;
+
+    if ((long)mFlacChannels.size() < channels) mFlacChannels.resize(channels);
+    for (int c = 0; c < channels; c++) {
+      // the side channel carries one extra bit
+      bool side = (ch_code == 8 && c == 1) || (ch_code == 9 && c == 0) ||
+                  (ch_code == 10 && c == 1);
+      mFlacChannels[c].resize(block);
+      if (!decodeFLACSubframe(br, &mFlacChannels[c][0], block, bps + side))
+        return 0;
+    }
+    br.alignToByte();
+    br.bits(16);  // frame crc
+
+    if (ch_code >= 8) {
+      int32_t *a = &mFlacChannels[0][0], *b = &mFlacChannels[1][0];
+      for (long i = 0; i < block; i++) {
+        if (ch_code == 8) {  // left, side
+          b[i] = a[i] - b[i];
+        } else if (ch_code == 9) {  // side, right
+          a[i] += b[i];
+        } else {  // mid, side
+          int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+          a[i] = (mid + b[i]) >> 1;
+          b[i] = (mid - b[i]) >> 1;
+        }
+      }
+    }
+
+    mFlacPos = br.bitpos >> 3;
+    mFlacSample += block;
+    if (mFlacSample > mFlacIndex.back().sample)
+      mFlacIndex.push_back(FlacIndexEntry(mFlacSample, mFlacPos));
+
+    if (out != NULL) {
+      const float scale = 1.0f / (float)(1u << (mFlacBitsPerSample - 1));
+      size_t offset = out->size();
+      out->resize(offset + block * mOutChannels);
+      float *dst = &(*out)[offset];
+      for (long i = 0; i < block; i++) {
+        if (channels == mOutChannels) {
+          for (int c = 0; c < channels; c++)
+            *dst++ = mFlacChannels[c][i] * scale;
+        } else if (mOutChannels == 1) {
+          float sum = 0;
+          for (int c = 0; c < channels; c++) sum += mFlacChannels[c][i];
+          *dst++ = sum * scale / channels;
+        } else {
+          for (int c = 0; c < mOutChannels; c++)
+            *dst++ = mFlacChannels[c % channels][i] * scale;
+        }
+      }
+    }
+    return block;
+  }
+
+  bool decodeFLACSubframe(BitReader &br, int32_t *out, long block, int bps) {
+    br.bits(1);
+    uint32_t type = br.bits(6);
+    int wasted = 0;
+    if (br.bits(1)) wasted = br.unary() + 1;
+    bps -= wasted;
+
+    if (type == 0) {
+      int32_t v = br.sbits(bps);
+      for (long i = 0; i < block; i++) out[i] = v;
+    } else if (type == 1) {
+      for (long i = 0; i < block; i++) out[i] = br.sbits(bps);
+    } else if (type >= 8 && type <= 12) {
+      int order = type - 8;
+      for (int i = 0; i < order; i++) out[i] = br.sbits(bps);
+      if (!decodeFLACResidual(br, out, block, order)) return false;
+      for (long i = order; i < block; i++) {
+        int64_t pred = 0;
+        switch (order) {
+          case 1: pred = out[i - 1]; break;
+          case 2: pred = 2 * (int64_t)out[i - 1] - out[i - 2]; break;
+          case 3:
+            pred = 3 * ((int64_t)out[i - 1] - out[i - 2]) + out[i - 3];
+            break;
+          case 4:
+            pred = 4 * ((int64_t)out[i - 1] + out[i - 3]) -
+                   6 * (int64_t)out[i - 2] - out[i - 4];
+            break;
+        }
+        out[i] += (int32_t)pred;
+      }
+    } else if (type >= 32) {
+      int order = type - 31;
+      for (int i = 0; i < order; i++) out[i] = br.sbits(bps);
+      int precision = br.bits(4) + 1;
+      if (precision == 16) return false;
+      int shift = br.sbits(5);
+      if (shift < 0) shift = 0;
+      int32_t coefs[32];
+      for (int i = 0; i < order; i++) coefs[i] = br.sbits(precision);
+      if (!decodeFLACResidual(br, out, block, order)) return false;
+      for (long i = order; i < block; i++) {
+        int64_t sum = 0;
+        for (int j = 0; j < order; j++) sum += (int64_t)coefs[j] * out[i - 1 - j];
+        out[i] += (int32_t)(sum >> shift);
+      }
+    } else {
+      return false;
+    }
+
+    if (wasted) {
+      for (long i = 0; i < block; i++) out[i] <<= wasted;
+    }
+    return true;
+  }
+
+  // partitioned Rice coded residual, written to out[order...]
+  bool decodeFLACResidual(BitReader &br, int32_t *out, long block, int order) {
+    uint32_t method = br.bits(2);
+    if (method > 1) return false;
+    int param_bits = method == 0 ? 4 : 5;
+    uint32_t escape = method == 0 ? 15 : 31;
+    int partition_order = br.bits(4);
+    long partitions = 1L << partition_order;
+    long idx = order;
+    for (long p = 0; p < partitions; p++) {
+      long n = (block >> partition_order) - (p == 0 ? order : 0);
+      if (n < 0 || idx + n > block) return false;
+      uint32_t k = br.bits(param_bits);
+      if (k == escape) {
+        int raw = br.bits(5);
+        for (long i = 0; i < n; i++) out[idx++] = br.sbits(raw);
+      } else {
+        for (long i = 0; i < n; i++) {
+          // two statements: the quotient has to be read before the remainder
+          uint32_t q = br.unary();
+          uint32_t u = (q << k) | br.bits(k);
+          out[idx++] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+        }
+      }
+    }
+    return true;
+  }
+
+  // restart decoding at the last known frame at or before sample
+  void seekFLAC(long sample) {
+    size_t lo = 0, hi = mFlacIndex.size();
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (mFlacIndex[mid].sample <= sample)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    mFlacSample = mFlacIndex[lo].sample;
+    mFlacPos = mFlacIndex[lo].offset;
+  }
+
+  // make the cache start at or before sample and hold around kBlockFrames
+  bool fillFLAC(long sample) {
+    if (sample < mFlacSample) seekFLAC(sample);
+    mBlock.clear();
+    mBlockStart = mFlacSample;
+    mBlockFrames = 0;
+    while (mBlockStart + mBlockFrames <= sample ||
+           mBlockFrames < kBlockFrames) {
+      long frames = decodeFLACFrame(&mBlock);
+      if (frames == 0) break;
+      mBlockFrames += frames;
+      // drop whole frames that end before the wanted position
+      if (mBlockStart + mBlockFrames <= sample) {
+        mBlock.clear();
+        mBlockStart += mBlockFrames;
+        mBlockFrames = 0;
+      }
+    }
+    return sample >= mBlockStart && sample < mBlockStart + mBlockFrames;
+  }
+
+  bool readFLAC(float *target, long start, long count) {
+    while (count > 0) {
+      if (start < mBlockStart || start >= mBlockStart + mBlockFrames) {
+        if (!fillFLAC(start)) {
+          memset(target, 0, sizeof(float) * count * mOutChannels);
+          return false;
+        }
+      }
+      long offset = start - mBlockStart;
+      long n = mBlockFrames - offset;
+      if (n > count) n = count;
+      memcpy(target, &mBlock[offset * mOutChannels],
+             sizeof(float) * n * mOutChannels);
+      target += n * mOutChannels;
+      start += n;
+      count -= n;
+    }
+    return true;
+  }
+
+  // frames [start, start + count) at the file's rate, all within the file
+  bool readNative(float *target, long start, long count) {
+    if (mEncoding == FLAC) {
+      return readFLAC(target, start, count);
+    }
+    convertPCM(mData + start * mFrameBytes, count, target);
+    return true;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // sample rate conversion
+
+  // convert the kBlockFrames output frames from start into mOut, reading
+  // the file frames they depend on (zeros before and after the file)
+  bool fillResampled(long start) {
+    long count = (long)mNumSamples - start;
+    if (count > kBlockFrames) count = kBlockFrames;
+    long first, length;
+    mResampler.inputRange(start, count, first, length);
+
+    mIn.assign(length * mOutChannels, 0.0f);
+    long begin = first < 0 ? 0 : first;
+    long end = first + length;
+    if (end > (long)mNativeSamples) end = (long)mNativeSamples;
+    bool ok = true;
+    if (end > begin) {
+      ok = readNative(&mIn[(begin - first) * mOutChannels], begin, end - begin);
+    }
+
+    mOut.resize(count * mOutChannels);
+    mPlanar.resize(length);
+    for (int c = 0; c < mOutChannels; c++) {
+      const float *in = &mIn[c];
+      for (long i = 0; i < length; i++) mPlanar[i] = in[i * mOutChannels];
+      mResampler.process(&mPlanar[0], first, start, count, &mOut[c],
+                         mOutChannels);
+    }
+    mOutStart = start;
+    mOutFrames = count;
+    return ok;
+  }
+
+  bool readResampled(float *target, long start, long count) {
+    bool ok = true;
+    while (count > 0) {
+      if (start < mOutStart || start >= mOutStart + mOutFrames) {
+        ok = fillResampled(start) && ok;
+      }
+      long offset = start - mOutStart;
+      long n = mOutFrames - offset;
+      if (n > count) n = count;
+      memcpy(target, &mOut[offset * mOutChannels],
+             sizeof(float) * n * mOutChannels);
+      target += n * mOutChannels;
+      start += n;
+      count -= n;
+    }
+    return ok;
+  }
+
+  struct FlacIndexEntry {
+    FlacIndexEntry(long s, size_t o) : sample(s), offset(o) {}
+    long sample;
+    size_t offset;
+  };
+
+  const uint8_t *mMap;
+  size_t mMapSize;
+  const uint8_t *mData;
+  size_t mDataBytes, mFrameBytes;
+  Encoding mEncoding;
+  bool mBigEndian;
+  int mOutChannels;
+
+  // decoded FLAC frames [mBlockStart, mBlockStart + mBlockFrames)
+  vector<float> mBlock;
+  long mBlockStart, mBlockFrames;
+
+  // file length at its own rate (mNumSamples is at the requested rate)
+  unsigned long mNativeSamples;
+
+  // converted frames [mOutStart, mOutStart + mOutFrames), and scratch for
+  // the file frames they were made from
+  pkmResampler mResampler;
+  bool mResampling;
+  vector<float> mOut, mIn, mPlanar;
+  long mOutStart, mOutFrames;
+
+  vector<vector<int32_t> > mFlacChannels;
+  vector<FlacIndexEntry> mFlacIndex;
+  size_t mFlacPos, mFlacFirstFrame;
+  long mFlacSample;
+  int mFlacBitsPerSample;
+};
@@ -113,7 +113,7 @@ public:
 	~pkmAudioFeatures();
     
     // 12 features + 12 optional delta
-    void computeMelFeatures(float *inputSignal,
+    void computeMelFeatures(const float *inputSignal,
                             float *outputFeatures,
                             int numFilters = -1,
                             bool computeLogAmplitude = true,
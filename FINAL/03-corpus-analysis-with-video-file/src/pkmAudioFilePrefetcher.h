@@ -0,0 +1,174 @@
+/*
+ *  pkmAudioFilePrefetcher.h
+ *
+ *  Decodes a pkmAudioFileReader on a background thread into a small pool of
+ *  large blocks, so that reading the file and analysing what has already
+ *  been read happen at the same time.
+ *
+ *  At most max_blocks decoded blocks exist at once: once they are all
+ *  waiting to be analysed the decoder sleeps until one is released, so a
+ *  multi-hour file never sits in memory all at once (backpressure).
+ *  acquire()/release() may be called from any number of analysis threads;
+ *  blocks are handed out in file order and carry their start frame so
+ *  results can be put back in order.
+ *
+ *  Usage:
+ *
+ *  pkmAudioFilePrefetcher prefetcher;
+ *  prefetcher.start(&reader, 64 * 1024);
+ *  pkmAudioFilePrefetcher::Block block;
+ *  while (prefetcher.acquire(block)) {
+ *      analyse(block.data, block.frames);
+ *      prefetcher.release(block);
+ *      printf("%.0f%%\n", prefetcher.getProgress() * 100.0);
+ *  }
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pkmAudioFileReader.h"
+
+class pkmAudioFilePrefetcher {
+ public:
+  struct Block {
+    long start;         // first frame of the block in the file
+    long frames;        // number of frames (the last block may be short)
+    const float *data;  // frames * channels interleaved floats
+    int slot;
+  };
+
+  pkmAudioFilePrefetcher()
+      : mReader(NULL), mBlockFrames(0), mTotalFrames(0), mNextFrame(0),
+        mChannels(1), mDecoded(0), mRunning(false), mFinished(true),
+        mStopping(false) {}
+  ~pkmAudioFilePrefetcher() { stop(); }
+
+  // start decoding reader (already opened) from its first frame, in blocks
+  // of block_frames frames, holding at most max_blocks of them
+  void start(pkmAudioFileReader *reader, long block_frames = 1 << 16,
+             int max_blocks = 4) {
+    stop();
+    mReader = reader;
+    mBlockFrames = block_frames;
+    mChannels = reader->getOutputChannels();
+    mTotalFrames = reader->mNumSamples;
+    mNextFrame = 0;
+    mDecoded = 0;
+    mFinished = false;
+    mStopping = false;
+
+    mSlots.assign(max_blocks, vector<float>(block_frames * mChannels));
+    mFree.clear();
+    mReady.clear();
+    for (int i = 0; i < max_blocks; i++) mFree.push_back(i);
+
+    mRunning = true;
+    mThread = std::thread(&pkmAudioFilePrefetcher::decode, this);
+  }
+
+  // wait for the next decoded block; false once the whole file has been
+  // handed out (or after stop())
+  bool acquire(Block &block) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mReadyCondition.wait(lock, [this] {
+      return !mReady.empty() || mFinished || mStopping;
+    });
+    if (mReady.empty()) return false;
+    block = mReady.front();
+    mReady.pop_front();
+    return true;
+  }
+
+  // give a block's memory back to the decoder
+  void release(const Block &block) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mFree.push_back(block.slot);
+    }
+    mFreeCondition.notify_one();
+  }
+
+  // fraction of the file decoded so far
+  float getProgress() const {
+    return mTotalFrames > 0 ? (float)mDecoded.load() / (float)mTotalFrames
+                            : 1.0f;
+  }
+
+  long getFramesDecoded() const { return mDecoded.load(); }
+
+  // stop the decoder; blocks already acquired stay valid until the next
+  // start()
+  void stop() {
+    if (!mRunning) return;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+    }
+    mFreeCondition.notify_all();
+    mReadyCondition.notify_all();
+    mThread.join();
+    mRunning = false;
+  }
+
+ private:
+  void decode() {
+    while (true) {
+      int slot;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFreeCondition.wait(lock, [this] { return !mFree.empty() || mStopping; });
+        if (mStopping) break;
+        slot = mFree.front();
+        mFree.pop_front();
+      }
+
+      long frames = mTotalFrames - mNextFrame;
+      if (frames > mBlockFrames) frames = mBlockFrames;
+      if (frames <= 0) break;
+
+      // the slow part runs without the lock
+      mReader->read(&mSlots[slot][0], mNextFrame, frames);
+
+      Block block;
+      block.start = mNextFrame;
+      block.frames = frames;
+      block.data = &mSlots[slot][0];
+      block.slot = slot;
+      mNextFrame += frames;
+      mDecoded.store(mNextFrame);
+
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mReady.push_back(block);
+      }
+      mReadyCondition.notify_one();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mFinished = true;
+    }
+    mReadyCondition.notify_all();
+  }
+
+  pkmAudioFileReader *mReader;
+  long mBlockFrames, mTotalFrames, mNextFrame;
+  int mChannels;
+  std::atomic<long> mDecoded;
+
+  vector<vector<float> > mSlots;
+  std::deque<int> mFree;
+  std::deque<Block> mReady;
+
+  std::mutex mMutex;
+  std::condition_variable mFreeCondition, mReadyCondition;
+  std::thread mThread;
+  bool mRunning, mFinished, mStopping;
+};
@@ -107,7 +107,7 @@ Mat::Mat(const std::vector<float> m) {
   rows = 1;
   cols = m.size();
   if (rows * cols > 0) {
-    data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(cols));
+    data = alignedMalloc(cols);
     cblas_scopy(cols, &m[0], 1, data, 1);
   }
   current_row = 0;
@@ -120,7 +120,7 @@ Mat::Mat(const std::vector<std::vector<float> > m) {
   rows = m.size();
   cols = m[0].size();
   if (rows * cols > 0) {
-    data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(rows * cols));
+    data = alignedMalloc(rows * cols);
 
     for (size_t i = 0; i < rows; i++)
       cblas_scopy(cols, &(m[i][0]), 1, data + i * cols, 1);
@@ -136,7 +136,7 @@ Mat::Mat(const std::vector<std::vector<float> > m) {
 Mat::Mat(const cv::Mat &m) {
   rows = m.rows;
   cols = m.cols;
-  data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(rows * cols));
+  data = alignedMalloc(rows * cols);
 
   for (size_t i = 0; i < rows; i++)
     cblas_scopy(cols, m.ptr<float>(i), 1, data + i * cols, 1);
@@ -161,13 +161,13 @@ Mat::Mat(size_t r, size_t c, bool clear) {
   cols = c;
   current_row = 0;
   bCircularInsertionFull = false;
-  data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+  data = alignedMalloc(rows * cols);
 
   bAllocated = true;
 
   // set every element to 0
   if (clear) {
-    vDSP_vclr(data, 1, MULTIPLE_OF_4(rows * cols));
+    vDSP_vclr(data, 1, rows * cols);
   }
 }
 
@@ -184,7 +184,7 @@ Mat::Mat(size_t r, size_t c, const float *existing_buffer) {
   current_row = 0;
   bCircularInsertionFull = false;
 
-  data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+  data = alignedMalloc(rows * cols);
 
   cblas_scopy(rows * cols, existing_buffer, 1, data, 1);
 
@@ -205,7 +205,7 @@ Mat::Mat(size_t r, size_t c, float *existing_buffer, bool withCopy) {
   bCircularInsertionFull = false;
 
   if (withCopy) {
-    data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+    data = alignedMalloc(rows * cols);
 
     cblas_scopy(rows * cols, existing_buffer, 1, data, 1);
     // memcpy(data, existing_buffer, sizeof(float)*r*c);
@@ -228,12 +228,36 @@ Mat::Mat(size_t r, size_t c, float val) {
   current_row = 0;
   bCircularInsertionFull = false;
 
-  data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+  data = alignedMalloc(rows * cols);
 
   bAllocated = true;
 
   // set every element to val
-  vDSP_vfill(&val, data, 1, MULTIPLE_OF_4(rows * cols));
+  vDSP_vfill(&val, data, 1, rows * cols);
+}
+
+// borrow storage from a frame arena
+// the arena owns the memory, so this behaves like user data and is
+// never freed by the matrix
+Mat::Mat(size_t r, size_t c, Arena &arena, bool clear) {
+#ifdef DEBUG
+  assert(r > 0);
+  assert(c > 0);
+#endif
+
+  rows = r;
+  cols = c;
+  current_row = 0;
+  bCircularInsertionFull = false;
+
+  data = arena.allocate(rows * cols);
+
+  bUserData = true;
+  bAllocated = false;
+
+  if (clear) {
+    vDSP_vclr(data, 1, rows * cols);
+  }
 }
 
 // copy-constructor, called during:
@@ -247,7 +271,7 @@ Mat::Mat(const Mat &rhs) {
     bCircularInsertionFull = rhs.bCircularInsertionFull;
     bUserData = false;
     if (rows * cols > 0) {
-      data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+      data = alignedMalloc(rows * cols);
       memcpy(data, rhs.data, rows * cols * sizeof(float));
     }
     bAllocated = true;
@@ -286,7 +310,7 @@ Mat &Mat::operator=(const Mat &rhs) {
       rows = rhs.rows;
       cols = rhs.cols;
 
-      data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+      data = alignedMalloc(rows * cols);
       memcpy(data, rhs.data, sizeof(float) * rows * cols);
       bAllocated = true;
     }
@@ -321,7 +345,7 @@ Mat &Mat::operator=(const std::vector<float> &rhs) {
 
       releaseMemory();
 
-      data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+      data = alignedMalloc(rows * cols);
 
       bAllocated = true;
     }
@@ -357,7 +381,7 @@ Mat &Mat::operator=(const std::vector<std::vector<float> > &rhs) {
 
       releaseMemory();
 
-      data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+      data = alignedMalloc(rows * cols);
 
       bAllocated = true;
     }
@@ -395,7 +419,7 @@ Mat &Mat::operator=(const cv::Mat &rhs) {
 
       releaseMemory();
 
-      data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+      data = alignedMalloc(rows * cols);
 
       bAllocated = true;
     }
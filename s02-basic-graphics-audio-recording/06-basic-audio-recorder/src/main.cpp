@@ -1,4 +1,5 @@
 #include "ofMain.h"
+#include "pkmAudioFileWriter.h"
 
 
 // declare the padbutton class and methods
@@ -146,6 +147,7 @@ public:
         bRecording = false;
         bPlaying = false;
         bRecorded = false;
+        bReading = false;
         bForward = true;
         
         // which audio frame am i currently playing back
@@ -153,6 +155,7 @@ public:
         
         // how many audio frames did we record?
         numFrames = 0;
+        buffer = NULL;
         
         width = 480;
         height = 320;
@@ -160,6 +163,11 @@ public:
         
         sampleRate = 44100;
         initialBufferSize = 512;
+        
+        // everything we record goes to a file on disk.  the writer sets aside
+        // all the memory it needs now, so recording never has to ask for more
+        // while the audio is running
+        writer.open(ofToDataPath("recording.wav"), sampleRate);
         ofSoundStreamSetup(1, 1, this, sampleRate, initialBufferSize, 4);
     }
     
@@ -224,11 +232,30 @@ public:
         if(button_play.released(x, y))
             bPlaying = false;
         if(button_record.released(x, y))
+        {
             bRecording = false;
+            
+                // look at everything recorded so far, straight out of the file.
+                // that replaces the last look we had, so first stop the audio
+                // thread from playing it: once bRecorded is false audioOut
+                // won't start reading buffer again, and if it already had, we
+                // wait for it to finish before the old memory goes away.
+            bRecorded = false;
+            while(bReading) {
+                this_thread::yield();
+            }
+            long recordedFrames;
+            buffer = writer.getRecordedFrames(recordedFrames);
+            numFrames = recordedFrames / initialBufferSize;
+            bRecorded = numFrames > 1;
+        }
     }
     
     void audioOut(float * output, int bufferSize, int nChannels) {
         
+            // tell mouseReleased we might be reading buffer until we're done here
+        bReading = true;
+        
             // if we are playing back audio (if the user is pressing the play button)
         if(bPlaying && bRecorded)
         {
@@ -274,6 +301,8 @@ public:
         else {
             memset(output, 0, nChannels * bufferSize * sizeof(float));
         }
+        
+        bReading = false;
     }
 
     void audioIn(float * input, int bufferSize, int nChannels) {
@@ -286,19 +315,12 @@ public:
             // if we are recording
         if(bRecording)
         {
-                // let's add the current frame of audio input to our recording buffer.  this is 512 samples.
-                // (note: another way to do this is to copy the whole chunk of memory using memcpy)
-            for (int i = 0; i < bufferSize; i++)
-            {
-                    // we will add a sample at a time to the back of the buffer, increasing the size of "buffer"
-                buffer.push_back(input[i]);
-            }
-            
-                // we also need to keep track of how many audio "frames" we have.  this is how many times
-                // we have recorded a chunk of 512 samples.  we refer to that chunk of 512 samples as 1 frame.
-            numFrames++;
-            
-            bRecorded = true;
+                // let's add the current frame of audio input to our recording.  this is 512 samples.
+                // the writer copies them into memory it set aside in setup() and
+                // a separate thread saves them to disk, so this returns straight away
+                // (growing a vector here would mean asking for memory on the audio
+                // thread, which can make the audio glitch in a long session)
+            writer.write(input, bufferSize);
         }
             // otherwise we set the input to 0
         else
@@ -319,8 +341,11 @@ private:
     int                 initialBufferSize,
                         sampleRate;
     
-    // this vector will store our audio recording
-    vector<float>       buffer;
+    // this saves our audio recording to disk
+    pkmAudioFileWriter  writer;
+    
+    // and this points at the recording, read back from the file
+    const float         *buffer;
     
     // frame will tell us "what chunk of audio are we currently playing back".
     // as we record and play back in "chunks" also called "frames", we will need
@@ -328,14 +353,19 @@ private:
     int                 frame;
     
     // frame will run until it hits the final recorded frame, which is numFrames
-    // we increment this value every time we record a new frame of audio
+    // we find this value every time we stop recording
     int                 numFrames;
     
     // our buttons for user interaction
     padButton           button_play, button_record;
     
     // determined based on whether the user has pressed the play or record buttons
-    bool                bRecording, bPlaying, bRecorded, bForward;
+    bool                bRecording, bPlaying, bForward;
+    
+    // these two are shared between the main thread and the audio thread, so
+    // they are atomic: bRecorded says buffer holds a recording we can play,
+    // and bReading that audioOut is in the middle of playing it
+    atomic<bool>        bRecorded, bReading;
     
     // single instance of our padButton class
     // padButton           button1;
@@ -1,4 +1,5 @@
 #include "ofMain.h"
+#include "pkmAudioFileWriter.h"
 
 
 // declare the ButtonPad class and methods
@@ -126,14 +127,42 @@ class AudioPad : public ButtonPad {
 public:
     AudioPad() {
         frame = 0;
-        n_frames = 0;
+        n_samples = 0;
+        buffer = NULL;
         is_recording = false;
         is_playing = false;
         is_recorded = false;
+        is_reading = false;
+        writer = make_shared<pkmAudioFileWriter>();
     }
     
     void setRecording(bool recording) {
-        is_recording = recording;
+        // holding a key down repeats keyPressed, which shouldn't start over
+        if(recording == is_recording) {
+            return;
+        }
+        
+        if(recording) {
+            // every recording starts a new file for this pad, and opening it
+            // throws away the last take.  so first stop the audio thread from
+            // playing it: once is_recorded is false audioOut won't start
+            // reading buffer again, and if it already had, we wait for it
+            // to finish before the memory goes away.
+            is_recorded = false;
+            while(is_reading) {
+                this_thread::yield();
+            }
+            buffer = NULL;
+            writer->open(ofToDataPath(string("pad-") + key + ".wav"));
+            is_recording = true;
+        }
+        else {
+            is_recording = false;
+            // finish the file and read back what we recorded, straight out of it
+            writer->close();
+            buffer = writer->getRecordedFrames(n_samples);
+            is_recorded = n_samples > 0;
+        }
     }
     
     bool isRecording() {
@@ -141,7 +170,7 @@ public:
     }
     
     void toggleRecording() {
-        is_recording = !is_recording;
+        setRecording(!is_recording);
     }
     
     void setPlaying(bool playing) {
@@ -157,7 +186,7 @@ public:
     }
     
     bool hasSamples() {
-        return buffer.size() > 0;
+        return n_samples > 0;
     }
     
     void setKey(char k) {
@@ -180,6 +209,9 @@ public:
     
     void audioOut(float * output, int buffer_size, int n_channels) {
 
+        // tell setRecording() we might be reading buffer until we're done here
+        is_reading = true;
+        
         // if we are playing back audio (if the user is pressing the play button)
         if(is_playing && is_recorded) {
             // we set the output to be our recorded buffer
@@ -198,7 +230,7 @@ public:
             
             // check if the frame counter has reached the end of the recorded
             // buffer.  if so, then we should go back to the start again
-            if (frame > (buffer.size() / buffer_size)) {
+            if ((frame + 1) * buffer_size > n_samples) {
                 frame = 0;
             }
         }
@@ -206,25 +238,19 @@ public:
         else {
             memset(output, 0, n_channels * buffer_size * sizeof(float));
         }
+        
+        is_reading = false;
     }
     
     void audioIn(float * input, int buffer_size, int n_channels) {
         
         // if we are recording
         if(is_recording) {
-            // let's add the current frame of audio input to our recording buffer.  this is 512 samples.
-            // (note: another way to do this is to copy the whole chunk of memory using memcpy)
-            for (int i = 0; i < buffer_size; i++)
-            {
-                // we will add a sample at a time to the back of the buffer, increasing the size of "buffer"
-                buffer.push_back(input[i]);
-            }
-            
-            // we also need to keep track of how many audio "frames" we have.  this is how many times
-            // we have recorded a chunk of 512 samples.  we refer to that chunk of 512 samples as 1 frame.
-            n_frames++;
-            
-            is_recorded = true;
+            // let's add the current frame of audio input to our recording.  this is 512 samples.
+            // the writer copies them into memory it set aside when the recording
+            // started, and saves them to disk on its own thread, so we never have
+            // to wait for memory or for the disk here
+            writer->write(input, buffer_size);
         }
         // otherwise we set the input to 0
         else {
@@ -236,20 +262,27 @@ public:
     
     char                key;
     
-    // this vector will store our audio recording
-    vector<float>       buffer;
+    // this saves our audio recording to disk
+    shared_ptr<pkmAudioFileWriter> writer;
+    
+    // and this points at the recording, read back from the file
+    const float         *buffer;
     
     // frame will tell us "what chunk of audio are we currently playing back".
     // as we record and play back in "chunks" also called "frames", we will need
     // to keep track of which frame we are playing during playback
     int                 frame;
     
-    // frame will run until it hits the final recorded frame, which is n_frames
-    // we increment this value every time we record a new frame of audio
-    int                 n_frames;
+    // frame will run until it hits the end of the recording, which is n_samples long
+    long                n_samples;
     
     // determined based on whether the user has pressed the play or record buttons
-    bool                is_recording, is_playing, is_recorded;
+    bool                is_recording, is_playing;
+    
+    // these two are shared between the main thread and the audio thread, so
+    // they are atomic: is_recorded says buffer holds a take we can play, and
+    // is_reading that audioOut is in the middle of playing it
+    atomic<bool>        is_recorded, is_reading;
 
 };
 
@@ -269,8 +302,10 @@ public:
         
         is_recording = true;
         
-        // we allow our vector to have 4 ButtonPads, which we index from 0 - 3
-        buttons.resize(n_buttons * n_buttons);
+        // we allow our vector to have 16 AudioPads, which we index from 0 - 15.
+        // an AudioPad can't be copied or moved (it has atomics in it), so we
+        // make the vector at its full size in one go rather than resizing it
+        buttons = vector<AudioPad>(n_buttons * n_buttons);
         
         // make two buttons in the same position, and we'll toggle between these
         button_record.load("button-record.png", "button-record.png");
@@ -383,7 +418,6 @@ public:
         for (int i = 0; i < buttons.size(); i++) {
             if(buttons[i].pressed(x, y)) {
                 if(is_recording) {
-                    buttons[i].buffer.resize(0);
                     buttons[i].setRecording(true);
                 }
                 else {
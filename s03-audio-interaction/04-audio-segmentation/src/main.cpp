@@ -1,4 +1,5 @@
 #include "ofMain.h"
+#include "pkmOnsetDetector.h"
 
 
 class App : public ofBaseApp{
@@ -20,7 +21,8 @@ public:
         total_samples = 0;
         
         audio_input.resize(buffer_size);
-        rms_values.resize(sample_rate / buffer_size);
+        onsets.setup(sample_rate);
+        grain_start = 0;
         ofSoundStreamSetup(1, 1, sample_rate, buffer_size, 3);
     }
     
@@ -120,62 +122,33 @@ public:
             return;
         }
         
-        // add all the audio input values
-        float total = 0;
-        for (int i = 0; i < buffer_size; i++) {
-            // we add the "square" of each value so that negative numbers
-            // become positive.  this is like thinking of the "magnitude"
-            total = total + (input[i] * input[i]);
-        }
-        // the "mean" part of the RMS, we divide by the number of audio input samples
-        // we added in the for loop above
-        total = total / (float)buffer_size;
-        
-        // the "root" part of RMS, we take the square root to get our RMS reading for the
-        // current chunk of audio input values
-        rms = sqrt(total);
-        
-        // calculate the average of the rms values
-        float average_rms = 0.0f;
-        for (int i = 0; i < rms_values.size(); i++) {
-            average_rms = average_rms + rms_values[i];
-        }
-        average_rms = average_rms / rms_values.size();
-        
-        // calculate the variance of the rms values
-        float var_rms = 0.0f;
-        for (int i = 0; i < rms_values.size(); i++) {
-            var_rms = var_rms + abs(rms_values[i] - average_rms);
-        }
-        var_rms = var_rms / rms_values.size();
-        
-        // now we see if the current value is outside the mean + variance
-        // basic statistics tells us a normally distributed function
-        // has a mean and a variance where 97% of the data is explained by
-        // 3 standard deviations.  we use this principle here in detecting
-        // the the current rms reading is outside this probability
-        float min_rms = 0.01;
-        if (rms > (average_rms + 2.0 * var_rms) &&
-            rms > min_rms &&
-            current_grain.size() > min_samples_per_grain) {
-            grains.push_back(current_grain);
-            current_grain.resize(0);
-        }
+        // the onset detector compares the spectrum of each short frame of
+        // audio with the one before it, and looks for the moments where the
+        // frequencies grow much more than they have been lately.  that is
+        // only a little work for each new block of audio, and it also
+        // catches soft or pitched onsets that hardly change the loudness.
+        onsets.process(input, buffer_size);
         
         for (int i = 0; i < buffer_size; i++) {
             current_grain.push_back(input[i]);
         }
         total_samples += buffer_size;
         
-        // add the current rms value
-        rms_values.push_back(rms);
-        
-        // we only keep a maximum of 1 second of the rms readings
-        if (rms_values.size() > (sample_rate / buffer_size)) {
-            // then we delete the first one
-            rms_values.erase(rms_values.begin(), rms_values.begin() + 1);
+        // every onset starts a new grain, as long as the current one is
+        // long enough.  the detector tells us where the onset was to within
+        // a few samples, a little after it happened, so the audio we have
+        // after the onset moves on to the new grain.
+        pkmOnsetDetector::Onset onset;
+        while (onsets.popOnset(onset)) {
+            int length = onset.sample - grain_start;
+            if (length > min_samples_per_grain) {
+                grains.push_back(vector<float>(current_grain.begin(),
+                                               current_grain.begin() + length));
+                current_grain.erase(current_grain.begin(),
+                                    current_grain.begin() + length);
+                grain_start = onset.sample;
+            }
         }
-
     }
     
 
@@ -188,9 +161,8 @@ private:
     int                     sample_rate,
                             buffer_size;
     
-    float                   rms;
-    
-    vector<float>           rms_values;
+    pkmOnsetDetector        onsets;
+    long                    grain_start;
     
     vector<vector<float>>   grains;
     vector<float>           current_grain;
@@ -0,0 +1,291 @@
+/*
+ *  pkmOnsetDetector.h
+ *
+ *  Streaming onset detection on top of pkmFFT.
+ *
+ *  Audio is fed in blocks of any size.  Every hop_size samples one windowed
+ *  frame is transformed and reduced to a single detection function value:
+ *
+ *  - SPECTRAL_FLUX: the sum over bins of the rise in log-compressed
+ *    magnitude since the previous frame.  Responds to any new energy.
+ *  - COMPLEX_DOMAIN: the rectified distance of each bin from where its
+ *    magnitude and phase were heading (Bello et al. / Dixon), which also
+ *    catches soft, pitched onsets that barely change the energy.
+ *
+ *  Both are O(bins) per hop on top of the FFT.  A hop is an onset when its
+ *  value is a local peak, exceeds offset + multiplier x the median of the
+ *  last median_hops values, and is at least min_interval samples after the
+ *  previous onset.  The peak's position is refined between hops with a
+ *  parabola, so onsets are reported to within a fraction of a hop rather
+ *  than to the audio block they were found in.
+ *
+ *  Onsets are reported one hop after their peak, and are pushed to a
+ *  single-producer, single-consumer queue: process() is called from one
+ *  thread (e.g. audioIn) and popOnset() from one other thread, or the same
+ *  one.  Neither allocates or locks.
+ *
+ *  Usage:
+ *
+ *  pkmOnsetDetector onsets;
+ *  onsets.setup(44100);
+ *  onsets.process(input, buffer_size);         // audio thread
+ *  pkmOnsetDetector::Onset o;
+ *  while (onsets.popOnset(o)) cut(o.sample);   // any one thread
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "pkmFFT.h"
+
+using namespace std;
+
+#ifndef PKM_CACHE_LINE
+#define PKM_CACHE_LINE 64
+#endif
+
+class pkmOnsetDetector {
+ public:
+  enum Method { SPECTRAL_FLUX, COMPLEX_DOMAIN };
+
+  struct Onset {
+    long sample;     // position in the samples given to process()
+    float strength;  // detection function at the peak
+  };
+
+  pkmOnsetDetector()
+      : mFFT(NULL), mQueueSize(0), mQueueHead(0), mQueueTail(0),
+        mDropped(0) {}
+  ~pkmOnsetDetector() { delete mFFT; }
+
+  // fft_size must be a power of two.  the queue holds queue_size onsets
+  // that have not been popped yet.
+  void setup(int sample_rate, int fft_size = 1024, int hop_size = 256,
+             Method method = SPECTRAL_FLUX, int queue_size = 64) {
+    delete mFFT;
+    mFFT = new pkmFFT(fft_size);
+    mSampleRate = sample_rate;
+    mFFTSize = fft_size;
+    mHopSize = hop_size;
+    mBins = fft_size / 2;
+    mMethod = method;
+
+    mFrame.assign(fft_size, 0.0f);
+    mMagnitude.assign(mBins, 0.0f);
+    mPhase.assign(mBins, 0.0f);
+    mPrevMagnitude.assign(mBins, 0.0f);
+    mPrevPhase.assign(mBins, 0.0f);
+    mPrevPrevPhase.assign(mBins, 0.0f);
+
+    mQueueSize = queue_size;
+    mQueue.resize(queue_size);
+    mQueueHead = mQueueTail = 0;
+    mDropped = 0;
+
+    // the two functions have different scales: the flux is in log units
+    setThreshold(2.0f, method == SPECTRAL_FLUX ? 3e-4f : 3e-5f);
+    setMinimumInterval(sample_rate / 20);
+    setCompression();
+    reset();
+  }
+
+  // an onset must exceed offset + multiplier x the running median of the
+  // last median_hops detection values.  offset is per bin, and sets how
+  // quiet a sound can start from silence and still count.
+  void setThreshold(float multiplier, float offset, int median_hops = 11) {
+    mMultiplier = multiplier;
+    mOffset = offset;
+    mHistory.assign(max(1, median_hops), 0.0f);
+    mSorted = mHistory;
+    mHistoryPos = 0;
+  }
+
+  // onsets closer together than this many samples are merged
+  void setMinimumInterval(int samples) { mMinInterval = samples; }
+
+  // gamma in log(1 + gamma |X|) for the flux: higher makes quiet partials
+  // count more, and the noise floor with them
+  void setCompression(float gamma = 10.0f) { mGamma = gamma; }
+
+  // start again from silence at sample 0.  anything still queued is kept.
+  void reset() {
+    fill(mFrame.begin(), mFrame.end(), 0.0f);
+    fill(mPrevMagnitude.begin(), mPrevMagnitude.end(), 0.0f);
+    fill(mPrevPhase.begin(), mPrevPhase.end(), 0.0f);
+    fill(mPrevPrevPhase.begin(), mPrevPrevPhase.end(), 0.0f);
+    fill(mHistory.begin(), mHistory.end(), 0.0f);
+    mSorted = mHistory;
+    mFill = 0;
+    mHops = 0;
+    mValue[0] = mValue[1] = mValue[2] = 0.0f;
+    mThreshold[0] = mThreshold[1] = 0.0f;
+    mLastOnset = -(long)mMinInterval - 1;
+  }
+
+  // analyse the next n samples; returns the number of onsets queued
+  int process(const float *input, int n) {
+    int found = 0;
+    while (n > 0) {
+      // the frame holds the last fft_size samples; a hop is complete when
+      // the last hop_size of them are new
+      int take = min(n, mHopSize - mFill);
+      memcpy(&mFrame[mFFTSize - mHopSize + mFill], input, sizeof(float) * take);
+      mFill += take;
+      input += take;
+      n -= take;
+      if (mFill < mHopSize) break;
+
+      found += analyseHop();
+      memmove(&mFrame[0], &mFrame[mHopSize],
+              sizeof(float) * (mFFTSize - mHopSize));
+      mFill = 0;
+    }
+    return found;
+  }
+
+  // consumer: the oldest unread onset, false if there is none
+  bool popOnset(Onset &onset) {
+    long tail = mQueueTail.load(std::memory_order_relaxed);
+    if (tail == mQueueHead.load(std::memory_order_acquire)) return false;
+    onset = mQueue[tail % mQueueSize];
+    mQueueTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // the most recent detection function value and threshold, for drawing
+  float getDetectionFunction() const { return mValue[2]; }
+  float getThreshold() const { return mThreshold[1]; }
+
+  // onsets lost because the queue was full
+  long getNumDropped() const { return mDropped.load(); }
+
+  int getHopSize() const { return mHopSize; }
+
+ private:
+  int analyseHop() {
+    mFFT->forward(0, &mFrame[0], &mMagnitude[0], &mPhase[0]);
+    // so that a full scale sine peaks near 1 whatever the fft size
+    float scale = 2.0f / mFFTSize;
+    vDSP_vsmul(&mMagnitude[0], 1, &scale, &mMagnitude[0], 1, mBins);
+
+    float value = 0;
+    if (mMethod == SPECTRAL_FLUX) {
+      for (int k = 0; k < mBins; k++) {
+        float m = logf(1.0f + mGamma * mMagnitude[k]);
+        float rise = m - mPrevMagnitude[k];
+        if (rise > 0) value += rise;
+        mPrevMagnitude[k] = m;
+      }
+    } else {
+      for (int k = 0; k < mBins; k++) {
+        float m = mMagnitude[k], prev = mPrevMagnitude[k];
+        if (m >= prev) {
+          // distance from prev * e^(i (2 prev_phase - prev_prev_phase))
+          float expected = 2.0f * mPrevPhase[k] - mPrevPrevPhase[k];
+          float d2 = m * m + prev * prev -
+                     2.0f * m * prev * cosf(mPhase[k] - expected);
+          value += d2 > 0 ? sqrtf(d2) : 0.0f;
+        }
+        mPrevMagnitude[k] = m;
+        mPrevPrevPhase[k] = mPrevPhase[k];
+        mPrevPhase[k] = mPhase[k];
+      }
+    }
+    value /= mBins;
+
+    mValue[0] = mValue[1];
+    mValue[1] = mValue[2];
+    mValue[2] = value;
+    mThreshold[0] = mThreshold[1];
+    mThreshold[1] = mOffset + mMultiplier * pushMedian(value);
+    mHops++;
+
+    // the previous hop is a peak above its threshold?  nothing counts until
+    // the median has a full window to adapt to.
+    if (mHops <= (long)mHistory.size() || !(mValue[1] > mValue[0] && mValue[1] >= mValue[2] &&
+                       mValue[1] > mThreshold[0])) {
+      return 0;
+    }
+
+    // fractional position of the peak from a parabola through the three
+    // values, in hops relative to the previous hop
+    float denom = mValue[0] - 2.0f * mValue[1] + mValue[2];
+    float shift = denom < 0 ? 0.5f * (mValue[0] - mValue[2]) / denom : 0.0f;
+    shift = max(-0.5f, min(0.5f, shift));
+
+    // the detection function peaks when a new sound reaches about the
+    // middle of the frame, and the frame of hop h ends at (h + 1) * hop
+    long hop = mHops - 2;
+    long sample = (long)((hop + 1 + shift) * mHopSize) - mFFTSize / 2;
+    if (sample < 0) sample = 0;
+    if (sample - mLastOnset < mMinInterval) return 0;
+    mLastOnset = sample;
+
+    long head = mQueueHead.load(std::memory_order_relaxed);
+    if (head - mQueueTail.load(std::memory_order_acquire) >= mQueueSize) {
+      mDropped.fetch_add(1, std::memory_order_relaxed);
+      return 0;
+    }
+    mQueue[head % mQueueSize].sample = sample;
+    mQueue[head % mQueueSize].strength = mValue[1];
+    mQueueHead.store(head + 1, std::memory_order_release);
+    return 1;
+  }
+
+  // replace the oldest value in the median window; returns the median.
+  // the window is small, so keeping a sorted copy is cheaper than a heap.
+  float pushMedian(float value) {
+    float old = mHistory[mHistoryPos];
+    mHistory[mHistoryPos] = value;
+    mHistoryPos = (mHistoryPos + 1) % mHistory.size();
+
+    size_t i = lower_bound(mSorted.begin(), mSorted.end(), old) - mSorted.begin();
+    // slide the gap left or right to where value belongs
+    while (i > 0 && mSorted[i - 1] > value) {
+      mSorted[i] = mSorted[i - 1];
+      i--;
+    }
+    while (i + 1 < mSorted.size() && mSorted[i + 1] < value) {
+      mSorted[i] = mSorted[i + 1];
+      i++;
+    }
+    mSorted[i] = value;
+    return mSorted[mSorted.size() / 2];
+  }
+
+  pkmFFT *mFFT;
+  Method mMethod;
+  int mSampleRate, mFFTSize, mHopSize, mBins;
+  float mMultiplier, mOffset, mGamma;
+  int mMinInterval;
+
+  vector<float> mFrame;
+  int mFill;  // new samples in the frame's last hop so far
+  long mHops;
+  vector<float> mMagnitude, mPhase;
+  // previous frame: log magnitudes for the flux, magnitudes for the
+  // complex domain
+  vector<float> mPrevMagnitude, mPrevPhase, mPrevPrevPhase;
+
+  // detection function of the last three hops, oldest first, and the
+  // threshold of the last two
+  float mValue[3];
+  float mThreshold[2];
+  vector<float> mHistory, mSorted;
+  size_t mHistoryPos;
+  long mLastOnset;
+
+  vector<Onset> mQueue;
+  int mQueueSize;
+  char mPadding0[PKM_CACHE_LINE];
+  std::atomic<long> mQueueHead;
+  char mPadding1[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mQueueTail;
+  char mPadding2[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mDropped;
+};
@@ -1,5 +1,7 @@
 #include "ofMain.h"
-#include "ofxMaxim.h"
+#include "pkmOnsetDetector.h"
+#include "pkmGrainEngine.h"
+#include "pkmDSPGraph.h"
 
 
 class App : public ofBaseApp{
@@ -18,10 +20,22 @@ public:
         min_samples_per_grain = 0.2 * sample_rate;
         current_frame_i = 0;
         current_grain_i = 0;
+        next_grain_onset = 0;
         total_samples = 0;
+        random_state = 1;
         
         audio_input.resize(buffer_size);
-        rms_values.resize(sample_rate / buffer_size);
+        onsets.setup(sample_rate);
+        grain_start = 0;
+        grain_engine.setup(sample_rate, 16, buffer_size);
+        
+        // the grains go through a low pass filter and then a delay
+        delay.setDelay(22050);
+        graph.setup(sample_rate, buffer_size);
+        graph.connect(&grain_output, &filter);
+        graph.connect(&filter, &delay);
+        graph.setOutput(&delay);
+        graph.compile();
         ofSoundStreamSetup(1, 1, sample_rate, buffer_size, 3);
     }
     
@@ -93,26 +107,37 @@ public:
         
         if(grains.size()) {
             
-            for (int i = 0; i < buffer_size; i++) {
-                output[i] = delay.dl(filter.lopass(grains[current_grain_i][i + current_frame_i * buffer_size],
-                                          ofClamp(mouseY / (float)ofGetHeight(), 0.0, 1.0)),
-                                     22050,
-                                     ofClamp(mouseX / (float)ofGetWidth(), 0.0, 1.0));
+            // start a new grain every half a grain, exactly on time even
+            // when that is the middle of this buffer.  each one fades in
+            // and out, so they crossfade instead of clicking, and they
+            // are mixed together a whole buffer at a time.
+            while (next_grain_onset < buffer_size) {
+                // now and then play the same grain again
+                if(xorshift() % 100 <= 75) {
+                    current_grain_i = xorshift() % grains.size();
+                }
+                grain_engine.trigger(next_grain_onset,
+                                     &grains[current_grain_i][0],
+                                     grains[current_grain_i].size(),
+                                     0,
+                                     min_samples_per_grain);
+                current_frame_i = 0;
+                next_grain_onset += min_samples_per_grain / 2;
             }
-            
+            next_grain_onset -= buffer_size;
             current_frame_i += 1;
             
-            if(current_frame_i * buffer_size > min_samples_per_grain ||
-               current_frame_i >= grains[current_grain_i].size() / buffer_size)
-            {
-                if(rand() % 100 > 75) {
-                    current_frame_i = 0;
-                }
-                else {
-                    current_grain_i = rand() % grains.size();
-                    current_frame_i = 0;
-                }
-            }
+            grain_engine.process(grain_output.getBuffer(), buffer_size);
+            
+            // the mouse sets the filter's cutoff, from 20 Hz at the top
+            // to 20 kHz at the bottom, and the delay's feedback.  they
+            // glide to their new values over the buffer, so moving the
+            // mouse does not click.
+            float y = ofClamp(mouseY / (float)ofGetHeight(), 0.0, 1.0);
+            float x = ofClamp(mouseX / (float)ofGetWidth(), 0.0, 1.0);
+            filter.frequency.rampTo(20.0 * powf(1000.0, y), buffer_size);
+            delay.feedback.rampTo(x, buffer_size);
+            graph.process(output, buffer_size);
         }
     }
     
@@ -124,64 +149,43 @@ public:
             return;
         }
         
-        // add all the audio input values
-        float total = 0;
-        for (int i = 0; i < buffer_size; i++) {
-            // we add the "square" of each value so that negative numbers
-            // become positive.  this is like thinking of the "magnitude"
-            total = total + (input[i] * input[i]);
-        }
-        // the "mean" part of the RMS, we divide by the number of audio input samples
-        // we added in the for loop above
-        total = total / (float)buffer_size;
-        
-        // the "root" part of RMS, we take the square root to get our RMS reading for the
-        // current chunk of audio input values
-        rms = sqrt(total);
-        
-        // calculate the average of the rms values
-        float average_rms = 0.0f;
-        for (int i = 0; i < rms_values.size(); i++) {
-            average_rms = average_rms + rms_values[i];
-        }
-        average_rms = average_rms / rms_values.size();
-        
-        // calculate the variance of the rms values
-        float var_rms = 0.0f;
-        for (int i = 0; i < rms_values.size(); i++) {
-            var_rms = var_rms + abs(rms_values[i] - average_rms);
-        }
-        var_rms = var_rms / rms_values.size();
-        
-        // now we see if the current value is outside the mean + variance
-        // basic statistics tells us a normally distributed function
-        // has a mean and a variance where 97% of the data is explained by
-        // 3 standard deviations.  we use this principle here in detecting
-        // the the current rms reading is outside this probability
-        float min_rms = 0.01;
-        if (rms > (average_rms + 2.0 * var_rms) &&
-            rms > min_rms &&
-            current_grain.size() > min_samples_per_grain) {
-            grains.push_back(current_grain);
-            current_grain.resize(0);
-        }
+        // the onset detector compares the spectrum of each short frame of
+        // audio with the one before it, and looks for the moments where the
+        // frequencies grow much more than they have been lately.  that is
+        // only a little work for each new block of audio, and it also
+        // catches soft or pitched onsets that hardly change the loudness.
+        onsets.process(input, buffer_size);
         
         for (int i = 0; i < buffer_size; i++) {
             current_grain.push_back(input[i]);
         }
         total_samples += buffer_size;
         
-        // add the current rms value
-        rms_values.push_back(rms);
-        
-        // we only keep a maximum of 1 second of the rms readings
-        if (rms_values.size() > (sample_rate / buffer_size)) {
-            // then we delete the first one
-            rms_values.erase(rms_values.begin(), rms_values.begin() + 1);
+        // every onset starts a new grain, as long as the current one is
+        // long enough.  the detector tells us where the onset was to within
+        // a few samples, a little after it happened, so the audio we have
+        // after the onset moves on to the new grain.
+        pkmOnsetDetector::Onset onset;
+        while (onsets.popOnset(onset)) {
+            int length = onset.sample - grain_start;
+            if (length > min_samples_per_grain) {
+                grains.push_back(vector<float>(current_grain.begin(),
+                                               current_grain.begin() + length));
+                current_grain.erase(current_grain.begin(),
+                                    current_grain.begin() + length);
+                grain_start = onset.sample;
+            }
         }
-
     }
     
+    // rand() may take a lock, so the audio thread picks its grains with
+    // its own xorshift generator, like the grain engine does
+    uint32_t xorshift() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    }
 
 private:
     int                     width,
@@ -192,9 +196,8 @@ private:
     int                     sample_rate,
                             buffer_size;
     
-    float                   rms;
-    
-    vector<float>           rms_values;
+    pkmOnsetDetector        onsets;
+    long                    grain_start;
     
     vector<vector<float>>   grains;
     vector<float>           current_grain;
@@ -203,9 +206,15 @@ private:
     int                     current_frame_i;
     int                     current_grain_i;
     int                     min_samples_per_grain;
+    int                     next_grain_onset;
+    uint32_t                random_state;
+    
+    pkmGrainEngine          grain_engine;
     
-    ofxMaxiDelayline        delay;
-    ofxMaxiFilter           filter;
+    pkmDSPGraph             graph;
+    pkmDSPGraph::Input      grain_output;
+    pkmDSPGraph::Biquad     filter;
+    pkmDSPGraph::Delay      delay;
     
     bool                    b_recording;
 };
@@ -1,5 +1,5 @@
 #include "ofMain.h"
-#include "ofxMaxim.h"
+#include "pkmDSPGraph.h"
 
 
 class App : public ofBaseApp{
@@ -14,6 +14,27 @@ public:
         
         sample_rate = 44100;
         buffer_size = 256;
+        
+        // the patch: a sine whose frequency sweeps up from 0 to 440 Hz
+        // every 2 seconds, ring modulated with a 440 Hz sine, into a half
+        // second delay.  the graph works out the order to run them in, and
+        // each one makes a whole buffer at a time.
+        sweep.setWaveform(pkmDSPGraph::Oscillator::PHASOR);
+        sweep.frequency.set(0.5);
+        sweep.setRange(0, 440);
+        osc2.frequency.set(440);
+        delay1.setDelay(22050);
+        delay1.feedback.set(0.5);
+        
+        graph.setup(sample_rate, buffer_size);
+        graph.connect(&sweep, &osc1);
+        graph.connect(&osc1, &ring);
+        graph.connect(&osc2, &ring);
+        graph.connect(&ring, &delay1);
+        graph.setOutput(&delay1);
+        graph.compile();
+        mono.resize(buffer_size);
+        
         ofSoundStreamSetup(2, 0, sample_rate, buffer_size, 3);
     }
     
@@ -33,10 +54,15 @@ public:
     }
     
     void audioOut(float * output, int buffer_size, int n_channels) {
+        graph.process(&mono[0], buffer_size);
+        
+        // the same sound in every channel
         for(int i = 0; i < buffer_size; i++)
         {
-            output[i] = delay1.dl(osc1.sinewave(osc3.phasor(0.5, 0, 440)) * osc2.sinewave(440),
-                                  22050, 0.5);
+            for(int ch = 0; ch < n_channels; ch++)
+            {
+                output[i * n_channels + ch] = mono[i];
+            }
         }
     }
 
@@ -47,8 +73,11 @@ private:
     int                     sample_rate,
                             buffer_size;
     
-    ofxMaxiOsc              osc1, osc2, osc3;
-    ofxMaxiDelayline        delay1;
+    pkmDSPGraph             graph;
+    pkmDSPGraph::Oscillator osc1, osc2, sweep;
+    pkmDSPGraph::Multiply   ring;
+    pkmDSPGraph::Delay      delay1;
+    vector<float>           mono;
 };
 
 
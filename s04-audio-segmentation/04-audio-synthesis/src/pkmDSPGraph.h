@@ -0,0 +1,703 @@
+/*
+ *  pkmDSPGraph.h
+ *
+ *  A small graph of audio nodes that are processed a block at a time.
+ *
+ *  Each node writes a whole block of samples to its own output buffer from
+ *  the outputs of the nodes connected to it, mostly with vDSP/vForce, so
+ *  the work of a patch is a few vector operations per node per block
+ *  rather than a chain of function calls, branches and state updates per
+ *  sample.  compile() orders the nodes the output depends on so that every
+ *  node runs after its inputs, and nodes that do not reach the output are
+ *  not run at all.
+ *
+ *  Nodes:
+ *
+ *  - Input: a buffer the app writes each block (e.g. grains, or values
+ *    read from a camera), for the rest of the graph to process
+ *  - Oscillator: sine, phasor or saw, at a frequency in Hz from a Param or,
+ *    if something is connected, from its input (FM)
+ *  - SamplePlayer: loops a sample at a speed from a Param or its input
+ *  - Biquad: low, high or band pass (RBJ cookbook) with vDSP_deq22
+ *  - Delay: a delay line with feedback
+ *  - EnvelopeFollower: separate attack and release, as maxiEnvelopeFollower
+ *  - Mixer: the sum of its inputs, each with its own gain
+ *  - Multiply: the product of its inputs (ring modulation, VCA)
+ *
+ *  Node parameters are Params, which can be set or ramped linearly to a
+ *  new value over any number of samples.  A ramp starts on the next sample
+ *  processed, whatever the block size, so moving a parameter once a block
+ *  (e.g. from the mouse) does not click.  Biquads recompute their
+ *  coefficients every 32 samples while ramping.
+ *
+ *  The graph does not own its nodes: keep them alive (e.g. as members) for
+ *  as long as the graph.  Build and compile() it before audio starts; after
+ *  that process(), and setting Params and writing Inputs, are meant for the
+ *  audio thread, and none of them allocate.  Other nodes can be made by
+ *  deriving from Node and implementing process().
+ *
+ *  Usage:
+ *
+ *  pkmDSPGraph graph;
+ *  pkmDSPGraph::Oscillator lfo(pkmDSPGraph::Oscillator::SINE, 0.5), osc;
+ *  pkmDSPGraph::Delay delay(22050);
+ *  graph.setup(44100, buffer_size);
+ *  graph.connect(&osc, &delay);
+ *  graph.setOutput(&delay);
+ *  graph.compile();
+ *
+ *  // in audioOut
+ *  osc.frequency.rampTo(mouseX, buffer_size);
+ *  graph.process(output, buffer_size);
+ *
+ */
+
+#pragma once
+
+#include <Accelerate/Accelerate.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+class pkmDSPGraph {
+ public:
+  // a value that can jump or ramp linearly to a target, sample by sample
+  class Param {
+   public:
+    Param(float value = 0)
+        : mValue(value), mTarget(value), mStep(0), mRemaining(0) {}
+
+    void set(float value) {
+      mValue = mTarget = value;
+      mStep = 0;
+      mRemaining = 0;
+    }
+
+    // reach target after the next samples samples
+    void rampTo(float target, int samples) {
+      if (samples <= 0) {
+        set(target);
+        return;
+      }
+      mTarget = target;
+      mStep = (target - mValue) / samples;
+      mRemaining = samples;
+    }
+
+    float getValue() const { return mValue; }
+    float getTarget() const { return mTarget; }
+    bool isRamping() const { return mRemaining > 0; }
+
+    // the next n values
+    void render(float *values, int n) {
+      int r = min(n, mRemaining);
+      if (r > 0) {
+        vDSP_vramp(&mValue, &mStep, values, 1, r);
+        advance(r);
+      }
+      if (r < n) vDSP_vfill(&mValue, values + r, 1, n - r);
+    }
+
+    // the current value, then move n samples on
+    float advance(int n) {
+      float value = mValue;
+      if (mRemaining > 0) {
+        int r = min(n, mRemaining);
+        mRemaining -= r;
+        // land exactly on the target rather than on the rounding error
+        mValue = mRemaining > 0 ? mValue + mStep * r : mTarget;
+      }
+      return value;
+    }
+
+   private:
+    float mValue, mTarget, mStep;
+    int mRemaining;
+  };
+
+  class Node {
+   public:
+    Node() : mSampleRate(44100), mIndex(-1) {}
+    virtual ~Node() {}
+
+    // the last block written, max_block samples long
+    const float *getOutput() const { return mOutput.data(); }
+
+   protected:
+    friend class pkmDSPGraph;
+
+    // called when the node is added to a graph: allocate everything for
+    // blocks of up to max_block samples here
+    virtual void prepare(int sample_rate, int max_block) {
+      mSampleRate = sample_rate;
+      mOutput.assign(max_block, 0.0f);
+      mScratch.assign(max_block, 0.0f);
+    }
+
+    // write the next n samples to mOutput
+    virtual void process(int n) = 0;
+
+    int getNumInputs() const { return (int)mInputs.size(); }
+    const float *getInput(int i) const { return mInputs[i]->mOutput.data(); }
+
+    // the sum of every input; NULL if nothing is connected
+    const float *sumInputs(int n) {
+      if (mInputs.empty()) return NULL;
+      if (mInputs.size() == 1) return getInput(0);
+      vDSP_vadd(getInput(0), 1, getInput(1), 1, &mScratch[0], 1, n);
+      for (size_t i = 2; i < mInputs.size(); i++) {
+        vDSP_vadd(&mScratch[0], 1, getInput(i), 1, &mScratch[0], 1, n);
+      }
+      return &mScratch[0];
+    }
+
+    int mSampleRate;
+    vector<float> mOutput;
+    vector<float> mScratch;
+
+   private:
+    vector<Node *> mInputs;
+    int mIndex;  // in the graph's list of nodes
+  };
+
+  // whatever the app writes to getBuffer() before process()
+  class Input : public Node {
+   public:
+    float *getBuffer() { return &mOutput[0]; }
+
+   protected:
+    void process(int n) {}
+  };
+
+  class Oscillator : public Node {
+   public:
+    enum Waveform {
+      SINE,    // -1 .. 1
+      PHASOR,  // a ramp from low to high, as maxiOsc::phasor
+      SAW      // -1 .. 1
+    };
+
+    Oscillator(Waveform waveform = SINE, float frequency_hz = 440)
+        : frequency(frequency_hz), mWaveform(waveform), mPhase(0), mLow(0),
+          mHigh(1) {}
+
+    // in Hz; ignored while something is connected to the input
+    Param frequency;
+
+    void setWaveform(Waveform waveform) { mWaveform = waveform; }
+
+    // the phasor's range
+    void setRange(float low, float high) {
+      mLow = low;
+      mHigh = high;
+    }
+
+    // 0 .. 1 of a cycle
+    void setPhase(float phase) { mPhase = phase - floorf(phase); }
+
+   protected:
+    void process(int n) {
+      float *out = &mOutput[0];
+      float to_cycles = 1.0f / mSampleRate;
+
+      // the phase of each sample, in cycles
+      if (getNumInputs() == 0 && !frequency.isRamping()) {
+        float step = frequency.advance(n) * to_cycles;
+        vDSP_vramp(&mPhase, &step, out, 1, n);
+        mPhase += step * n;
+      } else {
+        float *increment = &mScratch[0];
+        if (getNumInputs() > 0) {
+          vDSP_vsmul(sumInputs(n), 1, &to_cycles, increment, 1, n);
+          frequency.advance(n);
+        } else {
+          frequency.render(increment, n);
+          vDSP_vsmul(increment, 1, &to_cycles, increment, 1, n);
+        }
+        // a running sum is inherently serial, but it is one add a sample
+        float phase = mPhase;
+        for (int i = 0; i < n; i++) {
+          out[i] = phase;
+          phase += increment[i];
+        }
+        mPhase = phase;
+      }
+      mPhase -= floorf(mPhase);
+      // back into 0 .. 1 (or -1 .. 0 for negative frequencies)
+      vDSP_vfrac(out, 1, out, 1, n);
+
+      switch (mWaveform) {
+        case SINE: {
+          float two_pi = 2.0f * (float)M_PI;
+          int count = n;
+          vDSP_vsmul(out, 1, &two_pi, out, 1, n);
+          vvsinf(out, out, &count);
+          break;
+        }
+        case PHASOR: {
+          float range = mHigh - mLow;
+          vDSP_vsmsa(out, 1, &range, &mLow, out, 1, n);
+          break;
+        }
+        case SAW: {
+          float two = 2.0f, minus_one = -1.0f;
+          vDSP_vsmsa(out, 1, &two, &minus_one, out, 1, n);
+          break;
+        }
+      }
+    }
+
+   private:
+    Waveform mWaveform;
+    float mPhase;
+    float mLow, mHigh;
+  };
+
+  // loops a copy of a sample, read with linear interpolation
+  class SamplePlayer : public Node {
+   public:
+    SamplePlayer() : speed(1), mPosition(0) {}
+
+    // samples per output sample (negative plays backwards); ignored while
+    // something is connected to the input
+    Param speed;
+
+    // allocates.  positions are single precision for vDSP_vlint, so
+    // samples of more than 2^24 frames (about 6 minutes) lose resolution.
+    void setSample(const float *samples, long length) {
+      // one extra frame, a copy of the first, so interpolating across the
+      // loop point needs no special case
+      mSample.assign(samples, samples + length);
+      if (length > 0) mSample.push_back(samples[0]);
+      mPosition = 0;
+    }
+
+    long getLength() const {
+      return mSample.empty() ? 0 : (long)mSample.size() - 1;
+    }
+
+    void setPosition(double position) { mPosition = position; }
+    double getPosition() const { return mPosition; }
+
+   protected:
+    void prepare(int sample_rate, int max_block) {
+      Node::prepare(sample_rate, max_block);
+      mPositions.assign(max_block, 0.0f);
+    }
+
+    void process(int n) {
+      long length = getLength();
+      if (length == 0) {
+        vDSP_vclr(&mOutput[0], 1, n);
+        speed.advance(n);
+        return;
+      }
+
+      const float *rate = sumInputs(n);
+      if (rate != NULL) {
+        speed.advance(n);
+      } else {
+        speed.render(&mScratch[0], n);
+        rate = &mScratch[0];
+      }
+
+      // where each sample is read, wrapped into the loop
+      double position = mPosition;
+      for (int i = 0; i < n; i++) {
+        mPositions[i] = (float)position;
+        position += rate[i];
+        if (position >= length) position -= length;
+        if (position < 0) position += length;
+      }
+      mPosition = position;
+      vDSP_vlint(&mSample[0], &mPositions[0], 1, &mOutput[0], 1, n,
+                 mSample.size());
+    }
+
+   private:
+    vector<float> mSample;
+    vector<float> mPositions;
+    double mPosition;
+  };
+
+  class Biquad : public Node {
+   public:
+    enum Type { LOWPASS, HIGHPASS, BANDPASS };
+
+    Biquad(Type type = LOWPASS, float frequency_hz = 1000, float q = 0.707f)
+        : frequency(frequency_hz), resonance(q), mType(type) {
+      memset(mHistory, 0, sizeof(mHistory));
+    }
+
+    // cutoff (or centre) in Hz, and Q
+    Param frequency, resonance;
+
+    void setType(Type type) { mType = type; }
+
+    void clear() { memset(mHistory, 0, sizeof(mHistory)); }
+
+   protected:
+    void prepare(int sample_rate, int max_block) {
+      Node::prepare(sample_rate, max_block);
+      // vDSP_deq22 reads the two previous inputs and outputs from the
+      // first two elements of its buffers
+      mIn.assign(max_block + 2, 0.0f);
+      mOut.assign(max_block + 2, 0.0f);
+    }
+
+    void process(int n) {
+      const float *in = sumInputs(n);
+      if (in == NULL) {
+        vDSP_vclr(&mIn[2], 1, n);
+      } else {
+        memcpy(&mIn[2], in, sizeof(float) * n);
+      }
+      memcpy(&mIn[0], &mHistory[0], sizeof(float) * 2);
+      memcpy(&mOut[0], &mHistory[2], sizeof(float) * 2);
+
+      bool ramping = frequency.isRamping() || resonance.isRamping();
+      int step = ramping ? kRampStep : n;
+      for (int i = 0; i < n; i += step) {
+        int count = min(step, n - i);
+        computeCoefficients(frequency.advance(count),
+                            resonance.advance(count));
+        vDSP_deq22(&mIn[i], 1, mCoefficients, &mOut[i], 1, count);
+      }
+
+      memcpy(&mOutput[0], &mOut[2], sizeof(float) * n);
+      mHistory[0] = mIn[n];
+      mHistory[1] = mIn[n + 1];
+      mHistory[2] = mOut[n];
+      mHistory[3] = mOut[n + 1];
+    }
+
+   private:
+    static const int kRampStep = 32;
+
+    // RBJ's audio EQ cookbook, normalised by a0, in vDSP_deq22's order
+    // b0 b1 b2 a1 a2
+    void computeCoefficients(float hz, float q) {
+      float w = 2.0f * (float)M_PI *
+                max(1.0f, min(hz, 0.49f * mSampleRate)) / mSampleRate;
+      float cw = cosf(w);
+      float alpha = sinf(w) / (2.0f * max(q, 0.01f));
+      float b0, b1, b2;
+      switch (mType) {
+        case LOWPASS:
+          b1 = 1.0f - cw;
+          b0 = b2 = 0.5f * b1;
+          break;
+        case HIGHPASS:
+          b1 = -(1.0f + cw);
+          b0 = b2 = -0.5f * b1;
+          break;
+        default:  // BANDPASS, 0 dB peak
+          b0 = alpha;
+          b1 = 0;
+          b2 = -alpha;
+          break;
+      }
+      float a0 = 1.0f + alpha;
+      mCoefficients[0] = b0 / a0;
+      mCoefficients[1] = b1 / a0;
+      mCoefficients[2] = b2 / a0;
+      mCoefficients[3] = -2.0f * cw / a0;
+      mCoefficients[4] = (1.0f - alpha) / a0;
+    }
+
+    Type mType;
+    float mCoefficients[5];
+    float mHistory[4];  // x[n-2] x[n-1] y[n-2] y[n-1]
+    vector<float> mIn, mOut;
+  };
+
+  // each output sample is the one delay samples ago, and the input is added
+  // to what is fed back: memory = memory x feedback + input
+  class Delay : public Node {
+   public:
+    Delay(int max_samples = 88200)
+        : feedback(0.5f), mMemory(max(1, max_samples), 0.0f),
+          mDelay(max(1, max_samples)), mPhase(0) {}
+
+    Param feedback;
+
+    // up to the max_samples given to the constructor
+    void setDelay(int samples) {
+      mDelay = max(1, min(samples, (int)mMemory.size()));
+      if (mPhase >= mDelay) mPhase = 0;
+    }
+
+    int getDelay() const { return mDelay; }
+
+    void clear() { fill(mMemory.begin(), mMemory.end(), 0.0f); }
+
+   protected:
+    void process(int n) {
+      const float *in = sumInputs(n);
+      bool ramping = feedback.isRamping();
+      float gain = feedback.getValue();
+      if (ramping) {
+        feedback.render(&mGains[0], n);
+      } else {
+        feedback.advance(n);
+      }
+
+      // the memory is a ring: process it in runs up to its end
+      for (int i = 0; i < n;) {
+        int count = min(n - i, mDelay - mPhase);
+        float *memory = &mMemory[mPhase];
+        memcpy(&mOutput[i], memory, sizeof(float) * count);
+        if (ramping && in != NULL) {
+          vDSP_vma(memory, 1, &mGains[i], 1, in + i, 1, memory, 1, count);
+        } else if (ramping) {
+          vDSP_vmul(memory, 1, &mGains[i], 1, memory, 1, count);
+        } else if (in != NULL) {
+          vDSP_vsma(memory, 1, &gain, in + i, 1, memory, 1, count);
+        } else {
+          vDSP_vsmul(memory, 1, &gain, memory, 1, count);
+        }
+        mPhase += count;
+        if (mPhase >= mDelay) mPhase = 0;
+        i += count;
+      }
+    }
+
+    void prepare(int sample_rate, int max_block) {
+      Node::prepare(sample_rate, max_block);
+      mGains.assign(max_block, 0.0f);
+    }
+
+   private:
+    vector<float> mMemory;
+    vector<float> mGains;
+    int mDelay, mPhase;
+  };
+
+  // follows the magnitude of its input: rises towards it with the attack
+  // time and falls with the release time (both to within 1%, in ms)
+  class EnvelopeFollower : public Node {
+   public:
+    EnvelopeFollower(float attack_ms = 10, float release_ms = 100)
+        : mAttackMs(attack_ms), mReleaseMs(release_ms), mEnvelope(0) {
+      updateCoefficients();
+    }
+
+    void setAttack(float ms) {
+      mAttackMs = ms;
+      updateCoefficients();
+    }
+
+    void setRelease(float ms) {
+      mReleaseMs = ms;
+      updateCoefficients();
+    }
+
+    float getValue() const { return mEnvelope; }
+
+   protected:
+    void prepare(int sample_rate, int max_block) {
+      Node::prepare(sample_rate, max_block);
+      updateCoefficients();
+    }
+
+    void process(int n) {
+      const float *in = sumInputs(n);
+      float *out = &mOutput[0];
+      if (in == NULL) {
+        vDSP_vclr(out, 1, n);
+      } else {
+        vDSP_vabs(in, 1, out, 1, n);
+      }
+      // the recursion is serial; the branch is the only work per sample
+      float envelope = mEnvelope;
+      for (int i = 0; i < n; i++) {
+        float x = out[i];
+        float c = x > envelope ? mAttack : mRelease;
+        envelope = x + c * (envelope - x);
+        out[i] = envelope;
+      }
+      mEnvelope = envelope;
+    }
+
+   private:
+    void updateCoefficients() {
+      mAttack = coefficient(mAttackMs);
+      mRelease = coefficient(mReleaseMs);
+    }
+
+    float coefficient(float ms) const {
+      float samples = ms * 0.001f * mSampleRate;
+      return samples > 1 ? powf(0.01f, 1.0f / samples) : 0.0f;
+    }
+
+    float mAttackMs, mReleaseMs;
+    float mAttack, mRelease;
+    float mEnvelope;
+  };
+
+  // the sum of its inputs, input i scaled by getGain(i).  inputs whose gain
+  // is 0 are skipped.
+  class Mixer : public Node {
+   public:
+    Mixer(int max_inputs = 8) : mGains(max_inputs, Param(1)) {}
+
+    // inputs are numbered in the order they were connected
+    Param &getGain(int input) { return mGains[input]; }
+
+   protected:
+    void prepare(int sample_rate, int max_block) {
+      Node::prepare(sample_rate, max_block);
+      if ((int)mGains.size() < getNumInputs()) {
+        mGains.resize(getNumInputs(), Param(1));
+      }
+    }
+
+    void process(int n) {
+      float *out = &mOutput[0];
+      vDSP_vclr(out, 1, n);
+      int inputs = min(getNumInputs(), (int)mGains.size());
+      for (int i = 0; i < inputs; i++) {
+        Param &gain = mGains[i];
+        if (gain.isRamping()) {
+          gain.render(&mScratch[0], n);
+          vDSP_vma(getInput(i), 1, &mScratch[0], 1, out, 1, out, 1, n);
+          continue;
+        }
+        float g = gain.getValue();
+        if (g == 1.0f) {
+          vDSP_vadd(getInput(i), 1, out, 1, out, 1, n);
+        } else if (g != 0.0f) {
+          vDSP_vsma(getInput(i), 1, &g, out, 1, out, 1, n);
+        }
+      }
+    }
+
+   private:
+    vector<Param> mGains;
+  };
+
+  class Multiply : public Node {
+   protected:
+    void process(int n) {
+      float *out = &mOutput[0];
+      if (getNumInputs() == 0) {
+        vDSP_vclr(out, 1, n);
+        return;
+      }
+      memcpy(out, getInput(0), sizeof(float) * n);
+      for (int i = 1; i < getNumInputs(); i++) {
+        vDSP_vmul(out, 1, getInput(i), 1, out, 1, n);
+      }
+    }
+  };
+
+  pkmDSPGraph()
+      : mSampleRate(44100), mMaxBlock(512), mOutput(NULL), mCompiled(false) {}
+
+  // process() is never given more than max_block samples at a time
+  void setup(int sample_rate, int max_block = 512) {
+    mSampleRate = sample_rate;
+    mMaxBlock = max_block;
+    for (size_t i = 0; i < mNodes.size(); i++) {
+      mNodes[i]->prepare(mSampleRate, mMaxBlock);
+    }
+  }
+
+  // connect() adds nodes itself, so this is only needed for nodes with no
+  // connections (e.g. one oscillator as the output)
+  void add(Node *node) {
+    if (node->mIndex >= 0 && node->mIndex < (int)mNodes.size() &&
+        mNodes[node->mIndex] == node) {
+      return;
+    }
+    node->mIndex = (int)mNodes.size();
+    mNodes.push_back(node);
+    node->prepare(mSampleRate, mMaxBlock);
+    mCompiled = false;
+  }
+
+  // feed from's output into to
+  void connect(Node *from, Node *to) {
+    add(from);
+    add(to);
+    to->mInputs.push_back(from);
+    // e.g. a mixer makes room for the gain of its new input
+    to->prepare(mSampleRate, mMaxBlock);
+    mCompiled = false;
+  }
+
+  void disconnect(Node *from, Node *to) {
+    vector<Node *> &inputs = to->mInputs;
+    inputs.erase(std::remove(inputs.begin(), inputs.end(), from),
+                 inputs.end());
+    mCompiled = false;
+  }
+
+  // the node whose output process() writes
+  void setOutput(Node *node) {
+    add(node);
+    mOutput = node;
+    mCompiled = false;
+  }
+
+  // order the nodes the output depends on so that each one comes after its
+  // inputs.  false (and the graph stays silent) if there is a cycle.
+  // process() calls this if the graph changed, but it allocates, so call
+  // it once the graph is built.
+  bool compile() {
+    mOrder.clear();
+    mCompiled = true;
+    if (mOutput == NULL) return true;
+    vector<char> state(mNodes.size(), 0);  // 1: visiting, 2: done
+    if (!visit(mOutput, state)) {
+      printf("[pkmDSPGraph]: the graph has a cycle\n");
+      mOrder.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // run every node the output depends on over the next n samples (at most
+  // max_block) and write the output node's output
+  void process(float *output, int n) {
+    if (!mCompiled) compile();
+    int count = min(n, mMaxBlock);
+    for (size_t i = 0; i < mOrder.size(); i++) mOrder[i]->process(count);
+    if (mOutput != NULL && !mOrder.empty()) {
+      memcpy(output, mOutput->getOutput(), sizeof(float) * count);
+    } else {
+      vDSP_vclr(output, 1, count);
+    }
+    if (count < n) vDSP_vclr(output + count, 1, n - count);
+  }
+
+  int getSampleRate() const { return mSampleRate; }
+  int getMaxBlock() const { return mMaxBlock; }
+
+  // nodes run by process(), in order
+  int getNumScheduled() const { return (int)mOrder.size(); }
+
+ private:
+  // depth first, each node after everything it reads
+  bool visit(Node *node, vector<char> &state) {
+    if (state[node->mIndex] == 2) return true;
+    if (state[node->mIndex] == 1) return false;
+    state[node->mIndex] = 1;
+    for (size_t i = 0; i < node->mInputs.size(); i++) {
+      if (!visit(node->mInputs[i], state)) return false;
+    }
+    state[node->mIndex] = 2;
+    mOrder.push_back(node);
+    return true;
+  }
+
+  int mSampleRate, mMaxBlock;
+  vector<Node *> mNodes;
+  vector<Node *> mOrder;
+  Node *mOutput;
+  bool mCompiled;
+};
@@ -3,9 +3,20 @@
 //--------------------------------------------------------------
 void ofApp::setup(){
     speed = rate = 1.0;
-    sample1.load(ofToDataPath("amen.wav"));
+    pkmAudioFileReader reader;
+    if (reader.open(ofToDataPath("amen.wav"))) {
+        sample1.resize(reader.mNumSamples);
+        reader.read(&sample1[0], 0, reader.mNumSamples);
+        reader.close();
+    }
     
-    ts = new maxiTimePitchStretch<hannWinFunctor, maxiSample>(&sample1);
+    // grains of 0.1 seconds, 4 of them overlapping at any time: the
+    // playhead moves through the sample at speed, while each grain plays
+    // back at rate, so the two can be changed separately
+    grains.setup(44100, 16, 512);
+    grains.setGrainDuration(0.1 * 44100);
+    grains.setGrainInterval(0.1 * 44100 / 4);
+    grains.setSource(sample1.size() ? &sample1[0] : NULL, sample1.size());
 
     ofSoundStreamSetup(1, 0, 44100, 512, 3);
 //    maxiSettings::setup(44100, 1, 3);
@@ -26,9 +37,9 @@ void ofApp::draw(){
 }
 
 void ofApp::audioOut(float *buffer, int buffer_size, int n_channels) {
-    for (int i = 0; i < buffer_size; i++) {
-        buffer[i] = (*ts).play(speed, rate, 0.1, 4);
-    }
+    grains.setSpeed(speed);
+    grains.setRate(rate);
+    grains.process(buffer, buffer_size);
 }
 
 
@@ -1,8 +1,8 @@
 #pragma once
 
 #include "ofMain.h"
-#include "ofxMaxim.h"
-#include "maxiGrains.h"
+#include "pkmAudioFileReader.h"
+#include "pkmGrainEngine.h"
 
 class ofApp : public ofBaseApp{
 
@@ -13,7 +13,7 @@ class ofApp : public ofBaseApp{
 
     void audioOut(float *buffer, int buffer_size, int n_channels);
 		
-    maxiSample sample1;
-    maxiTimePitchStretch<hannWinFunctor, maxiSample> *ts;
+    vector<float> sample1;
+    pkmGrainEngine grains;
     float rate, speed;
 };
@@ -0,0 +1,276 @@
+/*
+ *  pkmGrainEngine.h
+ *
+ *  Granular playback from a fixed pool of voices.
+ *
+ *  Each grain reads duration samples of a source buffer from a given
+ *  position at a given rate (linearly interpolated), shaped by a Hann
+ *  envelope looked up in a precomputed table, and starts on an exact
+ *  sample: trigger() takes the offset into the next process() block (or a
+ *  later one) at which the grain should begin.
+ *
+ *  process() mixes every sounding voice into the output a whole run of
+ *  samples at a time with vDSP (ramp, table lookup, multiply-add), so the
+ *  cost of a block is at most max_voices runs of the block size whatever
+ *  is triggered: a grain triggered while every voice is busy is dropped
+ *  and counted rather than stealing time.  Nothing is allocated after
+ *  setup().
+ *
+ *  There is also a built-in scheduler for a single source: a grain every
+ *  interval samples (with optional jitter), starting near a playhead that
+ *  moves at speed samples per output sample.  With speed and rate set
+ *  separately that is time-stretching and pitch-shifting.
+ *
+ *  Sources must stay valid, and unchanged, while grains read them.  All
+ *  calls are meant for the audio thread.
+ *
+ *  Usage:
+ *
+ *  pkmGrainEngine grains;
+ *  grains.setup(44100);
+ *  grains.trigger(offset, source, source_length, position, 4410);
+ *  grains.process(output, buffer_size);
+ *
+ *  // or
+ *  grains.setSource(samples, n_samples);
+ *  grains.setGrainInterval(1102);   // 40 grains a second
+ *  grains.setSpeed(0.5);            // half speed, same pitch
+ *  grains.process(output, buffer_size);
+ *
+ */
+
+#pragma once
+
+#include <Accelerate/Accelerate.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+class pkmGrainEngine {
+ public:
+  pkmGrainEngine()
+      : mSampleRate(44100), mMaxBlock(0), mNumActive(0), mDropped(0),
+        mSource(NULL), mSourceLength(0), mScheduling(false), mRandom(1) {}
+
+  // at most max_voices grains sound at once, and process() is never given
+  // more than max_block samples at a time
+  void setup(int sample_rate, int max_voices = 64, int max_block = 4096,
+             int window_size = 1024) {
+    mSampleRate = sample_rate;
+    mMaxBlock = max_block;
+    mVoices.assign(max_voices, Voice());
+    mActive.assign(max_voices, 0);
+    mFree.resize(max_voices);
+    for (int v = 0; v < max_voices; v++) mFree[v] = max_voices - 1 - v;
+    mNumActive = 0;
+    mDropped = 0;
+
+    // hann window, with one extra zero so interpolating at the very end
+    // stays inside the table
+    mWindow.assign(window_size + 1, 0.0f);
+    for (int i = 0; i < window_size; i++) {
+      mWindow[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (window_size - 1));
+    }
+    mWindowSize = window_size;
+
+    mIndex.assign(max_block, 0.0f);
+    mEnvelope.assign(max_block, 0.0f);
+    mSamples.assign(max_block, 0.0f);
+
+    mScheduling = false;
+    mNextOnset = 0;
+    mPlayhead = 0;
+    setGrainDuration(sample_rate / 10);
+    setGrainInterval(sample_rate / 40.0f);
+    setRate(1);
+    setSpeed(1);
+    setSpread(0);
+    setAmplitude(0.5f);
+  }
+
+  // start a grain offset samples into the next process() block: duration
+  // samples of source from position on, read at rate, scaled by
+  // amplitude.  it is shortened if it would read past the end of the
+  // source.  false if every voice was busy.
+  bool trigger(int offset, const float *source, long source_length,
+               double position, int duration, float rate = 1.0f,
+               float amplitude = 1.0f) {
+    if (source == NULL || position < 0 || rate <= 0) return false;
+    // the last sample read is at position + rate * (duration - 1), and
+    // interpolating reads one past that
+    double room = (source_length - 2 - position) / rate + 1;
+    if (room < duration) duration = (int)room;
+    if (duration < 2) return false;
+    if (mFree.empty()) {
+      mDropped++;
+      return false;
+    }
+
+    int v = mFree.back();
+    mFree.pop_back();
+    Voice &voice = mVoices[v];
+    voice.source = source;
+    voice.position = position;
+    voice.rate = rate;
+    voice.amplitude = amplitude;
+    voice.onset = offset;
+    voice.remaining = duration;
+    voice.envelope = 0;
+    voice.envelope_step = (mWindowSize - 1) / (float)(duration - 1);
+    mActive[mNumActive++] = v;
+    return true;
+  }
+
+  // the built-in scheduler's source; NULL stops it
+  void setSource(const float *source, long length) {
+    mSource = source;
+    mSourceLength = length;
+    mScheduling = source != NULL && length > 2;
+  }
+
+  void setGrainDuration(int samples) { mDuration = samples > 2 ? samples : 2; }
+
+  // time between grain onsets, each moved by up to +/- jitter x interval
+  void setGrainInterval(float samples, float jitter = 0) {
+    mInterval = samples > 1 ? samples : 1;
+    mJitter = jitter;
+  }
+
+  // playback rate of each grain: 2 is an octave up
+  void setRate(float rate) { mRate = rate; }
+
+  // how fast the playhead moves through the source: 1 is the original
+  // speed, 0 freezes it
+  void setSpeed(float speed) { mSpeed = speed; }
+
+  // each grain starts up to +/- samples from the playhead
+  void setSpread(float samples) { mSpread = samples; }
+
+  void setAmplitude(float amplitude) { mGrainAmplitude = amplitude; }
+
+  // move the playhead, in samples of the source
+  void setPlayhead(double position) { mPlayhead = position; }
+
+  double getPlayhead() const { return mPlayhead; }
+
+  int getNumActive() const { return mNumActive; }
+
+  int getMaxVoices() const { return (int)mVoices.size(); }
+
+  // grains dropped because every voice was busy
+  long getNumDropped() const { return mDropped; }
+
+  // write the next n samples (at most max_block) of every voice mixed
+  void process(float *output, int n) {
+    if (n > mMaxBlock) n = mMaxBlock;
+    if (mScheduling) schedule(n);
+    vDSP_vclr(output, 1, n);
+
+    for (int a = 0; a < mNumActive;) {
+      Voice &voice = mVoices[mActive[a]];
+      if (voice.onset >= n) {
+        voice.onset -= n;
+        a++;
+        continue;
+      }
+      int begin = voice.onset;
+      int count = min(n - begin, voice.remaining);
+      mix(voice, output + begin, count);
+      voice.onset = 0;
+      voice.remaining -= count;
+      if (voice.remaining == 0) {
+        mFree.push_back(mActive[a]);
+        mActive[a] = mActive[--mNumActive];
+      } else {
+        a++;
+      }
+    }
+  }
+
+ private:
+  struct Voice {
+    const float *source;
+    double position;         // in the source
+    float rate, amplitude;
+    int onset;               // samples until it starts
+    int remaining;           // samples left to play
+    float envelope, envelope_step;  // position in the window table
+  };
+
+  void mix(Voice &voice, float *output, int count) {
+    // envelope, times the amplitude
+    vDSP_vramp(&voice.envelope, &voice.envelope_step, &mIndex[0], 1, count);
+    vDSP_vlint(&mWindow[0], &mIndex[0], 1, &mEnvelope[0], 1, count,
+               mWindow.size());
+    vDSP_vsmul(&mEnvelope[0], 1, &voice.amplitude, &mEnvelope[0], 1, count);
+    voice.envelope += voice.envelope_step * count;
+
+    // source, read from just below the position so the interpolation
+    // indices stay small and exact however long the source is
+    long base = (long)voice.position;
+    const float *source = voice.source + base;
+    if (voice.rate == 1.0f && voice.position == (double)base) {
+      vDSP_vma(source, 1, &mEnvelope[0], 1, output, 1, output, 1, count);
+    } else {
+      float start = (float)(voice.position - base);
+      vDSP_vramp(&start, &voice.rate, &mIndex[0], 1, count);
+      vDSP_vlint(source, &mIndex[0], 1, &mSamples[0], 1, count,
+                 (vDSP_Length)(mIndex[count - 1] + 2));
+      vDSP_vma(&mSamples[0], 1, &mEnvelope[0], 1, output, 1, output, 1, count);
+    }
+    voice.position += (double)voice.rate * count;
+  }
+
+  // queue the built-in scheduler's grains that start in the next n samples
+  void schedule(int n) {
+    while (mNextOnset < n) {
+      int offset = (int)mNextOnset;
+      double position = mPlayhead + mSpeed * offset;
+      if (mSpread > 0) position += mSpread * (2.0f * uniform() - 1.0f);
+      // wrap into the source
+      position = fmod(position, (double)mSourceLength);
+      if (position < 0) position += mSourceLength;
+      trigger(offset, mSource, mSourceLength, position, mDuration, mRate,
+              mGrainAmplitude);
+
+      float interval = mInterval;
+      if (mJitter > 0) interval *= 1.0f + mJitter * (2.0f * uniform() - 1.0f);
+      mNextOnset += interval > 1 ? interval : 1;
+    }
+    mNextOnset -= n;
+    mPlayhead = fmod(mPlayhead + (double)mSpeed * n, (double)mSourceLength);
+    if (mPlayhead < 0) mPlayhead += mSourceLength;
+  }
+
+  // xorshift32, uniform in [0, 1)
+  float uniform() {
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return (mRandom >> 8) * (1.0f / 16777216.0f);
+  }
+
+  int mSampleRate, mMaxBlock, mWindowSize;
+  vector<Voice> mVoices;
+  vector<int> mActive;  // indices of the sounding voices
+  vector<int> mFree;    // and of the rest; never grows past its capacity
+  int mNumActive;
+  long mDropped;
+
+  vector<float> mWindow;
+  // scratch for one run of one voice
+  vector<float> mIndex, mEnvelope, mSamples;
+
+  // built-in scheduler
+  const float *mSource;
+  long mSourceLength;
+  bool mScheduling;
+  int mDuration;
+  float mInterval, mJitter, mRate, mSpeed, mSpread, mGrainAmplitude;
+  double mNextOnset, mPlayhead;
+  uint32_t mRandom;
+};
@@ -6,10 +6,12 @@
 ofxCvBlobTracker::ofxCvBlobTracker() {
     listener = NULL;
 	currentID = 1;
-	extraIDs = 0;
 	reject_distance_threshold = 150;
 	minimumDisplacementThreshold = 0.25f;
 	ghost_frames = 2;
+	process_noise = 25.0f;
+	measurement_noise = 4.0f;
+	gate_sigmas = 10.0f;
 }
 
 
@@ -89,7 +91,7 @@ void ofxCvBlobTracker::draw( float x, float y ) {
 * This method tracks by proximity and best fit.
 */
 void ofxCvBlobTracker::trackBlobs( const vector<ofxCvBlob>& _blobs ) {
-	unsigned int i, j, k;
+	unsigned int i, j;
 
     // Push to history, clear
 	history.push_back( blobs );
@@ -109,146 +111,81 @@ void ofxCvBlobTracker::trackBlobs( const vector<ofxCvBlob>& _blobs ) {
 	int prevsize = (*prev).size();
 
 
-	// now figure out the 'error' (distance) to all blobs in the previous
-    // frame. We are optimizing for the least change in distance.
-    // While this works really well we could also optimize for lowest
-    // deviation from predicted position, change in size etc...
+	// now figure out the cost of matching each blob to each blob in the
+    // previous frame: how far it is from where that blob was predicted
+    // to be.  pairs that are too far apart, in pixels or in standard
+    // deviations of the prediction, are gated: they cost as much as
+    // leaving both blobs unmatched.
+    //
+    // the assignment needs no more rows than columns, so with more new
+    // blobs than old ones the matrix is transposed.
+    bool transposed = cursize > prevsize;
+    int rows = transposed ? prevsize : cursize;
+    int cols = transposed ? cursize : prevsize;
+    float gated = (float)reject_distance_threshold;
+    costs.resize( rows * cols );
     
-	for( i=0; i<cursize; i++ ) {
-		blobs[i].error.clear();
-		blobs[i].closest.clear();
-
-		for( j=0; j<prevsize; j++ ) {
-            //calc error - distance to blob in prev frame
-            float deviationX = blobs[i].centroid.x - (*prev)[j].centroid.x;
-            float deviationY = blobs[i].centroid.y - (*prev)[j].centroid.y;
-            float error = (float)sqrt( deviationX*deviationX 
-                                     + deviationY*deviationY );
+	for( j=0; j<prevsize; j++ ) {
+        const ofxCvTrackedBlob& old = (*prev)[j];
+        const float* P = old.covariance;
+        // variance of the predicted position against a new measurement
+        float innovation = P[0] + 2.0f*P[1] + P[2] 
+                         + 0.25f*process_noise + measurement_noise;
+        float gate = gate_sigmas*gate_sigmas*innovation;
         
-			blobs[i].error.push_back( error );
-			blobs[i].closest.push_back( j );
-		}
-	}
-
-	// sort so we can make a list of the closest blobs in the previous frame..
-	for( i=0; i<cursize; i++ ) {
-		// Bubble sort closest.
-		for( j=0; j<prevsize; j++ )	{
-			for( k=0; k<prevsize-1-j; k++ )	{
-				// ugly as hell, I know.
-				if( blobs[i].error[blobs[i].closest[k+1]] 
-                    < blobs[i].error[blobs[i].closest[k]] ) {
-                    
-                    int tmp = blobs[i].closest[k];  // swap
-                    blobs[i].closest[k] = blobs[i].closest[k+1];
-                    blobs[i].closest[k+1] = tmp;
-				}
-			}
+		for( i=0; i<cursize; i++ ) {
+            float deviationX = blobs[i].centroid.x - old.predictedPos.x;
+            float deviationY = blobs[i].centroid.y - old.predictedPos.y;
+            float distance2 = deviationX*deviationX + deviationY*deviationY;
+            float cost = (float)sqrt( distance2 );
+            if( cost > gated || distance2 > gate ) {
+                cost = gated;
+            }
+            costs[transposed ? j*cols + i : i*cols + j] = cost;
 		}
 	}
 
-
-	// Generate a matrix of all the possible choices.
-	// Then we will calculate the errors for every possible match
-    // and pick the matrix that has the lowest error.
-    // This is an NP complete approach and exponentially increases in complexity
-    // with the number of blobs. To remedy for each blob we will only
-    // consider the 4 closest blobs of the previous frame.
-
-	ids.clear();
-
-
-	// collect id's.. 
-	for( i=0; i<cursize; i++ ) {
-		ids.push_back( -1 );
-	}
-
-	extraIDs = cursize - prevsize;
-	if( extraIDs < 0 ) {
-		extraIDs = 0;
-    }
-	matrix.clear();
-
-
-	// FIXME: we could scale numcheck depending on how many blobs there are
-	// if we are tracking a lot of blobs, we could check less.. 
-
-	if( cursize <= 4 ) {
-		numcheck = 4;
-	} else if( cursize <= 6 ) {
-		numcheck = 3;
-	} else if( cursize <= 10 ) {
-		numcheck = 2;
-	} else {
-		numcheck = 1;
-    }
-
-	if( prevsize < numcheck ) {
-		numcheck = prevsize;
-	}
-    
-	if( blobs.size() > 0 ) {
-		permute(0);
+    // the optimal assignment, in O(rows^2 cols)
+    matches.assign( cursize, -1 );
+    if( rows > 0 ) {
+        solveAssignment( rows, cols );
+        for( j=0; j<cols; j++ ) {
+            int row = col_match[j+1] - 1;
+            if( row < 0 ) {
+                continue;
+            }
+            int blob = transposed ? j : row;
+            int old = transposed ? row : j;
+            if( costs[row*cols + j] < gated ) {
+                matches[blob] = old;
+            }
+        }
     }
 
 
-	unsigned int num_results = matrix.size();
-
-
-	// loop through all the potential 
-    // ID configurations and find one with lowest error
-    
-	float best_error = 99999, error;
-	int best_error_ndx = -1;
-
-	for( j=0; j<num_results; j++ ) {
-		error = 0;
-		// get the error for each blob and sum
-		for( i=0; i<cursize; i++ ) {
-			//ofxCvTrackedBlob *f = 0;
-
-			if( matrix[j][i] != -1 ) {
-				error += blobs[i].error[matrix[j][i]];
-			}
-		}
-
-		if( error < best_error)	{
-			best_error = error;
-			best_error_ndx = j;		
-		}
-	}
-
-
 	// now that we know the optimal configuration, 
     // set the IDs and calculate some things..
     
-	if( best_error_ndx != -1 ) {
-		for( i=0; i<cursize; i++ ) {
-			if( matrix[best_error_ndx][i] != -1 ) {
-				blobs[i].id = (*prev)[matrix[best_error_ndx][i]].id;
-			} else {
-				blobs[i].id = -1;
-            }
-
-			if( blobs[i].id != -1 ) {
-				ofxCvTrackedBlob *oldblob = &(*prev)[matrix[best_error_ndx][i]];
-                
-				blobs[i].deltaLoc.x = (blobs[i].centroid.x - oldblob->centroid.x);
-				blobs[i].deltaLoc.y = (blobs[i].centroid.y - oldblob->centroid.y);
-
-				blobs[i].deltaArea = blobs[i].area - oldblob->area;
-                
-				blobs[i].predictedPos.x = blobs[i].centroid.x + blobs[i].deltaLoc.x;
-				blobs[i].predictedPos.y = blobs[i].centroid.y + blobs[i].deltaLoc.y;
-
-				blobs[i].deltaLocTotal.x = oldblob->deltaLocTotal.x + blobs[i].deltaLoc.x;
-				blobs[i].deltaLocTotal.y = oldblob->deltaLocTotal.y + blobs[i].deltaLoc.y;
-			} else {
-				blobs[i].deltaLoc = ofPoint( 0.0f, 0.0f );
-				blobs[i].deltaArea = 0;
-				blobs[i].predictedPos = blobs[i].centroid;
-				blobs[i].deltaLocTotal = ofPoint( 0.0f, 0.0f );
-			}
+	for( i=0; i<cursize; i++ ) {
+		if( matches[i] != -1 ) {
+			ofxCvTrackedBlob *oldblob = &(*prev)[matches[i]];
+			blobs[i].id = oldblob->id;
+			
+			blobs[i].deltaLoc.x = (blobs[i].centroid.x - oldblob->centroid.x);
+			blobs[i].deltaLoc.y = (blobs[i].centroid.y - oldblob->centroid.y);
+
+			blobs[i].deltaArea = blobs[i].area - oldblob->area;
+			
+			correct( blobs[i], *oldblob );
+
+			blobs[i].deltaLocTotal.x = oldblob->deltaLocTotal.x + blobs[i].deltaLoc.x;
+			blobs[i].deltaLocTotal.y = oldblob->deltaLocTotal.y + blobs[i].deltaLoc.y;
+		} else {
+			blobs[i].id = -1;
+			blobs[i].deltaLoc = ofPoint( 0.0f, 0.0f );
+			blobs[i].deltaArea = 0;
+			blobs[i].deltaLocTotal = ofPoint( 0.0f, 0.0f );
+			startTrack( blobs[i] );
 		}
 	}
     
@@ -304,12 +241,14 @@ void ofxCvBlobTracker::trackBlobs( const vector<ofxCvBlob>& _blobs ) {
 					//doUntouchEvent( (*prev)[i].getTouchData() );
                     doBlobOff( (*prev)[i] );
 				} else {
+					predict( (*prev)[i] );  // coast on its velocity
 					blobs.push_back( (*prev)[i] );  // keep it around 
                                                     // until framesleft = 0
                 }
 			} else {
 				(*prev)[i].markedForDeletion = true;
 				(*prev)[i].framesLeft = ghost_frames;
+				predict( (*prev)[i] );  // coast on its velocity
 				blobs.push_back( (*prev)[i] );  // keep it around 
                                                 // until framesleft = 0
 			}
@@ -353,70 +292,113 @@ void ofxCvBlobTracker::doBlobOff( const ofxCvTrackedBlob& b ) {
 // Helper Methods
 //
 //
-inline void ofxCvBlobTracker::permute( int start ) {  
-    if( start == ids.size() ) {
-        //for( int i=0; i<start; i++)
-        //{
-        //printf("%d, ", ids[i]);
-        //}
-        //printf("--------\n");
-        matrix.push_back( ids );
-
-    } else {
-        int numchecked = 0;
-
-        for( int i=0; i<blobs[start].closest.size(); i++ ) {
-            if( blobs[start].error[blobs[start].closest[i]] 
-                > reject_distance_threshold ) {
-                
-                break;
-            }
-
-            ids[start] = blobs[start].closest[i];
-            if( checkValid(start) ) {
-                permute( start+1 );
-                numchecked++;
-            }
-
-            if( numchecked >= numcheck ) {
-                break;
+/**
+* Hungarian algorithm (Kuhn-Munkres with row and column potentials):
+* assigns each of rows rows of costs to a different one of cols >= rows
+* columns, with the least total cost.  Afterwards col_match[j+1] is
+* 1 + the row given column j, or 0 if none was.
+*/
+void ofxCvBlobTracker::solveAssignment( int rows, int cols ) {
+    // 1-based, with row and column 0 as a sentinel
+    row_potential.assign( rows+1, 0.0 );
+    col_potential.assign( cols+1, 0.0 );
+    col_match.assign( cols+1, 0 );
+    col_way.assign( cols+1, 0 );
+    
+    for( int i=1; i<=rows; i++ ) {
+        // grow an alternating path from row i until it reaches a free
+        // column, along the least reduced costs
+        col_match[0] = i;
+        int j0 = 0;
+        min_slack.assign( cols+1, HUGE_VAL );
+        col_used.assign( cols+1, 0 );
+        do {
+            col_used[j0] = 1;
+            int i0 = col_match[j0];
+            int j1 = 0;
+            double delta = HUGE_VAL;
+            const float* row = &costs[(i0-1)*cols];
+            for( int j=1; j<=cols; j++ ) {
+                if( !col_used[j] ) {
+                    double slack = row[j-1] - row_potential[i0] - col_potential[j];
+                    if( slack < min_slack[j] ) {
+                        min_slack[j] = slack;
+                        col_way[j] = j0;
+                    }
+                    if( min_slack[j] < delta ) {
+                        delta = min_slack[j];
+                        j1 = j;
+                    }
+                }
             }
-        }
-
-        if( extraIDs > 0 ) {
-            ids[start] = -1;		// new ID
-            if( checkValidNew(start) ) {
-                permute(start+1);
+            for( int j=0; j<=cols; j++ ) {
+                if( col_used[j] ) {
+                    row_potential[col_match[j]] += delta;
+                    col_potential[j] -= delta;
+                } else {
+                    min_slack[j] -= delta;
+                }
             }
-        }
+            j0 = j1;
+        } while( col_match[j0] != 0 );
+        
+        // flip the path
+        do {
+            int j1 = col_way[j0];
+            col_match[j0] = col_match[j1];
+            j0 = j1;
+        } while( j0 != 0 );
     }
 }
 
-inline bool ofxCvBlobTracker::checkValidNew( int start ) {
-	int newidcount = 0;
-	newidcount ++;
-	for( int i=0; i<start; i++ ) {
-        if(ids[i] == -1) {
-            newidcount ++;
-        }
-	}
 
-	if( newidcount > extraIDs ) { 
-        return false;
-    }
-    
-	return true;
+// Kalman filter, with a constant velocity model per axis
+//
+//
+void ofxCvBlobTracker::predict( ofxCvTrackedBlob& b ) {
+    float* P = b.covariance;
+    P[0] += 2.0f*P[1] + P[2] + 0.25f*process_noise;
+    P[1] += P[2] + 0.5f*process_noise;
+    P[2] += process_noise;
+    b.filteredPos = b.predictedPos;
+    b.predictedPos.x = b.filteredPos.x + b.filteredVel.x;
+    b.predictedPos.y = b.filteredPos.y + b.filteredVel.y;
 }
 
-inline bool ofxCvBlobTracker::checkValid( int start ) {
-	for(int i=0; i<start; i++) {
-        // check to see whether this ID exists already
-        if(ids[i] == ids[start]) {
-            return false;
-        }
-	}
+void ofxCvBlobTracker::correct( ofxCvTrackedBlob& b, const ofxCvTrackedBlob& previous ) {
+    // predict from the previous frame...
+    const float* Q = previous.covariance;
+    float P0 = Q[0] + 2.0f*Q[1] + Q[2] + 0.25f*process_noise;
+    float P1 = Q[1] + Q[2] + 0.5f*process_noise;
+    float P2 = Q[2] + process_noise;
+    
+    // ...and move towards the measured centroid
+    float gain0 = P0 / (P0 + measurement_noise);
+    float gain1 = P1 / (P0 + measurement_noise);
+    float innovationX = b.centroid.x - previous.predictedPos.x;
+    float innovationY = b.centroid.y - previous.predictedPos.y;
+    
+    b.filteredPos.x = previous.predictedPos.x + gain0*innovationX;
+    b.filteredPos.y = previous.predictedPos.y + gain0*innovationY;
+    b.filteredVel.x = previous.filteredVel.x + gain1*innovationX;
+    b.filteredVel.y = previous.filteredVel.y + gain1*innovationY;
+    b.covariance[0] = (1.0f - gain0)*P0;
+    b.covariance[1] = (1.0f - gain0)*P1;
+    b.covariance[2] = P2 - gain1*P1;
+    
+    b.predictedPos.x = b.filteredPos.x + b.filteredVel.x;
+    b.predictedPos.y = b.filteredPos.y + b.filteredVel.y;
+}
 
-    return true;
+void ofxCvBlobTracker::startTrack( ofxCvTrackedBlob& b ) {
+    // where it is is known, how fast it is moving is not: allow for
+    // anything up to the distance at which blobs are rejected
+    b.filteredPos = b.centroid;
+    b.filteredVel = ofPoint( 0.0f, 0.0f );
+    b.predictedPos = b.centroid;
+    b.covariance[0] = measurement_noise;
+    b.covariance[1] = 0.0f;
+    b.covariance[2] = (float)reject_distance_threshold*reject_distance_threshold;
 }
 
 
@@ -48,8 +48,6 @@ class ofxCvBlobTracker {
   protected:
   
     int currentID;
-    int extraIDs;
-    int numcheck;
     
     ofxCvBlobListener* listener;
 
@@ -57,18 +55,31 @@ class ofxCvBlobTracker {
     int ghost_frames;
     float minimumDisplacementThreshold;
 
-    vector<vector<int> > matrix;
-    vector<int> ids;
+    // the kalman filter's noise: how much a blob's velocity may change
+    // between frames, and how far its centroid may be off (both in
+    // pixels squared), and how many standard deviations from its
+    // predicted position a blob can still be matched
+    float process_noise;
+    float measurement_noise;
+    float gate_sigmas;
+
     vector<vector<ofxCvTrackedBlob> > history;
     
+    // for the assignment, kept between frames to save allocating
+    vector<float> costs;
+    vector<double> row_potential, col_potential, min_slack;
+    vector<int> col_match, col_way, matches;
+    vector<char> col_used;
+    
     
     void doBlobOn( const ofxCvTrackedBlob& b );    
     void doBlobMoved( const ofxCvTrackedBlob& b );    
     void doBlobOff( const ofxCvTrackedBlob& b );    
     
-    inline void permute( int k );
-    inline bool checkValid( int start );
-    inline bool checkValidNew( int start );    
+    void solveAssignment( int rows, int cols );
+    void predict( ofxCvTrackedBlob& b );
+    void correct( ofxCvTrackedBlob& b, const ofxCvTrackedBlob& previous );
+    void startTrack( ofxCvTrackedBlob& b );
 };
 
 
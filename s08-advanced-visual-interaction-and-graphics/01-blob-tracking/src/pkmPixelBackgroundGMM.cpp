@@ -8,7 +8,280 @@
 // improvements on zivkovic's original 2005 implementation 
 
 #include "pkmPixelBackgroundGMM.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//a band is at least this many pixels, so waking a thread for it is always
+//worth it
+#define PBGMM_MIN_BAND_PIXELS 4096
+//bands per thread, so that a thread that finishes early can take another
+#define PBGMM_BANDS_PER_THREAD 4
+
+//the vector unit the kernels run on: PBGMM_LANES pixels at a time with AVX
+//(8), SSE or NEON (4), or one at a time with plain floats.
+//pbgmm_v holds a float per lane and pbgmm_m a true/false per lane.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PBGMM_LANES 8
+typedef __m256 pbgmm_v;
+typedef __m256 pbgmm_m;
+static inline pbgmm_v _pbgmm_set(float x) {return _mm256_set1_ps(x);}
+static inline pbgmm_v _pbgmm_load(const float* p) {return _mm256_load_ps(p);}
+static inline void _pbgmm_store(float* p,pbgmm_v a) {_mm256_store_ps(p,a);}
+static inline pbgmm_v _pbgmm_add(pbgmm_v a,pbgmm_v b) {return _mm256_add_ps(a,b);}
+static inline pbgmm_v _pbgmm_sub(pbgmm_v a,pbgmm_v b) {return _mm256_sub_ps(a,b);}
+static inline pbgmm_v _pbgmm_mul(pbgmm_v a,pbgmm_v b) {return _mm256_mul_ps(a,b);}
+static inline pbgmm_v _pbgmm_div(pbgmm_v a,pbgmm_v b) {return _mm256_div_ps(a,b);}
+static inline pbgmm_v _pbgmm_min(pbgmm_v a,pbgmm_v b) {return _mm256_min_ps(a,b);}
+static inline pbgmm_v _pbgmm_max(pbgmm_v a,pbgmm_v b) {return _mm256_max_ps(a,b);}
+static inline pbgmm_m _pbgmm_lt(pbgmm_v a,pbgmm_v b) {return _mm256_cmp_ps(a,b,_CMP_LT_OQ);}
+static inline pbgmm_m _pbgmm_le(pbgmm_v a,pbgmm_v b) {return _mm256_cmp_ps(a,b,_CMP_LE_OQ);}
+static inline pbgmm_m _pbgmm_eq(pbgmm_v a,pbgmm_v b) {return _mm256_cmp_ps(a,b,_CMP_EQ_OQ);}
+static inline pbgmm_m _pbgmm_and(pbgmm_m a,pbgmm_m b) {return _mm256_and_ps(a,b);}
+static inline pbgmm_m _pbgmm_or(pbgmm_m a,pbgmm_m b) {return _mm256_or_ps(a,b);}
+static inline pbgmm_m _pbgmm_andnot(pbgmm_m a,pbgmm_m b) {return _mm256_andnot_ps(b,a);}
+static inline pbgmm_m _pbgmm_false() {return _mm256_setzero_ps();}
+static inline bool _pbgmm_any(pbgmm_m a) {return _mm256_movemask_ps(a)!=0;}
+static inline pbgmm_v _pbgmm_select(pbgmm_m m,pbgmm_v a,pbgmm_v b) {return _mm256_blendv_ps(b,a,m);}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PBGMM_LANES 4
+typedef __m128 pbgmm_v;
+typedef __m128 pbgmm_m;
+static inline pbgmm_v _pbgmm_set(float x) {return _mm_set1_ps(x);}
+static inline pbgmm_v _pbgmm_load(const float* p) {return _mm_load_ps(p);}
+static inline void _pbgmm_store(float* p,pbgmm_v a) {_mm_store_ps(p,a);}
+static inline pbgmm_v _pbgmm_add(pbgmm_v a,pbgmm_v b) {return _mm_add_ps(a,b);}
+static inline pbgmm_v _pbgmm_sub(pbgmm_v a,pbgmm_v b) {return _mm_sub_ps(a,b);}
+static inline pbgmm_v _pbgmm_mul(pbgmm_v a,pbgmm_v b) {return _mm_mul_ps(a,b);}
+static inline pbgmm_v _pbgmm_div(pbgmm_v a,pbgmm_v b) {return _mm_div_ps(a,b);}
+static inline pbgmm_v _pbgmm_min(pbgmm_v a,pbgmm_v b) {return _mm_min_ps(a,b);}
+static inline pbgmm_v _pbgmm_max(pbgmm_v a,pbgmm_v b) {return _mm_max_ps(a,b);}
+static inline pbgmm_m _pbgmm_lt(pbgmm_v a,pbgmm_v b) {return _mm_cmplt_ps(a,b);}
+static inline pbgmm_m _pbgmm_le(pbgmm_v a,pbgmm_v b) {return _mm_cmple_ps(a,b);}
+static inline pbgmm_m _pbgmm_eq(pbgmm_v a,pbgmm_v b) {return _mm_cmpeq_ps(a,b);}
+static inline pbgmm_m _pbgmm_and(pbgmm_m a,pbgmm_m b) {return _mm_and_ps(a,b);}
+static inline pbgmm_m _pbgmm_or(pbgmm_m a,pbgmm_m b) {return _mm_or_ps(a,b);}
+static inline pbgmm_m _pbgmm_andnot(pbgmm_m a,pbgmm_m b) {return _mm_andnot_ps(b,a);}
+static inline pbgmm_m _pbgmm_false() {return _mm_setzero_ps();}
+static inline bool _pbgmm_any(pbgmm_m a) {return _mm_movemask_ps(a)!=0;}
+static inline pbgmm_v _pbgmm_select(pbgmm_m m,pbgmm_v a,pbgmm_v b) {return _mm_or_ps(_mm_and_ps(m,a),_mm_andnot_ps(m,b));}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PBGMM_LANES 4
+typedef float32x4_t pbgmm_v;
+typedef uint32x4_t pbgmm_m;
+static inline pbgmm_v _pbgmm_set(float x) {return vdupq_n_f32(x);}
+static inline pbgmm_v _pbgmm_load(const float* p) {return vld1q_f32(p);}
+static inline void _pbgmm_store(float* p,pbgmm_v a) {vst1q_f32(p,a);}
+static inline pbgmm_v _pbgmm_add(pbgmm_v a,pbgmm_v b) {return vaddq_f32(a,b);}
+static inline pbgmm_v _pbgmm_sub(pbgmm_v a,pbgmm_v b) {return vsubq_f32(a,b);}
+static inline pbgmm_v _pbgmm_mul(pbgmm_v a,pbgmm_v b) {return vmulq_f32(a,b);}
+static inline pbgmm_v _pbgmm_div(pbgmm_v a,pbgmm_v b) {return vdivq_f32(a,b);}
+static inline pbgmm_v _pbgmm_min(pbgmm_v a,pbgmm_v b) {return vminq_f32(a,b);}
+static inline pbgmm_v _pbgmm_max(pbgmm_v a,pbgmm_v b) {return vmaxq_f32(a,b);}
+static inline pbgmm_m _pbgmm_lt(pbgmm_v a,pbgmm_v b) {return vcltq_f32(a,b);}
+static inline pbgmm_m _pbgmm_le(pbgmm_v a,pbgmm_v b) {return vcleq_f32(a,b);}
+static inline pbgmm_m _pbgmm_eq(pbgmm_v a,pbgmm_v b) {return vceqq_f32(a,b);}
+static inline pbgmm_m _pbgmm_and(pbgmm_m a,pbgmm_m b) {return vandq_u32(a,b);}
+static inline pbgmm_m _pbgmm_or(pbgmm_m a,pbgmm_m b) {return vorrq_u32(a,b);}
+static inline pbgmm_m _pbgmm_andnot(pbgmm_m a,pbgmm_m b) {return vbicq_u32(a,b);}
+static inline pbgmm_m _pbgmm_false() {return vdupq_n_u32(0);}
+static inline bool _pbgmm_any(pbgmm_m a) {return vmaxvq_u32(a)!=0;}
+static inline pbgmm_v _pbgmm_select(pbgmm_m m,pbgmm_v a,pbgmm_v b) {return vbslq_f32(m,a,b);}
+#else
+#define PBGMM_LANES 1
+typedef float pbgmm_v;
+typedef bool pbgmm_m;
+static inline pbgmm_v _pbgmm_set(float x) {return x;}
+static inline pbgmm_v _pbgmm_load(const float* p) {return *p;}
+static inline void _pbgmm_store(float* p,pbgmm_v a) {*p=a;}
+static inline pbgmm_v _pbgmm_add(pbgmm_v a,pbgmm_v b) {return a+b;}
+static inline pbgmm_v _pbgmm_sub(pbgmm_v a,pbgmm_v b) {return a-b;}
+static inline pbgmm_v _pbgmm_mul(pbgmm_v a,pbgmm_v b) {return a*b;}
+static inline pbgmm_v _pbgmm_div(pbgmm_v a,pbgmm_v b) {return a/b;}
+static inline pbgmm_v _pbgmm_min(pbgmm_v a,pbgmm_v b) {return b<a?b:a;}
+static inline pbgmm_v _pbgmm_max(pbgmm_v a,pbgmm_v b) {return a<b?b:a;}
+static inline pbgmm_m _pbgmm_lt(pbgmm_v a,pbgmm_v b) {return a<b;}
+static inline pbgmm_m _pbgmm_le(pbgmm_v a,pbgmm_v b) {return a<=b;}
+static inline pbgmm_m _pbgmm_eq(pbgmm_v a,pbgmm_v b) {return a==b;}
+static inline pbgmm_m _pbgmm_and(pbgmm_m a,pbgmm_m b) {return a&&b;}
+static inline pbgmm_m _pbgmm_or(pbgmm_m a,pbgmm_m b) {return a||b;}
+static inline pbgmm_m _pbgmm_andnot(pbgmm_m a,pbgmm_m b) {return a&&!b;}
+static inline pbgmm_m _pbgmm_false() {return false;}
+static inline bool _pbgmm_any(pbgmm_m a) {return a;}
+static inline pbgmm_v _pbgmm_select(pbgmm_m m,pbgmm_v a,pbgmm_v b) {return m?a:b;}
+#endif
+
+//blocks of the model to fetch ahead
+#define PBGMM_PREFETCH_BLOCKS 2
+#if defined(__GNUC__)
+#define PBGMM_PREFETCH(p,n) for (long _l=0;_l<(n);_l+=64/sizeof(float)) __builtin_prefetch((p)+_l)
+#else
+#define PBGMM_PREFETCH(p,n)
+#endif
+
+//where field f of mode m of the block of pixels at pBlock starts
+#define PBGMM_PLANE(pBlock,m,f) ((pBlock)+((m)*PBGMM_FIELDS+(f))*PBGMM_BLOCK)
+
+//the parameters, as the kernels use them
+typedef struct CvPBGMMConstants
+{
+	int nM;
+	float fAlphaT;
+	float fOneMinAlpha;
+	float fTb;
+	float fTB;
+	float fTg;
+	float fSigma;
+	float fPrune;
+	float fTau;
+	int bShadowDetection;
+} CvPBGMMConstants;
+
+static void _cvGetConstantsGMM(CvPixelBackgroundGMM* pGMM,CvPBGMMConstants* c)
+{
+	c->nM=pGMM->nM;
+	c->fAlphaT=pGMM->fAlphaT;
+	c->fOneMinAlpha=1-pGMM->fAlphaT;
+	c->fTb=pGMM->fTb;//Tb - threshold on the Mahalan. dist.
+	c->fTB=pGMM->fTB;//1-TF from the paper
+	c->fTg=pGMM->fTg;//Tg - when to generate a new component
+	c->fSigma=pGMM->fSigma;//initial sigma
+	c->fPrune=-pGMM->fAlphaT*pGMM->fCT;//CT - complexity reduction prior
+	c->fTau=pGMM->fTau;
+	c->bShadowDetection=pGMM->bShadowDetection;
+}
+
+//threads that wait for a frame, then take bands of its pixels in turn
+//until there are none left. the calling thread takes bands too.
+struct CvPBGMMThreadPool
+{
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;//a new frame, or quit
+	std::condition_variable done;//no thread is busy any more
+	long frame;
+	int nBusy;
+	bool bQuit;
+
+	//the current frame
+	std::function<void(int,int)> job;//update pixels [first,last)
+	int nBands;
+	int nBandSize;//pixels in a band
+	int nSize;
+	std::atomic<int> nextBand;
+};
+
+static void _cvRunBands(CvPBGMMThreadPool* pPool)
+{
+	int band;
+	while ((band=pPool->nextBand.fetch_add(1))<pPool->nBands)
+	{
+		int first=band*pPool->nBandSize;
+		int last=first+pPool->nBandSize;
+		pPool->job(first,last<pPool->nSize?last:pPool->nSize);
+	}
+}
+
+static void _cvBandWorker(CvPBGMMThreadPool* pPool)
+{
+	long frame=0;
+	std::unique_lock<std::mutex> lock(pPool->mutex);
+	for (;;)
+	{
+		while (!pPool->bQuit && pPool->frame==frame)
+			pPool->wake.wait(lock);
+		if (pPool->bQuit)
+			return;
+		frame=pPool->frame;
+		pPool->nBusy++;
+		lock.unlock();
+		_cvRunBands(pPool);
+		lock.lock();
+		if (--pPool->nBusy==0)
+			pPool->done.notify_all();
+	}
+}
 
+static void _cvStopBandWorkers(CvPixelBackgroundGMM* pGMM)
+{
+	CvPBGMMThreadPool* pPool=pGMM->pThreads;
+	if (!pPool)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(pPool->mutex);
+		pPool->bQuit=true;
+	}
+	pPool->wake.notify_all();
+	for (size_t t=0;t<pPool->threads.size();t++)
+		pPool->threads[t].join();
+	delete pPool;
+	pGMM->pThreads=0;
+}
+
+//call job(first,last) for every band of the image, spread over nThreads
+//threads (the calling thread and nThreads-1 workers), and return when they
+//are all done. bands start on a block of the model.
+static void _cvForEachBand(CvPixelBackgroundGMM* pGMM,const std::function<void(int,int)>& job)
+{
+	int nThreads=pGMM->nThreads;
+	int nBandSize=(pGMM->nSize+nThreads*PBGMM_BANDS_PER_THREAD-1)/(nThreads*PBGMM_BANDS_PER_THREAD);
+	if (nBandSize<PBGMM_MIN_BAND_PIXELS)
+		nBandSize=PBGMM_MIN_BAND_PIXELS;
+	nBandSize=(nBandSize+PBGMM_BLOCK-1)/PBGMM_BLOCK*PBGMM_BLOCK;
+	int nBands=(pGMM->nSize+nBandSize-1)/nBandSize;
+	if (nThreads<=1 || nBands<=1)
+	{
+		job(0,pGMM->nSize);
+		return;
+	}
+
+	//(re)start the workers if nThreads changed
+	CvPBGMMThreadPool* pPool=pGMM->pThreads;
+	if (pPool && (int)pPool->threads.size()!=nThreads-1)
+	{
+		_cvStopBandWorkers(pGMM);
+		pPool=0;
+	}
+	if (!pPool)
+	{
+		pPool=new CvPBGMMThreadPool;
+		pPool->frame=0;
+		pPool->nBusy=0;
+		pPool->bQuit=false;
+		pPool->nBands=0;
+		pPool->nextBand=0;
+		for (int t=1;t<nThreads;t++)
+			pPool->threads.push_back(std::thread(_cvBandWorker,pPool));
+		pGMM->pThreads=pPool;
+	}
+
+	{
+		//a worker that woke too late for the last frame may still be
+		//looking for a band of it
+		std::unique_lock<std::mutex> lock(pPool->mutex);
+		while (pPool->nBusy)
+			pPool->done.wait(lock);
+		pPool->job=job;
+		pPool->nBands=nBands;
+		pPool->nBandSize=nBandSize;
+		pPool->nSize=pGMM->nSize;
+		pPool->nextBand=0;
+		pPool->frame++;
+	}
+	pPool->wake.notify_all();
+	_cvRunBands(pPool);
+
+	//every band has been taken, wait for the ones still being updated
+	std::unique_lock<std::mutex> lock(pPool->mutex);
+	while (pPool->nBusy)
+		pPool->done.wait(lock);
+}
 
 CvPixelBackgroundGMM* cvCreatePixelBackgroundGMM(int width,int height)
 {
@@ -41,20 +314,35 @@ CvPixelBackgroundGMM* cvCreatePixelBackgroundGMM(int width,int height)
 	pGMM->fTau = 0.5f;// Tau - shadow threshold
 
 
-	//GMM for each pixel
-	pGMM->rGMM=(CvPBGMMGaussian*) malloc(size * pGMM->nM * sizeof(CvPBGMMGaussian));
+	//GMM for each pixel, in whole blocks, starting on a cache line.
+	//unused modes have weight 0.
+	long blocks=(size+PBGMM_BLOCK-1)/PBGMM_BLOCK;
+	size_t bytes=blocks * PBGMM_BLOCK * PBGMM_FIELDS * pGMM->nM * sizeof(float);
+	void* pModels=0;
+	if (posix_memalign(&pModels,64,bytes))
+		pModels=0;
+	else
+		memset(pModels,0,bytes);
+	pGMM->rGMM=(float*) pModels;
 
 	//used modes per pixel
-	pGMM->rnUsedModes = (unsigned char* ) malloc(size);
-	memset(pGMM->rnUsedModes,0,size);//no modes used
+	pGMM->rnUsedModes = (unsigned char* ) malloc(blocks * PBGMM_BLOCK);
+	memset(pGMM->rnUsedModes,0,blocks * PBGMM_BLOCK);//no modes used
     pGMM->bRemoveForeground=0;
+
+	//threads
+	pGMM->nThreads=(int)std::thread::hardware_concurrency();
+	if (pGMM->nThreads<1)
+		pGMM->nThreads=1;
+	pGMM->pThreads=0;
 	return pGMM;
 }
 
 void cvReleasePixelBackgroundGMM(CvPixelBackgroundGMM** ppGMM)
 {
-	delete (*ppGMM)->rGMM;
-	delete (*ppGMM)->rnUsedModes;
+	_cvStopBandWorkers(*ppGMM);
+	free((*ppGMM)->rGMM);
+	free((*ppGMM)->rnUsedModes);
 	delete (*ppGMM);
 	(*ppGMM)=0;
 }
@@ -64,599 +352,379 @@ void cvReleasePixelBackgroundGMM(CvPixelBackgroundGMM** ppGMM)
 void cvSetPixelBackgroundGMM(CvPixelBackgroundGMM* pGMM,unsigned char* data)
 {
 	int size=pGMM->nSize;
+	int m_nM=pGMM->nM;
 	unsigned char* pDataCurrent=data;
-	
+
 	for (int i=0;i<size;i++)
 	{
 	// retrieve the colors
 		float R = *pDataCurrent++;
 		float G = *pDataCurrent++;
 		float B = *pDataCurrent++;
-	
-		pGMM->rGMM[i].weight=1.0;
-		pGMM->rGMM[i].muR=R;
-		pGMM->rGMM[i].muG=G;
-		pGMM->rGMM[i].muB=B;
-		pGMM->rGMM[i].sigma=pGMM->fSigma;
+
+		//one mode, the others unused
+		float* pBlock=pGMM->rGMM+(long)(i/PBGMM_BLOCK)*PBGMM_BLOCK*PBGMM_FIELDS*m_nM;
+		int lane=i%PBGMM_BLOCK;
+		for (int iModes=0;iModes<m_nM;iModes++)
+			PBGMM_PLANE(pBlock,iModes,PBGMM_WEIGHT)[lane]=0;
+		PBGMM_PLANE(pBlock,0,PBGMM_WEIGHT)[lane]=1.0;
+		PBGMM_PLANE(pBlock,0,PBGMM_MUR)[lane]=R;
+		PBGMM_PLANE(pBlock,0,PBGMM_MUG)[lane]=G;
+		PBGMM_PLANE(pBlock,0,PBGMM_MUB)[lane]=B;
+		PBGMM_PLANE(pBlock,0,PBGMM_SIGMA)[lane]=pGMM->fSigma;
 	}
-		
+
 	memset(pGMM->rnUsedModes,1,size);//1 mode used
 
 }
 
-int _cvRemoveShadowGMM(long posPixel, 
-								float red, float green, float blue, 
-								unsigned char nModes, 
-								CvPBGMMGaussian* m_aGaussians,
-								int m_nM,
-								float m_fTb,
-								float m_fTB,	
-								float m_fTg,
-								float m_fTau)
+//shadow detection for PBGMM_LANES pixels starting at lane j of a block:
+//which of the pixels still open are a darker version of one of the
+//background modes
+static pbgmm_m _cvRemoveShadowGMM(const CvPBGMMConstants& c,
+								const float* pBlock, int j, int nMax, pbgmm_v nModes,
+								pbgmm_v red, pbgmm_v green, pbgmm_v blue,
+								pbgmm_m open)
 {
-	//calculate distances to the modes (+ sort???)
-	//here we need to go in descending order!!!
-//	long posPixel = pixel * m_nM;
-	long pos;
-	float tWeight = 0;
-	float numerator, denominator;
+	pbgmm_v zero=_pbgmm_set(0);
+	pbgmm_v one=_pbgmm_set(1);
+	pbgmm_v Tb=_pbgmm_set(c.fTb);
+	pbgmm_v TB=_pbgmm_set(c.fTB);
+	pbgmm_v Tau=_pbgmm_set(c.fTau);
+	pbgmm_m shadow=_pbgmm_false();
+	pbgmm_v tWeight=zero;
+
 	// check all the distributions, marked as background:
-	for (int iModes=0;iModes<nModes;iModes++)
+	//here we need to go in descending order!!!
+	for (int iModes=0;iModes<nMax && _pbgmm_any(open);iModes++)
 	{
-		pos=posPixel+iModes;
-		float var = m_aGaussians[pos].sigma;
-		float muR = m_aGaussians[pos].muR;
-		float muG = m_aGaussians[pos].muG;
-		float muB = m_aGaussians[pos].muB;
-		float weight = m_aGaussians[pos].weight;
-		tWeight += weight;
-		
-		numerator = red * muR + green * muG + blue * muB;
-		denominator = muR * muR + muG * muG + muB * muB;
+		pbgmm_v var=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_SIGMA)+j);
+		pbgmm_v muR=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUR)+j);
+		pbgmm_v muG=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUG)+j);
+		pbgmm_v muB=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUB)+j);
+		pbgmm_v weight=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_WEIGHT)+j);
+		tWeight=_pbgmm_add(tWeight,weight);
+
+		pbgmm_v numerator=_pbgmm_add(_pbgmm_add(_pbgmm_mul(red,muR),_pbgmm_mul(green,muG)),_pbgmm_mul(blue,muB));
+		pbgmm_v denominator=_pbgmm_add(_pbgmm_add(_pbgmm_mul(muR,muR),_pbgmm_mul(muG,muG)),_pbgmm_mul(muB,muB));
 		// no division by zero allowed
-		if (denominator == 0)
-		{
-				break;
-		};
-		float a = numerator / denominator;
+		open=_pbgmm_and(open,_pbgmm_lt(_pbgmm_set((float)iModes),nModes));
+		open=_pbgmm_andnot(open,_pbgmm_eq(denominator,zero));
+		pbgmm_v a=_pbgmm_div(numerator,denominator);
 
 		// if tau < a < 1 then also check the color distortion
-		if ((a <= 1) && (a >= m_fTau))//m_nBeta=1
-		{
-			float dR=a * muR - red;
-			float dG=a * muG - green;
-			float dB=a * muB - blue;
-
-			//square distance -slower and less accurate
-			//float maxDistance = cvSqrt(m_fTb*var);
-			//if ((fabs(dR) <= maxDistance) && (fabs(dG) <= maxDistance) && (fabs(dB) <= maxDistance))
-			//circle
-			float dist=(dR*dR+dG*dG+dB*dB);
-			if (dist<m_fTb*var*a*a)
-			{
-				return 2;
-			}
-		};
-		if (tWeight > m_fTB)
-		{
-				break;
-		};
-	};
-	return 0;
+		pbgmm_v dR=_pbgmm_sub(_pbgmm_mul(a,muR),red);
+		pbgmm_v dG=_pbgmm_sub(_pbgmm_mul(a,muG),green);
+		pbgmm_v dB=_pbgmm_sub(_pbgmm_mul(a,muB),blue);
+		pbgmm_v dist=_pbgmm_add(_pbgmm_add(_pbgmm_mul(dR,dR),_pbgmm_mul(dG,dG)),_pbgmm_mul(dB,dB));
+		pbgmm_m found=_pbgmm_and(open,_pbgmm_and(_pbgmm_le(a,one),_pbgmm_le(Tau,a)));
+		found=_pbgmm_and(found,_pbgmm_lt(dist,_pbgmm_mul(_pbgmm_mul(Tb,var),_pbgmm_mul(a,a))));
+		shadow=_pbgmm_or(shadow,found);
+
+		open=_pbgmm_andnot(open,found);
+		open=_pbgmm_andnot(open,_pbgmm_lt(TB,tWeight));
+	}
+	return shadow;
 }
 
-
-
-
-int _cvUpdatePixelBackgroundGMM(long posPixel, 
-								float red, float green, float blue, 
-								unsigned char* pModesUsed, 
-								CvPBGMMGaussian* m_aGaussians,
-								int m_nM,
-								float m_fAlphaT,
-								float m_fTb,
-								float m_fTB,	
-								float m_fTg,
-								float m_fSigma,
-								float m_fPrune)
+//update the models of one block of PBGMM_BLOCK pixels, PBGMM_LANES at a
+//time in lockstep, and classify the pixels: 0 background, 125 shadow,
+//255 foreground. the colors and the numbers of modes are in planes of
+//PBGMM_BLOCK floats.
+static void _cvUpdatePixelBackgroundGMM(const CvPBGMMConstants& c, float* pBlock,
+								const float* pRed, const float* pGreen, const float* pBlue,
+								float* pModesUsed, float* pResult)
 {
-	//calculate distances to the modes (+ sort???)
-	//here we need to go in descending order!!!
-	
-	//long posPixel = pixel * m_nM;
-	long pos;
-
-//	long pos=posPixel-1;//because of ++ at the end
-	
-	bool bFitsPDF=0;
-	bool bBackground=0;
-
-	float m_fOneMinAlpha=1-m_fAlphaT;
-
-	//bool bPrune=0;
-	int nModes=*pModesUsed;
-	float totalWeight=0.0f;
-
-	//////
-	//go through all modes
-	for (int iModes=0;iModes<nModes;iModes++)
+	int m_nM=c.nM;
+	pbgmm_v zero=_pbgmm_set(0);
+	pbgmm_v one=_pbgmm_set(1);
+	pbgmm_v alpha=_pbgmm_set(c.fAlphaT);
+	pbgmm_v oneMinAlpha=_pbgmm_set(c.fOneMinAlpha);
+	pbgmm_v prune=_pbgmm_set(c.fPrune);
+	pbgmm_v minusPrune=_pbgmm_set(-c.fPrune);
+	pbgmm_v Tb=_pbgmm_set(c.fTb);
+	pbgmm_v TB=_pbgmm_set(c.fTB);
+	pbgmm_v Tg=_pbgmm_set(c.fTg);
+	pbgmm_v sigma=_pbgmm_set(c.fSigma);
+	pbgmm_v minVar=_pbgmm_set(4);
+	pbgmm_v maxVar=_pbgmm_set(5*c.fSigma);
+
+	for (int j=0;j<PBGMM_BLOCK;j+=PBGMM_LANES)
 	{
-		pos=posPixel+iModes;
-		float weight = m_aGaussians[pos].weight;
-
-		////
-		//fit not found yet
-		if (!bFitsPDF)
+		pbgmm_v red=_pbgmm_load(pRed+j);
+		pbgmm_v green=_pbgmm_load(pGreen+j);
+		pbgmm_v blue=_pbgmm_load(pBlue+j);
+		pbgmm_v nModes=_pbgmm_load(pModesUsed+j);
+		//no lane uses modes past nMax
+		int nMax=0;
+		for (int l=j;l<j+PBGMM_LANES;l++)
+			nMax=pModesUsed[l]>nMax?(int)pModesUsed[l]:nMax;
+
+		pbgmm_m bFitsPDF=_pbgmm_false();
+		pbgmm_m bBackground=_pbgmm_false();
+		pbgmm_v totalWeight=zero;
+		pbgmm_v nKept=zero;
+
+		//////
+		//go through all modes, in descending order of weight: each decays,
+		//the first that fits the color moves towards it, and the weakest
+		//are pruned
+		for (int iModes=0;iModes<nMax;iModes++)
 		{
-			//check if it belongs to some of the modes
+			float* pWeight=PBGMM_PLANE(pBlock,iModes,PBGMM_WEIGHT)+j;
+			float* pVar=PBGMM_PLANE(pBlock,iModes,PBGMM_SIGMA)+j;
+			float* pMuR=PBGMM_PLANE(pBlock,iModes,PBGMM_MUR)+j;
+			float* pMuG=PBGMM_PLANE(pBlock,iModes,PBGMM_MUG)+j;
+			float* pMuB=PBGMM_PLANE(pBlock,iModes,PBGMM_MUB)+j;
+			pbgmm_m bUsed=_pbgmm_lt(_pbgmm_set((float)iModes),nModes);
+			pbgmm_v weight=_pbgmm_load(pWeight);
+			pbgmm_v var=_pbgmm_load(pVar);
+			pbgmm_v muR=_pbgmm_load(pMuR);
+			pbgmm_v muG=_pbgmm_load(pMuG);
+			pbgmm_v muB=_pbgmm_load(pMuB);
+
 			//calculate distance
-			float var = m_aGaussians[pos].sigma;
-			float muR = m_aGaussians[pos].muR;
-			float muG = m_aGaussians[pos].muG;
-			float muB = m_aGaussians[pos].muB;
-		
-			float dR=muR - red;
-			float dG=muG - green;
-			float dB=muB - blue;
-
-			///////
-			//check if it fits the current mode (Factor * sigma)
-			
-			//square distance -slower and less accurate
-			//float maxDistance = cvSqrt(m_fTg*var);
-			//if ((fabs(dR) <= maxDistance) && (fabs(dG) <= maxDistance) && (fabs(dB) <= maxDistance))
-			//circle
-			float dist=(dR*dR+dG*dG+dB*dB);
+			pbgmm_v dR=_pbgmm_sub(muR,red);
+			pbgmm_v dG=_pbgmm_sub(muG,green);
+			pbgmm_v dB=_pbgmm_sub(muB,blue);
+			pbgmm_v dist=_pbgmm_add(_pbgmm_add(_pbgmm_mul(dR,dR),_pbgmm_mul(dG,dG)),_pbgmm_mul(dB,dB));
+
+			//fit not found yet
+			pbgmm_m bOpen=_pbgmm_andnot(bUsed,bFitsPDF);
 			//background? - m_fTb
-			if ((totalWeight<m_fTB)&&(dist<m_fTb*var))
-					bBackground=1;
+			pbgmm_m bInside=_pbgmm_and(_pbgmm_lt(totalWeight,TB),_pbgmm_lt(dist,_pbgmm_mul(Tb,var)));
+			bBackground=_pbgmm_or(bBackground,_pbgmm_and(bOpen,bInside));
 			//check fit
-			if (dist<m_fTg*var)
-			{
-				/////
-				//belongs to the mode
-				bFitsPDF=1;
-
-				//update distribution
-				float k = m_fAlphaT/weight;
-				weight=m_fOneMinAlpha*weight+m_fPrune;
-				weight+=m_fAlphaT;
-				m_aGaussians[pos].muR = muR - k*(dR);
-				m_aGaussians[pos].muG = muG - k*(dG);
-				m_aGaussians[pos].muB = muB - k*(dB);
-
-				//limit update speed for cov matrice
-				//not needed
-				//k=k>20*m_fAlphaT?20*m_fAlphaT:k;
-				//float sigmanew = var + k*((0.33*(dR*dR+dG*dG+dB*dB))-var);
-				//float sigmanew = var + k*((dR*dR+dG*dG+dB*dB)-var);
-				//float sigmanew = var + k*((0.33*dist)-var);
-				float sigmanew = var + k*(dist-var);
-				//limit the variance
-				//m_aGaussians[pos].sigma = sigmanew>70?70:sigmanew;
-				//m_aGaussians[pos].sigma = sigmanew>5*m_fSigma?5*m_fSigma:sigmanew;
-				m_aGaussians[pos].sigma =sigmanew< 4 ? 4 : sigmanew>5*m_fSigma?5*m_fSigma:sigmanew;
-				//m_aGaussians[pos].sigma =sigmanew< 4 ? 4 : sigmanew>3*m_fSigma?3*m_fSigma:sigmanew;
-				//m_aGaussians[pos].sigma = m_fSigma;
-				//sort
-				//all other weights are at the same place and 
-				//only the matched (iModes) is higher -> just find the new place for it
-				for (int iLocal = iModes;iLocal>0;iLocal--)
-				{
-					long posLocal=posPixel + iLocal;
-					if (weight < (m_aGaussians[posLocal-1].weight))
-					{
-						break;
-					}
-					else
-					{
-						//swap
-						CvPBGMMGaussian temp = m_aGaussians[posLocal];
-						m_aGaussians[posLocal] = m_aGaussians[posLocal-1];
-						m_aGaussians[posLocal-1] = temp;
-					}
-				}
+			pbgmm_m bFit=_pbgmm_and(bOpen,_pbgmm_lt(dist,_pbgmm_mul(Tg,var)));
+			bFitsPDF=_pbgmm_or(bFitsPDF,bFit);
 
-				//belongs to the mode
-				/////
-			}
-			else
+			//update distribution
+			if (_pbgmm_any(bFit))
 			{
-				weight=m_fOneMinAlpha*weight+m_fPrune;
-				//check prune
-				if (weight<-m_fPrune)
-				{
-					weight=0.0;
-					nModes--;
-				//	bPrune=1;
-					//break;//the components are sorted so we can skip the rest
-				}
+				pbgmm_v k=_pbgmm_div(alpha,weight);
+				pbgmm_v sigmanew=_pbgmm_add(var,_pbgmm_mul(k,_pbgmm_sub(dist,var)));
+				//limit the variance
+				sigmanew=_pbgmm_min(_pbgmm_max(sigmanew,minVar),maxVar);
+				_pbgmm_store(pMuR,_pbgmm_select(bFit,_pbgmm_sub(muR,_pbgmm_mul(k,dR)),muR));
+				_pbgmm_store(pMuG,_pbgmm_select(bFit,_pbgmm_sub(muG,_pbgmm_mul(k,dG)),muG));
+				_pbgmm_store(pMuB,_pbgmm_select(bFit,_pbgmm_sub(muB,_pbgmm_mul(k,dB)),muB));
+				_pbgmm_store(pVar,_pbgmm_select(bFit,sigmanew,var));
 			}
-			//check if it fits the current mode (2.5 sigma)
-			///////
-		}
-		//fit not found yet
-		/////
-		else
-		{
-				weight=m_fOneMinAlpha*weight+m_fPrune;
-				//check prune
-				if (weight<-m_fPrune)
-				{
-					weight=0.0;
-					nModes--;
-					//bPrune=1;
-					//break;//the components are sorted so we can skip the rest
-				}
-		}
-		totalWeight+=weight;
-		m_aGaussians[pos].weight=weight;
-	}
-	//go through all modes
-	//////
 
-	//renormalize weights
-	for (int iLocal = 0; iLocal < nModes; iLocal++)
-	{
-		m_aGaussians[posPixel+ iLocal].weight = m_aGaussians[posPixel+ iLocal].weight/totalWeight;
-	}
-	
-	//make new mode if needed and exit
-	if (!bFitsPDF)
-	{
-		if (nModes==m_nM)
-		{
-           //replace the weakest
-		}
-		else
-		{
-           //add a new one
-			//totalWeight+=m_fAlphaT;
-			//pos++;
-			nModes++;
+			weight=_pbgmm_add(_pbgmm_mul(oneMinAlpha,weight),prune);
+			//check prune
+			pbgmm_m bPrune=_pbgmm_and(_pbgmm_andnot(bUsed,bFit),_pbgmm_lt(weight,minusPrune));
+			weight=_pbgmm_select(bFit,_pbgmm_add(weight,alpha),weight);
+			weight=_pbgmm_select(_pbgmm_andnot(bUsed,bPrune),weight,zero);
+			totalWeight=_pbgmm_add(totalWeight,weight);
+			nKept=_pbgmm_add(nKept,_pbgmm_select(_pbgmm_andnot(bUsed,bPrune),one,zero));
+			_pbgmm_store(pWeight,weight);
 		}
-		pos=posPixel+nModes-1;
-
-      	if (nModes==1)
-			m_aGaussians[pos].weight=1;
-		else
-			m_aGaussians[pos].weight=m_fAlphaT;
-
-		//renormalize weights
-		int iLocal;
-		for (iLocal = 0; iLocal < nModes-1; iLocal++)
+		//go through all modes
+		//////
+
+		//renormalize weights, and make a new mode where nothing fitted,
+		//in place of the weakest if they are all used
+		pbgmm_m bNew=_pbgmm_andnot(_pbgmm_eq(zero,zero),bFitsPDF);
+		pbgmm_v scale=_pbgmm_select(_pbgmm_lt(zero,totalWeight),_pbgmm_div(one,totalWeight),zero);
+		scale=_pbgmm_select(bNew,_pbgmm_mul(scale,oneMinAlpha),scale);
+		pbgmm_v slot=_pbgmm_min(nKept,_pbgmm_set((float)(m_nM-1)));
+		pbgmm_v newWeight=_pbgmm_select(_pbgmm_lt(nKept,one),one,alpha);
+		int bAnyNew=_pbgmm_any(bNew);
+		if (bAnyNew && nMax<m_nM)
+			nMax++;
+		for (int iModes=0;iModes<nMax;iModes++)
 		{
-			m_aGaussians[posPixel+ iLocal].weight *=m_fOneMinAlpha;
+			float* pWeight=PBGMM_PLANE(pBlock,iModes,PBGMM_WEIGHT)+j;
+			pbgmm_v weight=_pbgmm_mul(_pbgmm_load(pWeight),scale);
+			if (!bAnyNew)
+			{
+				_pbgmm_store(pWeight,weight);
+				continue;
+			}
+			float* pVar=PBGMM_PLANE(pBlock,iModes,PBGMM_SIGMA)+j;
+			float* pMuR=PBGMM_PLANE(pBlock,iModes,PBGMM_MUR)+j;
+			float* pMuG=PBGMM_PLANE(pBlock,iModes,PBGMM_MUG)+j;
+			float* pMuB=PBGMM_PLANE(pBlock,iModes,PBGMM_MUB)+j;
+			pbgmm_m bHere=_pbgmm_and(bNew,_pbgmm_eq(_pbgmm_set((float)iModes),slot));
+			_pbgmm_store(pWeight,_pbgmm_select(bHere,newWeight,weight));
+			_pbgmm_store(pVar,_pbgmm_select(bHere,sigma,_pbgmm_load(pVar)));
+			_pbgmm_store(pMuR,_pbgmm_select(bHere,red,_pbgmm_load(pMuR)));
+			_pbgmm_store(pMuG,_pbgmm_select(bHere,green,_pbgmm_load(pMuG)));
+			_pbgmm_store(pMuB,_pbgmm_select(bHere,blue,_pbgmm_load(pMuB)));
 		}
-
-		m_aGaussians[pos].muR=red;
-		m_aGaussians[pos].muG=green;
-		m_aGaussians[pos].muB=blue;
-		m_aGaussians[pos].sigma=m_fSigma;
+		nModes=_pbgmm_select(bNew,_pbgmm_min(_pbgmm_add(nKept,one),_pbgmm_set((float)m_nM)),nKept);
+		_pbgmm_store(pModesUsed+j,nModes);
 
 		//sort
-		//find the new place for it
-		for (iLocal = nModes-1;iLocal>0;iLocal--)
+		//all other weights are still in order and only the mode that fitted,
+		//or the new one, is higher -> one pass from the bottom carries it to
+		//its new place
+		for (int iModes=nMax-1;iModes>0;iModes--)
 		{
-			long posLocal=posPixel + iLocal;
-			if (m_fAlphaT < (m_aGaussians[posLocal-1].weight))
+			pbgmm_m bSwap=_pbgmm_lt(_pbgmm_load(PBGMM_PLANE(pBlock,iModes-1,PBGMM_WEIGHT)+j),
+									_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_WEIGHT)+j));
+			if (!_pbgmm_any(bSwap))
+				continue;
+			for (int f=0;f<PBGMM_FIELDS;f++)
 			{
-						break;
-			}
-			else
-			{
-				//swap
-				CvPBGMMGaussian temp = m_aGaussians[posLocal];
-				m_aGaussians[posLocal] = m_aGaussians[posLocal-1];
-				m_aGaussians[posLocal-1] = temp;
+				float* pUpper=PBGMM_PLANE(pBlock,iModes-1,f)+j;
+				float* pLower=PBGMM_PLANE(pBlock,iModes,f)+j;
+				pbgmm_v upper=_pbgmm_load(pUpper);
+				pbgmm_v lower=_pbgmm_load(pLower);
+				_pbgmm_store(pUpper,_pbgmm_select(bSwap,lower,upper));
+				_pbgmm_store(pLower,_pbgmm_select(bSwap,upper,lower));
 			}
 		}
-	}
-
-	//set the number of modes
-	*pModesUsed=nModes;
 
-    return bBackground;
+		pbgmm_m bShadow=_pbgmm_false();
+		if (c.bShadowDetection)
+			bShadow=_cvRemoveShadowGMM(c,pBlock,j,nMax,nModes,red,green,blue,
+									   _pbgmm_andnot(_pbgmm_eq(zero,zero),bBackground));
+		_pbgmm_store(pResult+j,_pbgmm_select(bBackground,zero,
+						_pbgmm_select(bShadow,_pbgmm_set(125),_pbgmm_set(255))));
+	}
 }
 
-void _cvReplacePixelBackgroundGMM(long pos, 
-								unsigned char* pData, 
-								CvPBGMMGaussian* m_aGaussians)
+//check one block of pixels against the models, without updating them:
+//0 fits a mode (or is a shadow), 255 foreground
+static void _cvCheckPixel(const CvPBGMMConstants& c, const float* pBlock,
+						  const float* pRed, const float* pGreen, const float* pBlue,
+						  const float* pModesUsed, float* pResult)
 {
-	pData[0]=(unsigned char) m_aGaussians[pos].muR;
-	pData[1]=(unsigned char) m_aGaussians[pos].muG;
-	pData[2]=(unsigned char) m_aGaussians[pos].muB;
-}
+	pbgmm_v zero=_pbgmm_set(0);
+	pbgmm_v Tg=_pbgmm_set(c.fTg);
 
-
-void cvUpdatePixelBackgroundGMM(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output)
-{
-	int size=pGMM->nSize;
-	unsigned char* pDataCurrent=data;
-	unsigned char* pUsedModes=pGMM->rnUsedModes;
-	unsigned char* pDataOutput=output;
-	//some constants
-	int m_nM=pGMM->nM;
-	float m_fAlphaT=pGMM->fAlphaT;
-	float m_fTb=pGMM->fTb;//Tb - threshold on the Mahalan. dist.
-	float m_fTB=pGMM->fTB;//1-TF from the paper
-	float m_fTg=pGMM->fTg;//Tg - when to generate a new component
-	float m_fSigma=pGMM->fSigma;//initial sigma
-	float m_fCT=pGMM->fCT;//CT - complexity reduction prior 
-	float m_fPrune=-m_fAlphaT*m_fCT;
-	float m_fTau=pGMM->fTau;
-	CvPBGMMGaussian* m_aGaussians=pGMM->rGMM;
-	long posPixel;
-	int m_bShadowDetection=pGMM->bShadowDetection;
-
-	//go through the image
-	for (int i=0;i<size;i++)
+	for (int j=0;j<PBGMM_BLOCK;j+=PBGMM_LANES)
 	{
-		// retrieve the colors
-		float red = *pDataCurrent++;
-		float green = *pDataCurrent++;
-		float blue = *pDataCurrent++;
-		
-		//update model+ background subtract
-		;
-		posPixel=i*m_nM;
-		int result = _cvUpdatePixelBackgroundGMM(posPixel, red, green, blue,pUsedModes,m_aGaussians,
-			m_nM,m_fAlphaT, m_fTb, m_fTB, m_fTg, m_fSigma, m_fPrune);
-		int nMLocal=*pUsedModes;
-		pUsedModes++;
-		if (m_bShadowDetection)
-				if (!result)
-				{
-					result= _cvRemoveShadowGMM(posPixel, red, green, blue,nMLocal,m_aGaussians,
-								m_nM,
-								m_fTb,
-								m_fTB,	
-								m_fTg,
-								m_fTau);
-				}
-
-		
-		switch (result)
+		pbgmm_v red=_pbgmm_load(pRed+j);
+		pbgmm_v green=_pbgmm_load(pGreen+j);
+		pbgmm_v blue=_pbgmm_load(pBlue+j);
+		pbgmm_v nModes=_pbgmm_load(pModesUsed+j);
+		int nMax=0;
+		for (int l=j;l<j+PBGMM_LANES;l++)
+			nMax=pModesUsed[l]>nMax?(int)pModesUsed[l]:nMax;
+		pbgmm_m bFitsPDF=_pbgmm_false();
+
+		for (int iModes=0;iModes<nMax;iModes++)
 		{
-			case 0:
-				//foreground
-				(* pDataOutput)=255;
-				if (pGMM->bRemoveForeground) 
-				{
-					_cvReplacePixelBackgroundGMM(posPixel,pDataCurrent-3,m_aGaussians);
-				}
-				break;
-			case 1:
-				//background
-				(* pDataOutput)=0;
-				break;
-			case 2:
-				//shadow
-				(* pDataOutput)=125;
-				if (pGMM->bRemoveForeground) 
-				{
-					_cvReplacePixelBackgroundGMM(posPixel,pDataCurrent-3,m_aGaussians);
-				}
-
-				break;
+			pbgmm_v var=_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_SIGMA)+j);
+			pbgmm_v dR=_pbgmm_sub(_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUR)+j),red);
+			pbgmm_v dG=_pbgmm_sub(_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUG)+j),green);
+			pbgmm_v dB=_pbgmm_sub(_pbgmm_load(PBGMM_PLANE(pBlock,iModes,PBGMM_MUB)+j),blue);
+			pbgmm_v dist=_pbgmm_add(_pbgmm_add(_pbgmm_mul(dR,dR),_pbgmm_mul(dG,dG)),_pbgmm_mul(dB,dB));
+			pbgmm_m bUsed=_pbgmm_lt(_pbgmm_set((float)iModes),nModes);
+			bFitsPDF=_pbgmm_or(bFitsPDF,_pbgmm_and(bUsed,_pbgmm_lt(dist,_pbgmm_mul(Tg,var))));
 		}
-		//(* pDataOutput)=nM*30;
-		pDataOutput++;
+
+		pbgmm_m bOpen=_pbgmm_andnot(_pbgmm_eq(zero,zero),bFitsPDF);
+		if (_pbgmm_any(bOpen))
+			bFitsPDF=_pbgmm_or(bFitsPDF,_cvRemoveShadowGMM(c,pBlock,j,nMax,nModes,red,green,blue,bOpen));
+		_pbgmm_store(pResult+j,_pbgmm_select(bFitsPDF,zero,_pbgmm_set(255)));
 	}
 }
 
-int _cvCheckPixel(long posPixel, 
-					float red, float green, float blue, 
-					unsigned char* pModesUsed, 
-					CvPBGMMGaussian* m_aGaussians,
-					int m_nM,
-					float m_fAlphaT,
-					float m_fTb,
-					float m_fTB,	
-					float m_fTg,
-					float m_fSigma,
-					float m_fPrune)
+//update (or with bUpdate 0, only check) the models of pixels [first,last)
+//- one band, starting on a block. pixel i's colors are at pRed[i*nStride],
+//pGreen[i*nStride] and pBlue[i*nStride]
+template <int nStride>
+static void _cvUpdatePixelBackgroundGMMBand(CvPixelBackgroundGMM* pGMM, int bUpdate,
+								unsigned char* pRed, unsigned char* pGreen, unsigned char* pBlue,
+								unsigned char* output, int first, int last)
 {
-	long pos;
-	bool bFitsPDF=0;
-	bool bBackground=0;
-	
-	float m_fOneMinAlpha=1-m_fAlphaT;
-	
-	//bool bPrune=0;
-	int nModes=*pModesUsed;
-	float totalWeight=0.0f;
-	
-	//////
-	//go through all modes
-	for (int iModes=0;iModes<nModes;iModes++)
+	CvPBGMMConstants c;
+	_cvGetConstantsGMM(pGMM,&c);
+	long blockSize=(long)PBGMM_BLOCK*PBGMM_FIELDS*c.nM;
+	//one block of colors, modes used and results, as planes of floats
+	alignas(32) float red[PBGMM_BLOCK];
+	alignas(32) float green[PBGMM_BLOCK];
+	alignas(32) float blue[PBGMM_BLOCK];
+	alignas(32) float modes[PBGMM_BLOCK];
+	alignas(32) float result[PBGMM_BLOCK];
+
+	for (int i=first;i<last;i+=PBGMM_BLOCK)
 	{
-		pos=posPixel+iModes;
-		float weight = m_aGaussians[pos].weight;
-		
-		////
-		//fit not found yet
-		if (!bFitsPDF)
+		int n=last-i<PBGMM_BLOCK?last-i:PBGMM_BLOCK;
+		unsigned char* pUsedModes=pGMM->rnUsedModes+i;
+		float* pBlock=pGMM->rGMM+(i/PBGMM_BLOCK)*blockSize;
+		long posData=(long)i*nStride;
+
+		// retrieve the colors - past the end of the image the model is
+		// only padding
+		if (n==PBGMM_BLOCK)
 		{
-			//check if it belongs to some of the modes
-			//calculate distance
-			float var = m_aGaussians[pos].sigma;
-			float muR = m_aGaussians[pos].muR;
-			float muG = m_aGaussians[pos].muG;
-			float muB = m_aGaussians[pos].muB;
-			
-			float dR=muR - red;
-			float dG=muG - green;
-			float dB=muB - blue;
-			
-			float dist=(dR*dR+dG*dG+dB*dB);
-			//background? - m_fTb
-			if ((totalWeight<m_fTB)&&(dist<m_fTb*var))
-				bBackground=1;
-			//check fit
-			if (dist<m_fTg*var)
+			for (int l=0;l<PBGMM_BLOCK;l++)
 			{
-				/////
-				//belongs to the mode
-				bFitsPDF=1;
-				return 1;
-			}
-				
-			else
-			{
-				weight=m_fOneMinAlpha*weight+m_fPrune;
-				//check prune
-				if (weight<-m_fPrune)
-				{
-					weight=0.0;
-					nModes--;
-				}
+				red[l]=pRed[posData+l*nStride];
+				green[l]=pGreen[posData+l*nStride];
+				blue[l]=pBlue[posData+l*nStride];
 			}
 		}
-		//fit not found yet
-		/////
 		else
 		{
-			weight=m_fOneMinAlpha*weight+m_fPrune;
-			//check prune
-			if (weight<-m_fPrune)
+			for (int l=0;l<PBGMM_BLOCK;l++)
 			{
-				weight=0.0;
-				nModes--;
-				//bPrune=1;
-				//break;//the components are sorted so we can skip the rest
+				red[l]=l<n?pRed[posData+l*nStride]:0;
+				green[l]=l<n?pGreen[posData+l*nStride]:0;
+				blue[l]=l<n?pBlue[posData+l*nStride]:0;
 			}
 		}
-		totalWeight+=weight;
-		m_aGaussians[pos].weight=weight;
+		for (int l=0;l<PBGMM_BLOCK;l++)
+			modes[l]=pUsedModes[l];
+
+		//the kernels skip the planes of modes no pixel uses, which breaks
+		//up the stream the hardware would otherwise prefetch
+		PBGMM_PREFETCH(pBlock+PBGMM_PREFETCH_BLOCKS*blockSize,blockSize);
+
+		if (bUpdate)
+		{
+			//update model+ background subtract
+			_cvUpdatePixelBackgroundGMM(c,pBlock,red,green,blue,modes,result);
+			for (int l=0;l<PBGMM_BLOCK;l++)
+				pUsedModes[l]=(unsigned char)modes[l];
+		}
+		else
+			_cvCheckPixel(c,pBlock,red,green,blue,modes,result);
+
+		for (int l=0;l<n;l++)
+			output[i+l]=(unsigned char)result[l];
+		if (bUpdate && pGMM->bRemoveForeground)
+		{
+			//foreground or shadow
+			for (int l=0;l<n;l++)
+				if (result[l]!=0)
+				{
+					pRed[posData+l*nStride]=(unsigned char)PBGMM_PLANE(pBlock,0,PBGMM_MUR)[l];
+					pGreen[posData+l*nStride]=(unsigned char)PBGMM_PLANE(pBlock,0,PBGMM_MUG)[l];
+					pBlue[posData+l*nStride]=(unsigned char)PBGMM_PLANE(pBlock,0,PBGMM_MUB)[l];
+				}
+		}
 	}
-	
-    return 0;
+}
+
+void cvUpdatePixelBackgroundGMM(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output)
+{
+	_cvForEachBand(pGMM,[=](int first,int last)
+	{
+		_cvUpdatePixelBackgroundGMMBand<3>(pGMM,1,data,data+1,data+2,output,first,last);
+	});
 }
 
 void cvPixelBackgroundGMMSubtraction(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output)
 {
-	int size=pGMM->nSize;
-	unsigned char* pDataCurrent=data;
-	unsigned char* pUsedModes=pGMM->rnUsedModes;
-	unsigned char* pDataOutput=output;
-	//some constants
-	int m_nM=pGMM->nM;
-	float m_fAlphaT=pGMM->fAlphaT;
-	float m_fTb=pGMM->fTb;//Tb - threshold on the Mahalan. dist.
-	float m_fTB=pGMM->fTB;//1-TF from the paper
-	float m_fTg=pGMM->fTg;//Tg - when to generate a new component
-	float m_fSigma=pGMM->fSigma;//initial sigma
-	float m_fCT=pGMM->fCT;//CT - complexity reduction prior 
-	float m_fPrune=-m_fAlphaT*m_fCT;
-	float m_fTau=pGMM->fTau;
-	CvPBGMMGaussian* m_aGaussians=pGMM->rGMM;
-	long posPixel;
-	int m_bShadowDetection=pGMM->bShadowDetection;
-	
-	//go through the image
-	for (int i=0;i<size;i++)
+	_cvForEachBand(pGMM,[=](int first,int last)
 	{
-		// retrieve the colors
-		float red = *pDataCurrent++;
-		float green = *pDataCurrent++;
-		float blue = *pDataCurrent++;
-		
-		//update model+ background subtract
-		posPixel=i*m_nM;
-		int result = _cvCheckPixel(posPixel, red, green, blue,pUsedModes,m_aGaussians,
-								   m_nM,m_fAlphaT, m_fTb, m_fTB, m_fTg, m_fSigma, m_fPrune);
-		if(result == 0)
-		{
-			int nMLocal=*pUsedModes;
-			result = _cvRemoveShadowGMM(posPixel, red, green, blue,nMLocal,m_aGaussians,
-								   m_nM,
-								   m_fTb,
-								   m_fTB,	
-								   m_fTg,
-								   m_fTau);
-		}
-		(* pDataOutput)=255 - 255 * result;
-		pDataOutput++;
-	}
+		_cvUpdatePixelBackgroundGMMBand<3>(pGMM,0,data,data+1,data+2,output,first,last);
+	});
 }
 
 
 void cvUpdatePixelBackgroundGMMTiled(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output)
 {
 	int size=pGMM->nSize;
-	unsigned char* pDataCurrentR=data;//separate R G and B images
-	unsigned char* pDataCurrentG=data+size;
-	unsigned char* pDataCurrentB=data+2*size;
-
-	unsigned char* pUsedModes=pGMM->rnUsedModes;
-	unsigned char* pDataOutput=output;
-	//some constants
-	int m_nM=pGMM->nM;
-	float m_fAlphaT=pGMM->fAlphaT;
-	float m_fTb=pGMM->fTb;//Tb - threshold on the Mahalan. dist.
-	float m_fTB=pGMM->fTB;//1-TF from the paper
-	float m_fTg=pGMM->fTg;//Tg - when to generate a new component
-	float m_fSigma=pGMM->fSigma;//initial sigma
-	float m_fCT=pGMM->fCT;//CT - complexity reduction prior 
-	float m_fPrune=-m_fAlphaT*m_fCT;
-	float m_fTau=pGMM->fTau;
-	CvPBGMMGaussian* m_aGaussians=pGMM->rGMM;
-	long posPixel;
-	int m_bShadowDetection=pGMM->bShadowDetection;
-
-	//go through the image
-	for (int i=0;i<size;i++)
+	//separate R G and B images
+	_cvForEachBand(pGMM,[=](int first,int last)
 	{
-		// retrieve the colors
-		float red = *pDataCurrentR++;
-		float green = *pDataCurrentG++;
-		float blue = *pDataCurrentB++;
-		
-		//update model+ background subtract
-		;
-		posPixel=i*m_nM;
-		int result = _cvUpdatePixelBackgroundGMM(posPixel, red, green, blue,pUsedModes,m_aGaussians,
-			m_nM,m_fAlphaT, m_fTb, m_fTB, m_fTg, m_fSigma, m_fPrune);
-		int nMLocal=*pUsedModes;
-		pUsedModes++;
-		if (m_bShadowDetection)
-				if (!result)
-				{
-					result= _cvRemoveShadowGMM(posPixel, red, green, blue,nMLocal,m_aGaussians,
-								m_nM,
-								m_fTb,
-								m_fTB,	
-								m_fTg,
-								m_fTau);
-				}
-
-		
-		switch (result)
-		{
-			case 0:
-				//foreground
-				(* pDataOutput)=255;
-				if (pGMM->bRemoveForeground) 
-				{
-//					_cvReplacePixelBackgroundGMM(posPixel,pDataCurrent-3,m_aGaussians);
-				}
-				break;
-			case 1:
-				//background
-				(* pDataOutput)=0;
-				break;
-			case 2:
-				//shadow
-				(* pDataOutput)=125;
-				if (pGMM->bRemoveForeground) 
-				{
-//					_cvReplacePixelBackgroundGMM(posPixel,pDataCurrent-3,m_aGaussians);
-				}
-
-				break;
-		}
-		//(* pDataOutput)=nM*30;
-		pDataOutput++;
-	}
-}
\ No newline at end of file
+		_cvUpdatePixelBackgroundGMMBand<1>(pGMM,1,data,data+size,data+2*size,output,first,last);
+	});
+}
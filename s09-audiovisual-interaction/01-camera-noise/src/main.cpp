@@ -1,6 +1,8 @@
 #include "ofMain.h"
 #include "ofAppGlutWindow.h"
-#include "maximilian.h"
+#include "pkmDSPGraph.h"
+#include "pkmAudioFileReader.h"
+#include "pkmTripleBuffer.h"
 
 class ofApp : public ofBaseApp{
     
@@ -19,16 +21,32 @@ public:
             // setup the camera
         camera.initGrabber(width, height);
         
-        prev_audio = 0;
+            // the speeds read from each camera frame, for the audio thread
+        control.setup(vector<float>(width, 0.0));
         
-        line.setAttack(200);
-        line.setRelease(200);
+            // load the sample
+        pkmAudioFileReader reader;
+        if (reader.open(ofToDataPath("amen.wav"))) {
+            vector<float> samples(reader.mNumSamples);
+            reader.read(&samples[0], 0, reader.mNumSamples);
+            sample.setSample(&samples[0], samples.size());
+            reader.close();
+        }
         
-        sample.load(ofToDataPath("amen.wav"));
-
             // setup the sound
         int sampleRate = 44100;
         int bufferSize = 256;
+        
+            // the speed we read from the camera is smoothed, and then
+            // sets how fast the sample plays
+        line.setAttack(200);
+        line.setRelease(200);
+        graph.setup(sampleRate, bufferSize);
+        graph.connect(&speeds, &line);
+        graph.connect(&line, &sample);
+        graph.setOutput(&sample);
+        graph.compile();
+        
         ofSoundStreamSetup(1,				// output channels
                            0,				// input channels
                            sampleRate,		// how many samples (readings) per second
@@ -38,6 +56,24 @@ public:
     
     void update(){
         camera.update();
+        
+            // work out the speeds here, once a frame, rather than once a
+            // sample in audioOut.  the audio thread then never touches the
+            // camera's pixels while they are being replaced, it just
+            // picks up the latest row of speeds.
+        if (camera.isFrameNew()) {
+            ofPixels &pixels = camera.getPixels();
+            vector<float> &speed = control.getWriteBuffer();
+            int n = min(width, (int)pixels.getWidth());
+            for (int i = 0; i < n; i++)
+            {
+                float brightness = pixels.getColor(i, height / 2).getBrightness();
+                speed[i] = ofMap(brightness,
+                                 0, 255,
+                                 0.0, 2.0);
+            }
+            control.publish();
+        }
     }
     
     void draw(){
@@ -48,28 +84,21 @@ public:
     }
     
     void audioOut(float *buf, int size, int ch) {
-        auto pixels = camera.getPixels().getLine(height / 2).asPixels();
-        float ratio = (width - 1) / (float)(size - 1);
-        for (int i = 0; i < size; i++)
-        {
-            float brightness = pixels.getColor(i).getBrightness();
-            float speed = ofMap(brightness,
-                                0, 255,
-                                0.0, 2.0);
-            speed = line.play(speed);
-            buf[i] = sample.play(prev_audio * 0.99 + speed * 0.01);
-            prev_audio = speed;
-        }
+        const vector<float> &row = control.read();
+        int n = min(size, (int)row.size());
+        memcpy(speeds.getBuffer(), &row[0], sizeof(float) * n);
+        graph.process(buf, size);
     }
     
 private:
     
     int width, height;
     ofVideoGrabber camera;
-    maxiOsc osc;
-    maxiSample sample;
-    maxiEnvelopeFollower line;
-    float prev_audio;
+    pkmTripleBuffer<vector<float> > control;
+    pkmDSPGraph graph;
+    pkmDSPGraph::Input speeds;
+    pkmDSPGraph::EnvelopeFollower line;
+    pkmDSPGraph::SamplePlayer sample;
 };
 
 
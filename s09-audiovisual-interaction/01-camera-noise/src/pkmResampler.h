@@ -0,0 +1,146 @@
+/*
+ *  pkmResampler.h
+ *
+ *  Polyphase windowed-sinc sample rate converter.
+ *
+ *  The ratio out_rate / in_rate is reduced to L / M.  Output frame n sits at
+ *  input time n * M / L; its integer part picks where in the input to read,
+ *  its fractional part picks one of the filter's phases, and the output is
+ *  the dot product of that phase's taps with a contiguous run of input.  All
+ *  phases are tabulated once in setup(), so converting costs one dot product
+ *  of getTaps() floats per output sample.
+ *
+ *  When downsampling the cutoff moves down to the output Nyquist and the
+ *  filter grows to keep the same transition width.  If L is too large to
+ *  tabulate (rates with no useful common divisor) the fractional position
+ *  is rounded to one of kMaxPhases phases.
+ *
+ *  The converter itself keeps no history: process() is given the input
+ *  frames it needs (see inputRange()), so a caller can stream through a file
+ *  block by block, or jump anywhere, and get identical output either way.
+ *
+ *  Usage:
+ *
+ *  pkmResampler resampler;
+ *  resampler.setup(48000, 44100);
+ *  long first, length;
+ *  resampler.inputRange(0, 4096, first, length);
+ *  // fill in[0 .. length) with input frames [first, first + length)
+ *  resampler.process(in, first, 0, 4096, out);
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+class pkmResampler {
+ public:
+  static const int kMaxPhases = 4096;
+
+  pkmResampler() : mL(1), mM(1), mPhases(1), mTaps(0) {}
+
+  // taps is the filter length at unity or higher output rate
+  void setup(long in_rate, long out_rate, int taps = 32) {
+    long a = in_rate, b = out_rate;
+    while (b) {
+      long t = a % b;
+      a = b;
+      b = t;
+    }
+    mL = out_rate / a;
+    mM = in_rate / a;
+    mPhases = mL <= kMaxPhases ? (int)mL : kMaxPhases;
+
+    // cutoff relative to the input Nyquist, a little under the lower of the
+    // two to leave room for the transition band
+    double cutoff = (mL < mM ? (double)mL / (double)mM : 1.0) * 0.95;
+    mTaps = (int)ceil(taps / (cutoff / 0.95));
+    mTaps = (mTaps + 7) & ~7;
+
+    const double beta = 8.6;
+    const double half = mTaps / 2;
+    mTable.resize((size_t)mPhases * mTaps);
+    for (int p = 0; p < mPhases; p++) {
+      float *h = &mTable[(size_t)p * mTaps];
+      double frac = (double)p / (double)mPhases;
+      double sum = 0;
+      for (int k = 0; k < mTaps; k++) {
+        // distance in input frames from this tap to the output instant
+        double t = (half - 1 - k) + frac;
+        double x = t / half;
+        double w = fabs(x) < 1.0 ? besselI0(beta * sqrt(1.0 - x * x)) / besselI0(beta) : 0.0;
+        double s = t == 0.0 ? 1.0 : sin(M_PI * cutoff * t) / (M_PI * cutoff * t);
+        h[k] = (float)(cutoff * s * w);
+        sum += h[k];
+      }
+      // unity gain at DC for every phase
+      for (int k = 0; k < mTaps; k++) h[k] = (float)(h[k] / sum);
+    }
+  }
+
+  bool isIdentity() const { return mL == mM; }
+
+  int getTaps() const { return mTaps; }
+
+  // number of output frames for in_frames of input
+  long outputLength(long in_frames) const {
+    return (long)(((int64_t)in_frames * mL + mM - 1) / mM);
+  }
+
+  // input frames [first, first + length) needed for outputs [n, n + count);
+  // first may be negative and the range may run past the end of the input,
+  // in which case those frames should be zeros
+  void inputRange(long n, long count, long &first, long &length) const {
+    long begin = (long)(((int64_t)n * mM) / mL);
+    long end = (long)(((int64_t)(n + count - 1) * mM) / mL);
+    first = begin - mTaps / 2 + 1;
+    length = end - begin + mTaps;
+  }
+
+  // outputs [n, n + count) written to out[0], out[stride], ... from one
+  // channel of input, where in[0] is input frame in_first
+  void process(const float *in, long in_first, long n, long count, float *out,
+               int stride = 1) const {
+    const int half = mTaps / 2;
+    for (long i = 0; i < count; i++) {
+      int64_t pos = (int64_t)(n + i) * mM;
+      long ip = (long)(pos / mL);
+      int64_t rem = pos % mL;
+      int phase = mPhases == mL ? (int)rem : (int)((rem * mPhases) / mL);
+      const float *x = in + (ip - half + 1 - in_first);
+      const float *h = &mTable[(size_t)phase * mTaps];
+      out[i * stride] = dot(x, h, mTaps);
+    }
+  }
+
+ private:
+  // taps are a multiple of 8: eight independent partial sums let the
+  // compiler keep the whole loop in vector registers
+  static inline float dot(const float *x, const float *h, int n) {
+    float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int k = 0; k < n; k += 8) {
+      for (int j = 0; j < 8; j++) acc[j] += x[k + j] * h[k + j];
+    }
+    return ((acc[0] + acc[4]) + (acc[1] + acc[5])) +
+           ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+  }
+
+  static double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; k++) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+      if (term < sum * 1e-12) break;
+    }
+    return sum;
+  }
+
+  long mL, mM;
+  int mPhases, mTaps;
+  vector<float> mTable;
+};
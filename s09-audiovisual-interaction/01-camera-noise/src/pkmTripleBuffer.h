@@ -0,0 +1,100 @@
+/*
+ *  pkmTripleBuffer.h
+ *
+ *  Hands the latest of a stream of values (e.g. features of each camera
+ *  frame) from one thread to another, without locks and without either
+ *  side ever waiting for or touching what the other is using.
+ *
+ *  There are three slots.  The writer fills its own slot and publish()es
+ *  it, which swaps it with the middle slot in one atomic exchange.  The
+ *  reader's read() takes the middle slot in the same way if something new
+ *  was published since, and otherwise keeps the slot it has.  So the
+ *  reader always sees a whole frame, the newest one, and a writer that is
+ *  faster than the reader just replaces frames that were never read.
+ *
+ *  Values are never copied or allocated after setup(): fill the slot from
+ *  getWriteBuffer() in place.  One writer thread and one reader thread.
+ *
+ *  Usage:
+ *
+ *  pkmTripleBuffer<vector<float> > row;
+ *  row.setup(vector<float>(width));
+ *
+ *  // video thread
+ *  vector<float> &next = row.getWriteBuffer();
+ *  ... fill next ...
+ *  row.publish();
+ *
+ *  // audio thread
+ *  const vector<float> &latest = row.read();
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+
+#ifndef PKM_CACHE_LINE
+#define PKM_CACHE_LINE 64
+#endif
+
+template <typename T>
+class pkmTripleBuffer {
+ public:
+  pkmTripleBuffer() : mBack(0), mMiddle(1), mFront(2), mPublished(0) {}
+
+  // every slot starts as a copy of initial, so e.g. vectors are allocated
+  // here once and reused.  not thread safe.
+  void setup(const T &initial) {
+    for (int i = 0; i < 3; i++) mSlots[i] = initial;
+    mBack = 0;
+    mMiddle = 1;
+    mFront = 2;
+    mPublished = 0;
+  }
+
+  // writer: the slot to fill next.  it is the writer's until publish().
+  T &getWriteBuffer() { return mSlots[mBack]; }
+
+  // writer: make the write buffer the latest value
+  void publish() {
+    int previous = mMiddle.exchange(mBack | kFresh, std::memory_order_acq_rel);
+    mBack = previous & kIndex;
+    mPublished.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // reader: the latest value published, which stays valid and unchanged
+  // until the next read()
+  const T &read() {
+    if (mMiddle.load(std::memory_order_relaxed) & kFresh) {
+      int previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+      mFront = previous & kIndex;
+    }
+    return mSlots[mFront];
+  }
+
+  // reader: whether read() would return something new
+  bool hasNew() const {
+    return (mMiddle.load(std::memory_order_relaxed) & kFresh) != 0;
+  }
+
+  // how many values have been published
+  long getNumPublished() const {
+    return mPublished.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static const int kIndex = 3;
+  static const int kFresh = 4;  // set in mMiddle when it has not been read
+
+  T mSlots[3];
+  // the writer's and the reader's slot indices, and the one between them,
+  // each on its own cache line
+  int mBack;
+  char mPadding0[PKM_CACHE_LINE];
+  std::atomic<int> mMiddle;
+  char mPadding1[PKM_CACHE_LINE - sizeof(std::atomic<int>)];
+  int mFront;
+  char mPadding2[PKM_CACHE_LINE - sizeof(int)];
+  std::atomic<long> mPublished;
+};
@@ -1,7 +1,8 @@
 #include "ofMain.h"
 #include "ofxOpenCv.h"
-#include "maximilian.h"
-#include "maxiGrains.h"
+#include "pkmVoiceMixer.h"
+#include "pkmGrainEngine.h"
+#include "pkmAudioFileReader.h"
 #include "pkmBlobTracker.h"
 
 const int W = 320;
@@ -21,7 +22,13 @@ public:
 
         px[this_sound] = x;
         py[this_sound] = y;
-        visible[this_sound] = true;
+        velocities[this_sound] = 0.0;
+        
+            // the blob callbacks run on the main thread, so they only
+            // leave the audio thread new values to pick up
+        mixer.setControl(this_sound, 1.0);
+        mixer.setPan(this_sound, x / (float)W);
+        mixer.setActive(this_sound, true);
         
         curr_sound = (curr_sound + 1) % n_sounds;
     }
@@ -39,13 +46,18 @@ public:
         py[this_sound] = y;
         
         velocities[this_sound] = speed;
+        
+            // the faster the blob moves, the slower its sound plays
+        float slow_down = ofMap(ofClamp(speed, 0.0, 10.0), 0.0, 10.0, 0.0, 2.0);
+        mixer.setControl(this_sound, 1.0 - slow_down);
+        mixer.setPan(this_sound, x / (float)W);
     }
     
     void blobOff( int x, int y, int id, int order )
     {
         int this_sound = snd_mapping[id];
         velocities[this_sound] = 0.0;
-        visible[this_sound] = false;
+        mixer.setActive(this_sound, false);
     }
     
         // redeclaration of functions (declared in base class)
@@ -76,25 +88,36 @@ public:
         curr_sound = 0;
         n_sounds = samples.size();
         
-        visible.resize(n_sounds);
-        delays.resize(n_sounds);
         sounds.resize(n_sounds);
-        lines.resize(n_sounds);
         velocities.resize(n_sounds);
         px.resize(n_sounds);
         py.resize(n_sounds);
-        ts.resize(n_sounds);
+        grains.resize(n_sounds);
+        
+            // every sound is time stretched by its own grains, and the
+            // mixer adds together the ones whose blob is visible, panned
+            // to where the blob is
+        mixer.setup(n_sounds, 512);
         
         for (int i = 0; i < n_sounds; i++) {
-            sounds[i].load(ofToDataPath(samples[i]));
-            ts[i] = new maxiTimePitchStretch<hannWinFunctor, maxiSample>(&sounds[i]);
+            pkmAudioFileReader reader;
+            if (reader.open(ofToDataPath(samples[i]))) {
+                sounds[i].resize(reader.mNumSamples);
+                reader.read(&sounds[i][0], 0, reader.mNumSamples);
+                reader.close();
+            }
+            grains[i].setup(44100, 8, 512);
+            grains[i].setGrainDuration(0.2 * 44100);
+            grains[i].setGrainInterval(0.2 * 44100 / 3);
+            grains[i].setSource(sounds[i].size() ? &sounds[i][0] : NULL,
+                                sounds[i].size());
+            
             velocities[i] = 0.0;
             px[i] = W / 2;
             py[i] = H / 2;
         }
         
-        maxiSettings::setup(44100, 1, 512);
-        ofSoundStreamSetup(1, 0, 44100, 512, 3);
+        ofSoundStreamSetup(2, 0, 44100, 512, 3);
     }
     
     void update(){
@@ -128,14 +151,12 @@ public:
     }
     
     void audioOut(float *buf, int buffer_size, int ch) {
-        for (int sample_i = 0; sample_i < buffer_size; sample_i++) {
-            buf[sample_i] = 0.0;
-            for (int sound_i = 0; sound_i < n_sounds; sound_i++) {
-                float speed = lines[sound_i].play(ofMap(ofClamp(velocities[sound_i], 0.0, 10.0), 0.0, 10.0, 0.0, 2.0));
-                if(visible[sound_i])
-                    buf[sample_i] += (*ts[sound_i]).play(1.0, 1.0 - speed, 0.2, 3);
-            }
-        }
+            // one voice at a time, and only the ones that are sounding
+        mixer.process(buf, buffer_size, ch,
+                      [&](int voice, float *buffer, int n, float speed) {
+                          grains[voice].setSpeed(speed);
+                          grains[voice].process(buffer, n);
+                      });
     }
     
 private:
@@ -145,14 +166,12 @@ private:
     ofVideoGrabber                  camera;
     pkmBlobTracker                  tracker;
     
-    vector<maxiDelayline>           delays;
     vector<float>                   velocities;
-    vector<bool>                    visible;
     vector<int>                     px, py;
-    vector<maxiEnvelopeFollower>    lines;
 
-    vector<maxiSample>              sounds;
-    vector<maxiTimePitchStretch<hannWinFunctor, maxiSample> *> ts;
+    vector<vector<float> >          sounds;
+    vector<pkmGrainEngine>          grains;
+    pkmVoiceMixer                   mixer;
     int                             n_sounds;
     int                             curr_sound;
     
@@ -30,8 +30,13 @@ class ofxCvTrackedBlob : public ofxCvBlob {
     //
     bool markedForDeletion;
     int framesLeft;
-    vector<float> error;
-    vector<int> closest;  // ids of the closest points, sorted
+    
+    // constant velocity kalman filter of the centroid, from which
+    // predictedPos is worked out.  the covariance is the same for x
+    // and y: position, position-velocity and velocity.
+    ofPoint filteredPos;
+    ofPoint filteredVel;
+    float covariance[3];
     
     
 
@@ -42,6 +47,7 @@ class ofxCvTrackedBlob : public ofxCvBlob {
         deltaArea = 0.0f;
         markedForDeletion = false;
         framesLeft = 0;
+        covariance[0] = covariance[1] = covariance[2] = 0.0f;
 		
 		orientation = 0;
 		velocity = 0;
@@ -62,21 +68,7 @@ class ofxCvTrackedBlob : public ofxCvBlob {
         deltaArea = 0.0f;
         markedForDeletion = false;
         framesLeft = 0;
-    }
-    
-    
-
-
-    int getLowestError() {
-        int best=-1;
-        float best_v=99999.0f;
-        for( unsigned int i=0; i<error.size(); i++ ) {
-            if( error[i] < best_v ) {
-                best = i;
-                best_v = error[i];
-            }
-        }
-        return best;
+        covariance[0] = covariance[1] = covariance[2] = 0.0f;
     }
 
 
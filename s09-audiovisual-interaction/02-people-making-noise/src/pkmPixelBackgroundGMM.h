@@ -44,6 +44,17 @@
 // //at the end when the progam terminates do not forget to release the reseved memory
 // 	cvReleasePixelBackgroundGMM(&pGMM);
 //
+//The image is processed in bands on a pool of threads, one per core by
+//default (set nThreads to change it, 1 to stay on the calling thread).
+//Every pixel's model is independent of the others, so the bands need no
+//locking; each band's models, modes and output are contiguous in memory.
+//
+//The models are stored a block of PBGMM_BLOCK pixels at a time, as planes:
+//the weight of mode 0 of each pixel of the block, then its variance, its
+//mean R, G and B, then the same for mode 1 and so on. So the pixels of a
+//block are updated together, 8 (AVX) or 4 (SSE, NEON) at a time, with
+//masks in place of branches. The modes of a pixel are kept in descending
+//order of weight, and the ones it does not use have weight 0.
 //
 //Author: Z.Zivkovic, www.zoranz.net
 //University of Amsterdam, The Netherlands
@@ -53,14 +64,21 @@
 #include <stdlib.h>
 #include <memory.h>
 
-typedef struct CvPBGMMGaussian
+struct CvPBGMMThreadPool;
+
+//pixels per block of the model
+#define PBGMM_BLOCK 16
+
+//the planes of each mode in a block
+enum
 {
-	float sigma;
-	float muR;
-	float muG;
-	float muB;
-	float weight;
-} CvPBGMMGaussian;
+	PBGMM_WEIGHT,
+	PBGMM_SIGMA,//the variance
+	PBGMM_MUR,
+	PBGMM_MUG,
+	PBGMM_MUB,
+	PBGMM_FIELDS
+};
 
 typedef struct CvPixelBackgroundGMM
 {
@@ -117,10 +135,14 @@ typedef struct CvPixelBackgroundGMM
 	int nWidth;//image size
 	int nHeight;
 	int nSize;
-	// dynamic array for the mixture of Gaussians
-	CvPBGMMGaussian* rGMM;
+	// dynamic array for the mixture of Gaussians, in blocks
+	float* rGMM;
 	unsigned char* rnUsedModes;//number of Gaussian components per pixel
 	bool bRemoveForeground;
+
+	//threads
+	int nThreads;//threads to update with - defaults to the number of cores
+	CvPBGMMThreadPool* pThreads;//started on the first update
 } CvPixelBackgroundGMM;
 
 
@@ -134,19 +156,9 @@ void cvUpdatePixelBackgroundGMM(CvPixelBackgroundGMM* pGMM,unsigned char* data,u
 ///////////
 void cvUpdatePixelBackgroundGMMTiled(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output);
 //Use in case R G B images are separate - e.g. calling from Matlab 
+//  data - the R plane, followed by the G plane and the B plane
 
 void cvPixelBackgroundGMMSubtraction(CvPixelBackgroundGMM* pGMM,unsigned char* data,unsigned char* output);
-int _cvCheckPixel(long posPixel, 
-				  float red, float green, float blue, 
-				  unsigned char* pModesUsed, 
-				  CvPBGMMGaussian* m_aGaussians,
-				  int m_nM,
-				  float m_fAlphaT,
-				  float m_fTb,
-				  float m_fTB,	
-				  float m_fTg,
-				  float m_fSigma,
-				  float m_fPrune);
 
 
 #if 1
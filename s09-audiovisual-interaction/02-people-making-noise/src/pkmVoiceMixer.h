@@ -0,0 +1,181 @@
+/*
+ *  pkmVoiceMixer.h
+ *
+ *  Mixes many independently switched voices (e.g. one per tracked blob)
+ *  into an interleaved multichannel buffer, a voice at a time.
+ *
+ *  Each voice has a target on/off state, a control value (e.g. playback
+ *  speed) and a pan position, set from any thread with setActive(),
+ *  setControl() and setPan().  They are plain atomics, so the latest value
+ *  simply wins and nothing can overflow or block.
+ *
+ *  process() runs on the audio thread, voice-major: for every voice that is
+ *  on or still fading out it asks the app to render one block of that
+ *  voice (with its smoothed control value), then fades and pans it into
+ *  the output with vDSP.  Voices that are off and silent are skipped
+ *  entirely, so the cost is proportional to the number of voices that are
+ *  sounding, not to how many there could be.  Switching a voice on or off
+ *  fades it over fade_samples, so nothing clicks.
+ *
+ *  Usage:
+ *
+ *  pkmVoiceMixer mixer;
+ *  mixer.setup(64, 512);
+ *
+ *  // any thread
+ *  mixer.setActive(3, true);
+ *  mixer.setControl(3, speed);
+ *
+ *  // audio thread
+ *  mixer.process(output, buffer_size, n_channels,
+ *                [&](int voice, float *buffer, int n, float control) {
+ *                  grains[voice].setSpeed(control);
+ *                  grains[voice].process(buffer, n);
+ *                });
+ *
+ */
+
+#pragma once
+
+#include <Accelerate/Accelerate.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+class pkmVoiceMixer {
+ public:
+  pkmVoiceMixer()
+      : mNumVoices(0), mMaxBlock(0), mFadeSamples(512), mSmoothing(4410),
+        mNumSounding(0) {}
+
+  // fade_samples: how long switching a voice on or off takes.
+  // smoothing_samples: the time constant controls and pans glide with.
+  void setup(int max_voices, int max_block, int fade_samples = 512,
+             int smoothing_samples = 4410) {
+    mMaxBlock = max_block;
+    mFadeSamples = max(1, fade_samples);
+    mSmoothing = max(1, smoothing_samples);
+    // atomics cannot be moved, so the controls are a fixed array
+    mControls.reset(new Control[max_voices]);
+    mVoices.assign(max_voices, Voice());
+    mNumVoices = max_voices;
+    mBuffer.assign(max_block, 0.0f);
+    mGains.assign(max_block, 0.0f);
+    mNumSounding = 0;
+  }
+
+  int getNumVoices() const { return mNumVoices; }
+
+  // voices rendered in the last process()
+  int getNumSounding() const { return mNumSounding; }
+
+  // any thread: fade the voice in or out
+  void setActive(int voice, bool active) {
+    mControls[voice].active.store(active, std::memory_order_relaxed);
+  }
+
+  // any thread: the value handed to the voice's render function, which
+  // glides to it
+  void setControl(int voice, float value) {
+    mControls[voice].control.store(value, std::memory_order_relaxed);
+  }
+
+  // any thread: 0 is the first channel and 1 the last; the voice is
+  // panned with equal power between the two nearest channels
+  void setPan(int voice, float pan) {
+    mControls[voice].pan.store(max(0.0f, min(pan, 1.0f)),
+                               std::memory_order_relaxed);
+  }
+
+  // audio thread: clear output (n frames of n_channels, interleaved, n at
+  // most max_block) and mix in every sounding voice.
+  // render(int voice, float *buffer, int n, float control) writes n
+  // samples of the voice to buffer.
+  template <typename Render>
+  void process(float *output, int n, int n_channels, Render render) {
+    n = min(n, mMaxBlock);
+    vDSP_vclr(output, 1, (vDSP_Length)n * n_channels);
+    float glide = 1.0f - expf(-(float)n / mSmoothing);
+    float step = 1.0f / mFadeSamples;
+    mNumSounding = 0;
+
+    for (int v = 0; v < mNumVoices; v++) {
+      Voice &voice = mVoices[v];
+      const Control &control = mControls[v];
+      float target = control.active.load(std::memory_order_relaxed) ? 1.0f
+                                                                     : 0.0f;
+      // off and silent: nothing to do at all
+      if (target == 0.0f && voice.gain == 0.0f) continue;
+      mNumSounding++;
+
+      // the first block of a voice starts from its controls, after that
+      // they glide
+      float c = control.control.load(std::memory_order_relaxed);
+      float pan = control.pan.load(std::memory_order_relaxed);
+      if (voice.gain == 0.0f) {
+        voice.control = c;
+        voice.pan = pan;
+      } else {
+        voice.control += glide * (c - voice.control);
+        voice.pan += glide * (pan - voice.pan);
+      }
+
+      render(v, &mBuffer[0], n, voice.control);
+
+      // the fade: a ramp towards the target, then flat
+      float *buffer = &mBuffer[0];
+      if (voice.gain != target) {
+        float direction = target > voice.gain ? step : -step;
+        int ramp = min(n, (int)ceilf(fabsf(target - voice.gain) / step));
+        vDSP_vramp(&voice.gain, &direction, &mGains[0], 1, ramp);
+        if (ramp < n) vDSP_vfill(&target, &mGains[ramp], 1, n - ramp);
+        vDSP_vmul(buffer, 1, &mGains[0], 1, buffer, 1, n);
+        voice.gain = ramp < n ? target : voice.gain + direction * n;
+        // so that a voice fading out does reach exactly 0 and is culled
+        if (fabsf(voice.gain - target) < 0.5f * step) voice.gain = target;
+      }
+
+      // pan between the two nearest channels, and accumulate
+      if (n_channels == 1) {
+        vDSP_vadd(buffer, 1, output, 1, output, 1, n);
+        continue;
+      }
+      float position = voice.pan * (n_channels - 1);
+      int left = min((int)position, n_channels - 2);
+      float x = (position - left) * (float)M_PI_2;
+      float gains[2] = {cosf(x), sinf(x)};
+      for (int k = 0; k < 2; k++) {
+        float *channel = output + left + k;
+        vDSP_vsma(buffer, 1, &gains[k], channel, n_channels, channel,
+                  n_channels, n);
+      }
+    }
+  }
+
+ private:
+  // written by the control thread, read by the audio thread
+  struct Control {
+    Control() : active(false), control(0), pan(0.5f) {}
+    std::atomic<bool> active;
+    std::atomic<float> control;
+    std::atomic<float> pan;
+  };
+
+  // the audio thread's own state of each voice
+  struct Voice {
+    Voice() : gain(0), control(0), pan(0.5f) {}
+    float gain;
+    float control;
+    float pan;
+  };
+
+  int mNumVoices, mMaxBlock, mFadeSamples, mSmoothing;
+  unique_ptr<Control[]> mControls;
+  vector<Voice> mVoices;
+  vector<float> mBuffer, mGains;
+  int mNumSounding;
+};
@@ -158,7 +158,7 @@ class pkmFFT {
     vDSP_destroy_fftsetup(fftSetup);
   }
 
-  void forward(int start, float *buffer, float *magnitude, float *phase,
+  void forward(int start, const float *buffer, float *magnitude, float *phase,
                bool doWindow = true) {
     if (doWindow) {
       // multiply by window
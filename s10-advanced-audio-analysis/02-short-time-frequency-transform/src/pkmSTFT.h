@@ -114,7 +114,10 @@ class pkmSTFT {
 
     initializeFFTParameters(fftSize, windowSize, hopSize);
   }
-  ~pkmSTFT() { free(FFT); }
+  ~pkmSTFT() {
+    delete FFT;
+    free(edgeBuf);
+  }
 
   void initializeFFTParameters(int _fftSize, int _windowSize, int _hopSize) {
     fftSize = _fftSize;
@@ -124,6 +127,9 @@ class pkmSTFT {
     // fft constructor
     FFT = new pkmFFT(fftSize);
 
+    // one window's worth of scratch for frames overlapping the zero padding
+    edgeBuf = (float *)malloc(sizeof(float) * fftSize);
+
     numWindows = fftSize / hopSize + 1;
   }
 
@@ -139,33 +145,21 @@ class pkmSTFT {
     return numWindows;
   }
 
-  void STFT(float *buf, int bufSize, pkm::Mat &M_magnitudes,
+  // buf is only read, and is read in place: e.g. straight from
+  // pkmCircularRecorder::getAlignedData().  the input is still centred in
+  // zero padding up to a multiple of fftSize, but only the windows that
+  // overlap the padding are assembled (in a single window of scratch), the
+  // rest are transformed directly from buf.
+  void STFT(const float *buf, int bufSize, pkm::Mat &M_magnitudes,
             pkm::Mat &M_phases) {
-    // pad input buffer
     int padding = ceilf((float)bufSize / (float)fftSize) * fftSize - bufSize;
     int shift = padding / 2;
-    float *padBuf;
-    if (padding) {
-      // printf("Padding %d sample buffer with %d samples\n", bufSize, padding);
-      padBufferSize = bufSize + padding;
-      padBuf = (float *)malloc(sizeof(float) * padBufferSize);
-      // set padding to 0
-      // memset(&(padBuf[bufSize]), 0, sizeof(float)*padding);
-      vDSP_vclr(padBuf, 1, shift);
-      vDSP_vclr(padBuf + bufSize + shift, 1, shift);
-      // copy original buffer into padded one
-      // memcpy(padBuf, buf, sizeof(float)*bufSize);
-
-      cblas_scopy(bufSize, buf, 1, padBuf + shift, 1);
-    } else {
-      padBuf = buf;
-      padBufferSize = bufSize;
-    }
+    padBufferSize = bufSize + padding;
 
     // create output fft matrix
     numWindows = (padBufferSize - fftSize) / hopSize + 1;
 
-    if (M_magnitudes.rows != numWindows && M_magnitudes.cols != fftBins) {
+    if (M_magnitudes.rows != numWindows || M_magnitudes.cols != fftBins) {
       M_magnitudes.reset(numWindows, fftBins, true);
       M_phases.reset(numWindows, fftBins, true);
     }
@@ -175,14 +169,24 @@ class pkmSTFT {
       // get current col of freq mat
       float *magnitudes = M_magnitudes.row(i);
       float *phases = M_phases.row(i);
-      float *buffer = padBuf + i * hopSize;
+
+      // window start in buf's coordinates
+      int start = i * hopSize - shift;
+      const float *buffer;
+      if (start >= 0 && start + fftSize <= bufSize) {
+        buffer = buf + start;
+      } else {
+        int from = start < 0 ? -start : 0;
+        int to = start + fftSize > bufSize ? bufSize - start : fftSize;
+        vDSP_vclr(edgeBuf, 1, fftSize);
+        if (to > from) {
+          cblas_scopy(to - from, buf + start + from, 1, edgeBuf + from, 1);
+        }
+        buffer = edgeBuf;
+      }
 
       FFT->forward(0, buffer, magnitudes, phases);
     }
-    // release padded buffer
-    if (padding) {
-      free(padBuf);
-    }
   }
 
   int getBins() { return fftBins; }
@@ -225,6 +229,7 @@ class pkmSTFT {
   pkmFFT *FFT;
 
  private:
+  float *edgeBuf;
   int sampleRate, numFFTs, fftSize, fftBins, hopSize, bufferSize, padBufferSize,
       windowSize, numWindows;
 };
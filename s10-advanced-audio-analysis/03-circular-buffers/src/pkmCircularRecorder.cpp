@@ -8,101 +8,187 @@
  */
 
 #include "pkmCircularRecorder.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// map a shared memory object of bytes (a multiple of the page size) twice,
+// back to back, returning NULL if the platform will not let us
+static float * mirroredMap(size_t bytes)
+{
+	int fd = -1;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	fd = memfd_create("pkmCircularRecorder", MFD_CLOEXEC);
+#else
+	char name[64];
+	snprintf(name, sizeof(name), "/pkmCR.%d.%lx", (int)getpid(), (unsigned long)&fd);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		shm_unlink(name);
+	}
+#endif
+	if (fd < 0) {
+		return NULL;
+	}
+	if (ftruncate(fd, bytes) != 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	// reserve the whole range first so nothing else can land in the second half
+	char *base = (char *)mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	void *first = mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	void *second = mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+	close(fd);
+	
+	if (first != base || second != base + bytes) {
+		munmap(base, 2 * bytes);
+		return NULL;
+	}
+	return (float *)base;
+}
 
 pkmCircularRecorder::pkmCircularRecorder()
 {
-    
+	data_current = data_end = data = NULL;
+	size = sizeOver2 = frameSize = 0;
+	currentIdx = 0;
+	bRecorded = false;
+	numChannels = 0;
+	capacity = 0;
+	mappedBytes = 0;
+	bMirrored = false;
+	written.store(0);
 }
 
-void pkmCircularRecorder::setup(int fixed_size, int frame_size)
+void pkmCircularRecorder::setup(int fixed_size, int frame_size, int num_channels)
 {
+	release();
+	
 	size = fixed_size;
 	sizeOver2 = fixed_size/2;
-	data = (float *)malloc((size+1) * sizeof(float));
-	memset(data, 0, (size+1)*sizeof(float));
+	frameSize = frame_size;
+	numChannels = num_channels;
+	allocate();
+	
+	data = channelData[0];
 	data_current = data;
 	data_end = data + size;		
-	frameSize = frame_size;
 	currentIdx = 0;
 	bRecorded = false;
+	written.store(0);
+}
+
+void pkmCircularRecorder::allocate()
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	mappedBytes = ((size * sizeof(float) + page - 1) / page) * page;
+	
+	bMirrored = true;
+	for (int ch = 0; ch < numChannels && bMirrored; ch++) {
+		float *ring = mirroredMap(mappedBytes);
+		if (ring == NULL) {
+			bMirrored = false;
+		} else {
+			channelData.push_back(ring);
+		}
+	}
+	
+	if (bMirrored) {
+		// a fresh shared memory object is already zeroed
+		capacity = mappedBytes / sizeof(float);
+	} else {
+		printf("[WARNING]: pkmCircularRecorder could not mirror its buffer, samples will be written twice\n");
+		for (size_t ch = 0; ch < channelData.size(); ch++) {
+			munmap(channelData[ch], 2 * mappedBytes);
+		}
+		channelData.clear();
+		capacity = size;
+		for (int ch = 0; ch < numChannels; ch++) {
+			float *ring = (float *)malloc(2 * capacity * sizeof(float));
+			memset(ring, 0, 2 * capacity * sizeof(float));
+			channelData.push_back(ring);
+		}
+	}
+}
+
+void pkmCircularRecorder::release()
+{
+	for (size_t ch = 0; ch < channelData.size(); ch++) {
+		if (bMirrored) {
+			munmap(channelData[ch], 2 * mappedBytes);
+		} else {
+			free(channelData[ch]);
+		}
+	}
+	channelData.clear();
+	data_current = data_end = data = NULL;
 }
 
 pkmCircularRecorder::~pkmCircularRecorder()
 {
-	free(data);
+	release();
 	size = 0;
-	data_current = data_end = data = NULL;
-	
 }
 
 void pkmCircularRecorder::clear()
 {
-	memset(data, 0, (size+1) * sizeof(float));
+	// the mirror only needs its first half cleared
+	size_t count = bMirrored ? capacity : 2 * capacity;
+	for (size_t ch = 0; ch < channelData.size(); ch++) {
+		memset(channelData[ch], 0, count * sizeof(float));
+	}
 	currentIdx = 0;
 	bRecorded = false;
+	written.store(0, std::memory_order_release);
 }
 
 // get last half of the audio, 
 // (buf should be size / 2)
 void pkmCircularRecorder::getLastHalf(float *buf)
 {
-	//printf("3-cidx: %d, sizeOver2: %d, size: %d\n", currentIdx, sizeOver2, size);
-	if ((int)(currentIdx - sizeOver2) >= 0) {
-		cblas_scopy(sizeOver2, data + (currentIdx - sizeOver2), 1, buf, 1);
-	}
-	else {
-		// first part touching end of buffer
-		cblas_scopy(sizeOver2 - currentIdx, data + (size - (sizeOver2 - currentIdx)), 1, buf, 1);
-		// last part touching beginning of buffer
-		cblas_scopy(currentIdx, data, 1, buf + sizeOver2 - currentIdx, 1);
-	}
+	cblas_scopy(sizeOver2, getLastSamples(sizeOver2), 1, buf, 1);
 }
 
 // get first half of the audio, 
 // (buf should be size / 2)
 void pkmCircularRecorder::getFirstHalf(float *buf)
 {
-	//printf("2-cidx: %d, sizeOver2: %d, size: %d\n", currentIdx, sizeOver2, size);
-	if (currentIdx + sizeOver2 < size) {	
-		cblas_scopy(sizeOver2, data + currentIdx, 1, buf, 1);
-	}
-	else {		
-		// first part touching end of buffer
-		cblas_scopy(size-currentIdx, data + currentIdx, 1, buf, 1);
-		// last part in the beginning of the buffer
-		cblas_scopy(sizeOver2 - (size - currentIdx), data, 1, buf + (size - currentIdx), 1);
-	}
+	cblas_scopy(sizeOver2, front(), 1, buf, 1);
 }
 
 float pkmCircularRecorder::backValue()
 {
-	int offset = currentIdx - 1;
-	if (offset < 0) {
-		offset += size;
-	}
-	return *(data + offset);
+	return *back();
 }
 
 float* pkmCircularRecorder::back()
 {
 	int offset = currentIdx - 1;
 	if (offset < 0) {
-		offset += size;
+		offset += capacity;
 	}
 	return (data + offset);
 }
 
 float pkmCircularRecorder::frontValue()
 {
-	int offset = currentIdx;
-	
-	return *(data + offset);
+	return *front();
 }
 
+// oldest of the last size samples; the size samples from here on are
+// contiguous
 float* pkmCircularRecorder::front()
 {
-	int offset = currentIdx;
-	
+	int offset = currentIdx - size;
+	if (offset < 0) {
+		offset += capacity;
+	}
 	return (data + offset);
 }
 
@@ -113,5 +199,5 @@ void pkmCircularRecorder::setFrameSize(int frame_size)
 
 bool pkmCircularRecorder::isRecorded()
 {
-	return bRecorded;
+	return written.load(std::memory_order_acquire) >= size;
 }
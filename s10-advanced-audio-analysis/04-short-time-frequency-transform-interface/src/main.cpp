@@ -21,7 +21,6 @@ public:
         phases.resize(stft->getNumWindows(buffer_size), fft_size / 2);
         
         recorder.setup(buffer_size, frame_size);
-        buffer.resize(1, buffer_size);
         
         ofSoundStreamSetup(0, 1, 44100, frame_size, 3);
 
@@ -50,8 +49,9 @@ public:
     void audioIn(float *buf, int size, int ch) {
         recorder.insertFrame(buf);
         if (recorder.isRecorded()) {
-            recorder.copyAlignedData(buffer.data);
-            stft->STFT(buffer.data, n_frames * frame_size, magnitudes, phases);
+                // the recorder hands back the last buffer_size samples as one
+                // contiguous block, so the stft can read them where they are
+            stft->STFT(recorder.getAlignedData(), buffer_size, magnitudes, phases);
         }
     }
     
@@ -61,7 +61,7 @@ private:
     int buffer_size, fft_size, frame_size, n_frames;
     
     shared_ptr<pkmSTFT> stft;
-    pkmMatrix magnitudes, phases, buffer;
+    pkmMatrix magnitudes, phases;
     pkmCircularRecorder recorder;
 };
 
@@ -115,7 +115,7 @@ public:
                int fft_size = 2048);
     
     // 12 features + 12 optional delta
-    void computeMelFeatures(float *inputSignal,
+    void computeMelFeatures(const float *inputSignal,
                             float *outputFeatures,
                             int numFilters = -1,
                             bool computeLogAmplitude = true,
@@ -25,7 +25,6 @@ public:
         
         features.setup(44100, fft_size);
         recorder.setup(buffer_size, frame_size);
-        buffer.resize(1, buffer_size);
         
         ofSoundStreamSetup(0, 1, 44100, frame_size, 3);
 
@@ -45,10 +44,11 @@ public:
     }
     
     void drawSignal(ofEventArgs &args) {
-        float width_step = width / (float)buffer.size();
+        const float *buffer = recorder.getAlignedData();
+        float width_step = width / (float)buffer_size;
         float height_scale = height / 2;
-        for (int i = 1; i < buffer.size(); i ++) {
-//            ofSetColor(200 * (i / (float)buffer.size()), 100, 100);
+        for (int i = 1; i < buffer_size; i ++) {
+//            ofSetColor(200 * (i / (float)buffer_size), 100, 100);
             ofSetColor(200 * abs(buffer[i]) * 10.0, 100, 100);
             ofDrawLine((i - 1) * width_step, height / 2 - buffer[i - 1] * height_scale,
                        i * width_step, height / 2 - buffer[i] * height_scale);
@@ -75,9 +75,10 @@ public:
     void audioIn(float *buf, int size, int ch) {
         recorder.insertFrame(buf);
         if (recorder.isRecorded()) {
-            recorder.copyAlignedData(buffer.data);
-            stft->STFT(buffer.data, n_frames * frame_size, magnitudes, phases);
-            features.computeMelFeatures(buffer.data, mels.data, 60);
+                // read the last buffer_size samples in place, no copy
+            const float *buffer = recorder.getAlignedData();
+            stft->STFT(buffer, buffer_size, magnitudes, phases);
+            features.computeMelFeatures(buffer, mels.data, 60);
         }
     }
     
@@ -87,7 +88,7 @@ private:
     
     shared_ptr<pkmSTFT> stft;
     
-    pkmMatrix magnitudes, phases, mels, buffer;
+    pkmMatrix magnitudes, phases, mels;
     pkmCircularRecorder recorder;
     pkmAudioFeatures features;
 };
@@ -246,7 +246,7 @@ void pkmAudioFeatures::createDCT()
 	
 }
 
-void pkmAudioFeatures::computeMelFeatures(float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
+void pkmAudioFeatures::computeMelFeatures(const float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
 {
     // should window input buffer before FFT
 	fft->forward(0, input, fft_magnitudes, fft_phases);
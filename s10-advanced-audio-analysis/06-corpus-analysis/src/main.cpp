@@ -3,6 +3,7 @@
 #include "pkmSTFT.h"
 #include "pkmCircularRecorder.h"
 #include "pkmMatrix.h"
+#include "pkmAudioFileWriter.h"
 
 class Recording {
 public:
@@ -55,11 +56,18 @@ public:
     }
     
     shared_ptr<Recording> getMostSimilarRecording(pkmMatrix &magnitudes) {
-        pkmMatrix mean_magnitudes = magnitudes.mean();
+            // the mean spectrum of the target only lives for this search
+        if (frame_arena.size() < magnitudes.cols) {
+            frame_arena.setup(magnitudes.cols);
+        }
+        frame_arena.reset();
+        pkmMatrix mean_magnitudes(1, magnitudes.cols, frame_arena);
+        magnitudes.mean(mean_magnitudes);
+        
         float best_dist = HUGE_VALF;
         int best_idx = 0;
         for (int i = 0; i < recordings.size(); i++) {
-            pkmMatrix this_mean_magnitudes = recordings[i]->getFeatures();
+            const pkmMatrix &this_mean_magnitudes = recordings[i]->getFeatures();
             float dist = pkm::Mat::l1norm(mean_magnitudes.data,
                                           this_mean_magnitudes.data,
                                           mean_magnitudes.size());
@@ -76,6 +84,7 @@ public:
     }
     
 private:
+    pkm::Arena frame_arena;
     vector<shared_ptr<Recording>> recordings;
 };
 
@@ -141,10 +150,12 @@ public:
     }
     
     void audioIn(float *buf, int size, int ch) {
+            // the writers only copy into memory set aside when they were opened;
+            // the files are written on their own threads
         if(is_recording)
-            recording.push_back(buf, size);
+            recorder.write(buf, size);
         else if(is_playing)
-            target.push_back(buf, size);
+            target_recorder.write(buf, size);
     }
     
     void audioOut(float *buf, int size, int ch) {
@@ -160,24 +171,47 @@ public:
     
     void keyPressed(int k) {
         if (k == 'r') {
-            is_recording = !is_recording;
             if(!is_recording) {
-                magnitudes.resize(stft->getNumWindows(recording.size()), fft_size / 2);
-                phases.resize(stft->getNumWindows(recording.size()), fft_size / 2);
-                stft->STFT(recording.data, recording.size(), magnitudes, phases);
-                corpus.addRecording(magnitudes, recording);
+                    // each recording in the corpus gets its own file
+                recorder.open(ofToDataPath("recording-" + ofToString(corpus.size()) + ".wav"));
+                is_recording = true;
+            }
+            else {
+                is_recording = false;
+                recorder.close();
+                
+                    // analyse the recording straight out of the file
+                long n_samples;
+                const float *recording = recorder.getRecordedFrames(n_samples);
+                int n_recorded_frames = n_samples / frame_size;
+                if(n_recorded_frames > 0) {
+                    int size = n_recorded_frames * frame_size;
+                    magnitudes.resize(stft->getNumWindows(size), fft_size / 2);
+                    phases.resize(stft->getNumWindows(size), fft_size / 2);
+                    stft->STFT(recording, size, magnitudes, phases);
+                    pkmMatrix buffer(n_recorded_frames, frame_size, recording);
+                    corpus.addRecording(magnitudes, buffer);
+                }
             }
-            recording = pkmMatrix();
         }
         else if (k == 'p') {
-            is_playing = !is_playing;
-            if(!is_playing && target.size()) {
-                magnitudes.resize(stft->getNumWindows(target.size()), fft_size / 2);
-                phases.resize(stft->getNumWindows(target.size()), fft_size / 2);
-                stft->STFT(target.data, target.size(), magnitudes, phases);
-                match = corpus.getMostSimilarRecording(magnitudes);
+            if(!is_playing) {
+                target_recorder.open(ofToDataPath("target.wav"));
+                is_playing = true;
+            }
+            else {
+                is_playing = false;
+                target_recorder.close();
+                
+                long n_samples;
+                const float *target = target_recorder.getRecordedFrames(n_samples);
+                if(n_samples > 0 && corpus.size()) {
+                    magnitudes.resize(stft->getNumWindows(n_samples), fft_size / 2);
+                    phases.resize(stft->getNumWindows(n_samples), fft_size / 2);
+                    stft->STFT(target, n_samples, magnitudes, phases);
+                    match = corpus.getMostSimilarRecording(magnitudes);
+                }
             }
-            target = pkmMatrix();
         }
     }
     
@@ -188,7 +222,7 @@ private:
     
     shared_ptr<pkmSTFT> stft;
     pkmMatrix magnitudes, phases;
-    pkmMatrix recording, target;
+    pkmAudioFileWriter recorder, target_recorder;
     
     Corpus corpus;
     shared_ptr<Recording> match;
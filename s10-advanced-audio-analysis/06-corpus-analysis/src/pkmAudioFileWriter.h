@@ -0,0 +1,386 @@
+/*
+ *  pkmAudioFileWriter.h
+ *
+ *  Records audio to disk from the audio callback without allocating,
+ *  locking or touching the file on the audio thread (successor to
+ *  pkmEXTAudioFileWriter).
+ *
+ *  write() copies into a ring allocated by open() and returns; a writer
+ *  thread drains the ring to the file in large sequential writes (straight
+ *  out of the ring, no staging copy).  If the disk falls behind by more than
+ *  the ring holds, the frames that do not fit are dropped and counted
+ *  (getFramesDropped()), rather than blocking the audio thread.
+ *
+ *  Files are 32-bit float, interleaved, as WAV or, for a path ending in
+ *  .caf, CAF.  The header is valid from the moment the file is created:
+ *  a CAF data chunk is written with the "runs to the end of the file" size,
+ *  and a WAV header has its sizes brought up to date every
+ *  kHeaderInterval seconds, after the data it describes has been synced.  If
+ *  the program dies, everything up to the last update can still be read
+ *  back.  close() writes the final sizes.
+ *
+ *  getRecordedFrames() maps what has been written so far straight from the
+ *  file, so a finished (or still running) recording can be analysed without
+ *  reading it back into memory.  On a file that is still open it first
+ *  flush()es, which sleeps until the writer thread has the ring on disk:
+ *  usually a few milliseconds, but as long as the disk takes if it is
+ *  behind.  Call it from the main thread, never the audio thread.
+ *
+ *  Usage:
+ *
+ *  pkmAudioFileWriter writer;
+ *  writer.open(ofToDataPath("take.wav"));
+ *
+ *  // audio thread
+ *  writer.write(input, bufferSize);
+ *
+ *  // main thread
+ *  writer.close();
+ *  long frames;
+ *  const float *take = writer.getRecordedFrames(frames);
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef PKM_CACHE_LINE
+#define PKM_CACHE_LINE 64
+#endif
+
+using namespace std;
+
+class pkmAudioFileWriter {
+ public:
+  // smallest run of frames the writer thread bothers the disk with, unless
+  // it has been waiting longer than kHeaderInterval
+  static const long kMinWriteFrames = 1 << 14;
+  // seconds between WAV header updates
+  static const int kHeaderInterval = 1;
+
+  pkmAudioFileWriter()
+      : mFrameRate(0), mNumChannels(0), mFd(-1), mCaf(false),
+        mHeaderBytes(0), mCapacity(0), mHead(0), mTail(0), mOnDisk(0),
+        mDropped(0), mFlushTo(0), mRunning(false), mMap(NULL), mMapSize(0),
+        mMappedFrames(0) {}
+  ~pkmAudioFileWriter() {
+    close();
+    unmap();
+  }
+
+  // create (or truncate) path and start the writer thread.  the ring holds
+  // ring_seconds of audio: how long the disk may stall before frames are
+  // dropped.
+  bool open(string path, int sampleRate = 44100, int channels = 1,
+            float ring_seconds = 10.0f) {
+    close();
+    unmap();
+
+    mFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFd < 0) {
+      printf("[pkmAudioFileWriter]: could not create '%s'\n", path.c_str());
+      return false;
+    }
+    mFrameRate = sampleRate;
+    mNumChannels = channels;
+    mCaf = path.size() > 4 &&
+           !strcasecmp(path.c_str() + path.size() - 4, ".caf");
+
+    // the writer thread always writes whole frames, so the ring is never
+    // seen part written
+    long capacity = 1;
+    while (capacity < (long)(ring_seconds * sampleRate)) capacity <<= 1;
+    if (capacity != mCapacity || (long)mRing.size() != capacity * channels) {
+      mCapacity = capacity;
+      mRing.assign(capacity * channels, 0.0f);
+    }
+    mHead = mTail = mOnDisk = mDropped = mFlushTo = 0;
+
+    if (!writeHeader()) {
+      printf("[pkmAudioFileWriter]: could not write to '%s'\n", path.c_str());
+      ::close(mFd);
+      mFd = -1;
+      return false;
+    }
+
+    mRunning = true;
+    mThread = std::thread(&pkmAudioFileWriter::drain, this);
+    return true;
+  }
+
+  // audio thread: append count interleaved frames.  returns the number of
+  // frames taken, which is less than count only if the ring is full.
+  long write(const float *frames, long count) {
+    if (!mRunning.load(std::memory_order_relaxed)) return 0;
+    long head = mHead.load(std::memory_order_relaxed);
+    long space = mCapacity - (head - mTail.load(std::memory_order_acquire));
+    long n = count < space ? count : space;
+    long at = head & (mCapacity - 1);
+    long first = mCapacity - at < n ? mCapacity - at : n;
+    memcpy(&mRing[at * mNumChannels], frames,
+           sizeof(float) * first * mNumChannels);
+    memcpy(&mRing[0], frames + first * mNumChannels,
+           sizeof(float) * (n - first) * mNumChannels);
+    mHead.store(head + n, std::memory_order_release);
+    if (n < count) mDropped.fetch_add(count - n, std::memory_order_relaxed);
+    return n;
+  }
+
+  // wait until everything passed to write() so far is in the file.  the
+  // writer thread is asked to write it now rather than when it next would,
+  // so this blocks for about one disk write.
+  void flush() {
+    long head = mHead.load(std::memory_order_acquire);
+    mFlushTo.store(head, std::memory_order_release);
+    while (mRunning && mOnDisk.load(std::memory_order_acquire) < head) {
+      usleep(1000);
+    }
+  }
+
+  // stop the writer thread once it has drained the ring, and finalise the
+  // header.  the mapping from getRecordedFrames() stays valid until the
+  // next open().
+  void close() {
+    if (mFd < 0) return;
+    if (mThread.joinable()) {
+      mRunning = false;
+      mThread.join();
+    }
+    updateHeader(true);
+    remap();
+    ::close(mFd);
+    mFd = -1;
+  }
+
+  // frames written so far, mapped from the file (NULL if there are none).
+  // the pointer is valid until the next call, open() or destruction.
+  const float *getRecordedFrames(long &frames) {
+    if (mFd >= 0) {
+      flush();
+      remap();
+    }
+    frames = mMap != NULL ? mMappedFrames : 0;
+    return mMap != NULL ? (const float *)(mMap + mHeaderBytes) : NULL;
+  }
+
+  bool isOpen() const { return mFd >= 0; }
+
+  long getFramesWritten() const { return mOnDisk.load(); }
+
+  long getFramesDropped() const { return mDropped.load(); }
+
+  int mFrameRate, mNumChannels;
+
+ private:
+  // the writer thread: move whatever is in the ring to the file
+  void drain() {
+    long last_update = now();
+    while (true) {
+      bool running = mRunning.load(std::memory_order_acquire);
+      long tail = mTail.load(std::memory_order_relaxed);
+      long available = mHead.load(std::memory_order_acquire) - tail;
+      bool stale = now() - last_update >= kHeaderInterval;
+      bool flushing = mFlushTo.load(std::memory_order_acquire) > tail;
+
+      if (available > 0 &&
+          (available >= kMinWriteFrames || stale || flushing || !running)) {
+        long at = tail & (mCapacity - 1);
+        long first = mCapacity - at < available ? mCapacity - at : available;
+        struct iovec parts[2];
+        parts[0].iov_base = &mRing[at * mNumChannels];
+        parts[0].iov_len = sizeof(float) * first * mNumChannels;
+        parts[1].iov_base = &mRing[0];
+        parts[1].iov_len = sizeof(float) * (available - first) * mNumChannels;
+        if (!writeAll(parts, available > first ? 2 : 1)) {
+          printf("[pkmAudioFileWriter]: write failed, recording stopped\n");
+          mRunning = false;
+          return;
+        }
+        mTail.store(tail + available, std::memory_order_release);
+        mOnDisk.store(tail + available, std::memory_order_release);
+      } else if (!running) {
+        return;
+      }
+
+      if (stale) {
+        updateHeader(false);
+        last_update = now();
+      }
+      if (available < kMinWriteFrames && running) usleep(5000);
+    }
+  }
+
+  bool writeAll(struct iovec *parts, int count) {
+    while (count > 0) {
+      ssize_t n = ::writev(mFd, parts, count);
+      if (n < 0) return false;
+      while (count > 0 && (size_t)n >= parts[0].iov_len) {
+        n -= parts[0].iov_len;
+        parts++;
+        count--;
+      }
+      if (count > 0) {
+        parts[0].iov_base = (char *)parts[0].iov_base + n;
+        parts[0].iov_len -= n;
+      }
+    }
+    return true;
+  }
+
+  static long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // headers (samples are written in host order: little-endian hosts only)
+
+  static void le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+  }
+  static void le16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+  }
+  static void be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+  }
+  static void be64(uint8_t *p, uint64_t v) {
+    be32(p, (uint32_t)(v >> 32));
+    be32(p + 4, (uint32_t)v);
+  }
+
+  bool writeHeader() {
+    uint8_t h[68];
+    memset(h, 0, sizeof(h));
+    if (mCaf) {
+      memcpy(h, "caff", 4);
+      h[5] = 1;  // version 1, no flags
+      memcpy(h + 8, "desc", 4);
+      be64(h + 12, 32);
+      double rate = mFrameRate;
+      uint64_t bits;
+      memcpy(&bits, &rate, 8);
+      be64(h + 20, bits);
+      memcpy(h + 28, "lpcm", 4);
+      be32(h + 32, 3);  // float, little-endian
+      be32(h + 36, 4 * mNumChannels);
+      be32(h + 40, 1);
+      be32(h + 44, mNumChannels);
+      be32(h + 48, 32);
+      memcpy(h + 52, "data", 4);
+      be64(h + 56, (uint64_t)-1);  // to the end of the file
+      be32(h + 64, 0);             // edit count
+      mHeaderBytes = 68;
+    } else {
+      memcpy(h, "RIFF", 4);
+      le32(h + 4, 36);
+      memcpy(h + 8, "WAVE", 4);
+      memcpy(h + 12, "fmt ", 4);
+      le32(h + 16, 16);
+      le16(h + 20, 3);  // WAVE_FORMAT_IEEE_FLOAT
+      le16(h + 22, mNumChannels);
+      le32(h + 24, mFrameRate);
+      le32(h + 28, mFrameRate * 4 * mNumChannels);
+      le16(h + 32, 4 * mNumChannels);
+      le16(h + 34, 32);
+      memcpy(h + 36, "data", 4);
+      le32(h + 40, 0);
+      mHeaderBytes = 44;
+    }
+    return ::write(mFd, h, mHeaderBytes) == (ssize_t)mHeaderBytes;
+  }
+
+  // bring the sizes up to mOnDisk frames.  the data goes to disk before the
+  // header that covers it, so a crash never leaves a header pointing past
+  // the data.
+  void updateHeader(bool final) {
+    uint64_t bytes = (uint64_t)mOnDisk.load() * 4 * mNumChannels;
+    if (mCaf) {
+      // -1 already describes a crashed recording correctly
+      if (!final) return;
+      uint8_t size[8];
+      be64(size, bytes + 4);
+      pwrite(mFd, size, 8, 56);
+      return;
+    }
+    if (bytes > 0xffffffffULL - 36) bytes = 0xffffffffULL - 36;
+#ifdef __APPLE__
+    fsync(mFd);
+#else
+    fdatasync(mFd);
+#endif
+    uint8_t size[4];
+    le32(size, (uint32_t)(bytes + 36));
+    pwrite(mFd, size, 4, 4);
+    le32(size, (uint32_t)bytes);
+    pwrite(mFd, size, 4, 40);
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // read-back
+
+  void remap() {
+    long frames = mOnDisk.load(std::memory_order_acquire);
+    if (mMap != NULL && frames == mMappedFrames) return;
+    unmap();
+    if (frames == 0) return;
+    size_t size = mHeaderBytes + sizeof(float) * frames * mNumChannels;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) return;
+    mMap = (const uint8_t *)map;
+    mMapSize = size;
+    mMappedFrames = frames;
+  }
+
+  void unmap() {
+    if (mMap != NULL) munmap((void *)mMap, mMapSize);
+    mMap = NULL;
+    mMapSize = 0;
+    mMappedFrames = 0;
+  }
+
+  int mFd;
+  bool mCaf;
+  size_t mHeaderBytes;
+
+  // ring of mCapacity (a power of two) interleaved frames.  the audio thread
+  // owns mHead, the writer thread mTail, each on its own cache line.
+  vector<float> mRing;
+  long mCapacity;
+  char mPadding0[PKM_CACHE_LINE];
+  std::atomic<long> mHead;
+  char mPadding1[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mTail;
+  char mPadding2[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mOnDisk, mDropped;
+  // flush() asks for everything before this frame to be written straight away
+  std::atomic<long> mFlushTo;
+
+  std::atomic<bool> mRunning;
+  std::thread mThread;
+
+  const uint8_t *mMap;
+  size_t mMapSize;
+  long mMappedFrames;
+};
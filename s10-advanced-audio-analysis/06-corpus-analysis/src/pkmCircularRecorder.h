@@ -13,55 +13,117 @@
 #include <Accelerate/Accelerate.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <vector>
 
+#ifndef PKM_CACHE_LINE
+#define PKM_CACHE_LINE 64
+#endif
+
+// Fixed size ring holding the most recent audio of one or more channels.
+//
+// Each channel is kept planar in a mirrored buffer: the same pages are mapped
+// twice, back to back, so that data[i + capacity] is data[i].  Any run of up
+// to capacity samples ending at the write head is therefore one contiguous
+// block of memory, even when it straddles the wrap.  capacity is size rounded
+// up to a whole number of pages.  Where the double mapping is not available
+// the recorder falls back to an ordinary buffer of 2 * capacity and writes
+// every sample twice, which keeps the same guarantee.
+//
+// One thread (the audio callback) may call insert*(), while one other thread
+// reads with getLastSamples().  The sample count is published with
+// release/acquire ordering; a reader that holds on to a window can check with
+// isIntact() that the writer has not lapped it in the meantime.
 class pkmCircularRecorder
 {
 public:
     pkmCircularRecorder();
     ~pkmCircularRecorder();
     
-    void setup(int fixed_size = 44100, int frame_size = 512);
+    void setup(int fixed_size = 44100, int frame_size = 512, int num_channels = 1);
     
+    // idx samples after the oldest of the last size samples
     inline float * operator[](int idx)
     {
-        idx = (idx + currentIdx) % size;
-        return data + idx;
+        return front() + idx;
     }
 	
 	void clear();
 	
-	// add audio
+	// add a mono frame of frameSize samples (to channel 0)
 	inline void insertFrame(float *buf)
-	{	
-		 for (int i = 0; i < frameSize; i++) {
-             data[currentIdx] = *buf++;
-             currentIdx = (currentIdx + 1) % size;
-		 }
-		
-        /*
-		// this seems to be the same speed as the loop + modulo
-		if (currentIdx + frameSize >= size) {
-			// first part touching the end of the buffer
-			cblas_scopy(size-currentIdx, buf, 1, data + currentIdx, 1);
-			// second part at the start of the buffer
-			cblas_scopy(currentIdx + frameSize - size, buf + (size - currentIdx), 1, data, 1);
+	{
+		write(0, buf, 1, frameSize);
+		publish(frameSize);
+	}
+	
+	// add num_frames frames of numChannels interleaved samples
+	inline void insertInterleavedFrames(const float *buf, int num_frames)
+	{
+		for (int ch = 0; ch < numChannels; ch++) {
+			write(ch, buf + ch, numChannels, num_frames);
 		}
-		else {
-			cblas_scopy(frameSize, buf, 1, data + currentIdx, 1);
+		publish(num_frames);
+	}
+	
+	// add num_frames frames given as one buffer per channel
+	inline void insertPlanarFrames(const float * const *bufs, int num_frames)
+	{
+		for (int ch = 0; ch < numChannels; ch++) {
+			write(ch, bufs[ch], 1, num_frames);
 		}
-		currentIdx = (currentIdx + frameSize) % size;
-		*/
-		
-		if (currentIdx == 0) {
-			bRecorded = true;
+		publish(num_frames);
+	}
+	
+	// the most recent n samples of a channel (n <= capacity) as one
+	// contiguous block, oldest first.  end_count, if given, receives the
+	// write count the window ends at, to be passed to isIntact()
+	inline const float * getLastSamples(int n, int channel = 0, long *end_count = NULL) const
+	{
+		long count = written.load(std::memory_order_acquire);
+		if (end_count) {
+			*end_count = count;
+		}
+		long offset = (count - n) % capacity;
+		if (offset < 0) {
+			offset += capacity;
 		}
+		return channelData[channel] + offset;
+	}
+	
+	// false if the writer has since overwritten part of the n samples that
+	// ended at end_count
+	inline bool isIntact(long end_count, int n) const
+	{
+		return written.load(std::memory_order_acquire) - (end_count - n) <= capacity;
+	}
+	
+	// total number of frames written since setup() or clear()
+	inline long getWriteCount() const
+	{
+		return written.load(std::memory_order_acquire);
+	}
+	
+	inline int getNumChannels() const
+	{
+		return numChannels;
+	}
+	
+	inline int getCapacity() const
+	{
+		return capacity;
+	}
+	
+	inline float * getChannelPointer(int channel)
+	{
+		return channelData[channel];
 	}
 	
 	inline int getLastFrameOffset()
 	{
 		int offset = (currentIdx - frameSize);
 		if (offset < 0) {
-			offset += size;
+			offset += capacity;
 		}
 		return offset;
 	}
@@ -71,22 +133,29 @@ public:
 		return data;
 	}
 	
+	// the last size samples, oldest first, read in place with no copy.
+	// valid until the writer has added another capacity - size samples
+	inline const float * getAlignedData() const
+	{
+		return getLastSamples(size);
+	}
+	
+	// newest sizeOver2 samples, in place
+	inline const float * getLastHalf() const
+	{
+		return getLastSamples(sizeOver2);
+	}
+	
+	// oldest sizeOver2 of the last size samples, in place
+	inline const float * getFirstHalf() const
+	{
+		return getLastSamples(size);
+	}
+	
+	// copy the last size samples into buf, oldest first
 	inline void copyAlignedData(float *buf)
 	{
-		if (currentIdx == 0) {
-			cblas_scopy(size, data, 1, buf, 1);
-		}
-		else if(currentIdx < (size-1)) {
-			// first part touching end of buffer
-			cblas_scopy(size-currentIdx, data+currentIdx, 1, buf, 1);
-			// second part in the beginning of the buffer
-			cblas_scopy(currentIdx, data, 1, buf+(size-currentIdx), 1);
-		}
-        else if(currentIdx == size-1){
-			// second part in the beginning of the buffer
-			cblas_scopy(currentIdx, data, 1, buf+(size-currentIdx), 1);
-        }
-		
+		cblas_scopy(size, front(), 1, buf, 1);
 	}
     
 	
@@ -111,4 +180,56 @@ public:
 	int						currentIdx;
 	bool					bRecorded;
 	
+private:
+	pkmCircularRecorder(const pkmCircularRecorder &);
+	pkmCircularRecorder &operator=(const pkmCircularRecorder &);
+	
+	// copy n samples spaced by stride into a channel at the write head
+	inline void write(int channel, const float *buf, int stride, int n)
+	{
+		float *ring = channelData[channel];
+		int idx = currentIdx;
+		while (n > 0) {
+			int chunk = n < capacity ? n : capacity;
+			float *dst = ring + idx;
+			cblas_scopy(chunk, buf, stride, dst, 1);
+			if (!bMirrored) {
+				// keep the second copy in step: [0, capacity) is repeated
+				// at [capacity, 2 * capacity)
+				int first = chunk < capacity - idx ? chunk : capacity - idx;
+				cblas_scopy(first, dst, 1, dst + capacity, 1);
+				if (chunk > first) {
+					cblas_scopy(chunk - first, dst + first, 1, ring, 1);
+				}
+			}
+			buf += chunk * stride;
+			n -= chunk;
+			idx = (idx + chunk) % capacity;
+		}
+	}
+	
+	// advance the write head once every channel has its samples
+	inline void publish(int n)
+	{
+		currentIdx = (currentIdx + n) % capacity;
+		long count = written.load(std::memory_order_relaxed) + n;
+		if (count >= size) {
+			bRecorded = true;
+		}
+		written.store(count, std::memory_order_release);
+	}
+	
+	void allocate();
+	void release();
+	
+	std::vector<float *>	channelData;
+	int						numChannels, capacity;
+	size_t					mappedBytes;
+	bool					bMirrored;
+	
+	// the only field shared between the two threads gets a cache line to
+	// itself so the reader polling it never contends with the writer's state
+	char					padding0[PKM_CACHE_LINE];
+	std::atomic<long>		written;
+	char					padding1[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
 };
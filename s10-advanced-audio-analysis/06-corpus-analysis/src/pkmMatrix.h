@@ -81,6 +81,9 @@
 
 #include <Accelerate/Accelerate.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
 
@@ -107,9 +110,18 @@
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
 #endif
 
-    // uncomment next line for vecLib optimizations
-    //#define MULTIPLE_OF_4(x) ((x | 0x03) + 1)
-#define MULTIPLE_OF_4(x) x
+    // every matrix buffer starts on a 32-byte boundary and is padded to a whole
+    // number of 8-float (256-bit) vectors so vector loads never straddle the end
+#ifndef PKM_ALIGNMENT
+#define PKM_ALIGNMENT 32
+#endif
+#define PKM_ALIGNED_COUNT(x) ((((x) + 7) | 0x07) - 7)
+
+    // tile edge used by the in-place transpose: an 8 x 8 block of floats is
+    // 8 vectors of 256 bits, so a pair of tiles stays in L1 while it is swapped
+#ifndef PKM_TRANSPOSE_BLOCK
+#define PKM_TRANSPOSE_BLOCK 8
+#endif
 
 template <typename T>
 long signum(T val) {
@@ -118,6 +130,201 @@ long signum(T val) {
 
 
 namespace pkm {
+        
+        // allocate count floats on a PKM_ALIGNMENT boundary, release with free()
+    inline float *alignedMalloc(size_t count) {
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, PKM_ALIGNMENT,
+                           PKM_ALIGNED_COUNT(count > 0 ? count : 1) * sizeof(float)) != 0) {
+            printf("[ERROR]: pkm::alignedMalloc could not allocate %lu floats\n", count);
+            return NULL;
+        }
+        return (float *)ptr;
+    }
+        
+        // grow or shrink an aligned buffer keeping the first min(old, new) values.
+        // tries an in-place realloc first and only copies when the allocator hands
+        // back a block that is not aligned.
+    inline float *alignedRealloc(float *ptr, size_t old_count, size_t new_count) {
+        if (ptr == NULL) {
+            return alignedMalloc(new_count);
+        }
+        float *grown = (float *)realloc(
+            ptr, PKM_ALIGNED_COUNT(new_count > 0 ? new_count : 1) * sizeof(float));
+        if (grown == NULL || ((uintptr_t)grown % PKM_ALIGNMENT) == 0) {
+            return grown;
+        }
+        float *aligned = alignedMalloc(new_count);
+        cblas_scopy((int)MIN(old_count, new_count), grown, 1, aligned, 1);
+        free(grown);
+        return aligned;
+    }
+        
+        // frame-scoped bump allocator for short-lived scratch matrices.
+        //
+        //      pkm::Arena arena;
+        //      arena.setup(1 << 16);
+        //
+        //      void audioIn(float *buf, int size, int ch) {
+        //          arena.reset();
+        //          pkm::Mat features(1, 13, arena);
+        //          ...
+        //      }
+        //
+        // nothing is freed individually: every block handed out is invalidated by
+        // the next reset(), so arena-backed matrices must not outlive the callback.
+        // if a frame asks for more than the arena holds, the request falls back to
+        // a heap block that is kept until the next reset so nothing leaks.
+    class Arena {
+    public:
+        Arena() {
+            buffer = NULL;
+            capacity = 0;
+            offset = 0;
+            high_water = 0;
+        }
+        
+        ~Arena() {
+            reset();
+            free(buffer);
+            buffer = NULL;
+            capacity = 0;
+        }
+            
+            // reserve count floats of backing storage
+        void setup(size_t count) {
+            reset();
+            free(buffer);
+            capacity = PKM_ALIGNED_COUNT(count);
+            buffer = alignedMalloc(capacity);
+            high_water = 0;
+        }
+            
+            // hand out count floats starting on a PKM_ALIGNMENT boundary
+        inline float *allocate(size_t count) {
+            size_t padded = PKM_ALIGNED_COUNT(count > 0 ? count : 1);
+            if (buffer != NULL && offset + padded <= capacity) {
+                float *ptr = buffer + offset;
+                offset += padded;
+                high_water = MAX(high_water, offset);
+                return ptr;
+            }
+#ifdef DEBUG
+            printf("[WARNING]: pkm::Arena exhausted (%lu of %lu floats), using the heap\n",
+                   offset + padded, capacity);
+#endif
+            float *ptr = alignedMalloc(padded);
+            overflow.push_back(ptr);
+            high_water = MAX(high_water, offset + padded);
+            return ptr;
+        }
+            
+            // release everything handed out since the last reset, call once per frame
+        inline void reset() {
+            offset = 0;
+            for (size_t i = 0; i < overflow.size(); i++) {
+                free(overflow[i]);
+            }
+            overflow.clear();
+        }
+        
+        inline size_t used() const { return offset; }
+        inline size_t size() const { return capacity; }
+            
+            // largest number of floats any single frame has asked for, useful for
+            // sizing setup() so that frames never touch the heap
+        inline size_t highWaterMark() const { return high_water; }
+    
+    private:
+        Arena(const Arena &);
+        Arena &operator=(const Arena &);
+        
+        float *buffer;
+        size_t capacity, offset, high_water;
+        std::vector<float *> overflow;
+    };
+        
+    class Mat;
+    
+        // read-only, non-owning, strided window onto a block of floats.  element
+        // (r, c) lives at data[r * row_stride + c * col_stride], so a transpose or
+        // a range of columns is just a different pair of strides over the same
+        // memory and nothing is copied until copyTo() is asked for.
+        //
+        //      pkm::MatView bins = magnitudes.getTransposeView();
+        //      for (size_t b = 0; b < bins.rows; b++)
+        //          for (size_t f = 0; f < bins.cols; f++)
+        //              draw(b, f, bins(b, f));
+        //
+        // the view is only valid for as long as the matrix it was taken from is
+        // neither resized nor destroyed.
+    class MatView {
+    public:
+        MatView() {
+            data = NULL;
+            rows = cols = 0;
+            row_stride = col_stride = 0;
+        }
+        
+        MatView(const float *data, size_t rows, size_t cols,
+                size_t row_stride, size_t col_stride = 1) {
+            this->data = data;
+            this->rows = rows;
+            this->cols = cols;
+            this->row_stride = row_stride;
+            this->col_stride = col_stride;
+        }
+        
+        inline float operator()(size_t r, size_t c) const {
+#ifdef DEBUG
+            assert(r < rows && c < cols);
+#endif
+            return data[r * row_stride + c * col_stride];
+        }
+        
+            // true when each row of the view is a contiguous run of floats
+        inline bool isRowContiguous() const {
+            return col_stride == 1;
+        }
+        
+            // start of row r; step through it with getColStride()
+        inline const float *row(size_t r) const {
+            return data + r * row_stride;
+        }
+        
+        inline size_t getRowStride() const { return row_stride; }
+        inline size_t getColStride() const { return col_stride; }
+        
+        inline MatView getTranspose() const {
+            return MatView(data, cols, rows, col_stride, row_stride);
+        }
+        
+            // gather the view into a dense row-major rows x cols buffer
+        void copyTo(float *dst) const {
+            if (rows == 0 || cols == 0) {
+                return;
+            }
+            if (row_stride == 1 && col_stride == rows) {
+                    // transpose of a dense matrix
+                vDSP_mtrans(data, 1, dst, 1, rows, cols);
+            } else {
+                for (size_t r = 0; r < rows; r++) {
+                    cblas_scopy((int)cols, data + r * row_stride, (int)col_stride,
+                                dst + r * cols, 1);
+                }
+            }
+        }
+        
+            // resizes dst to rows x cols and copies the view into it
+        inline void copyTo(Mat &dst) const;
+        
+        const float *data;
+        size_t rows, cols;
+        
+    private:
+        size_t row_stride, col_stride;
+    };
+        
         // row-major floating point matrix
     class Mat {
             /////////////////////////////////////////
@@ -146,6 +353,11 @@ namespace pkm {
             // set every element to a value
         Mat(size_t r, size_t c, float val);
         
+            // scratch matrix drawing its storage from a frame arena, treated like
+            // user data so it is never freed and copies of it share the buffer;
+            // only valid until the arena is next reset
+        Mat(size_t r, size_t c, Arena &arena, bool clear = false);
+        
             // copy-constructor, called during:
             //        pkm::Mat a(rhs);
         Mat(const Mat &rhs);
@@ -477,18 +689,10 @@ namespace pkm {
                     // attempt to resize keeping data
                 if (r > rows && c > cols) {
                     if (bUserData) {
-                        data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
+                        data = alignedMalloc(r * c);
                         bUserData = false;
                     } else {
-                        float *temp_data =
-                        (float *)malloc(sizeof(float) * MULTIPLE_OF_4(rows * cols));
-                        cblas_scopy(rows * cols, data, 1, temp_data, 1);
-                        
-                        data = (float *)realloc(data, MULTIPLE_OF_4(r * c) * sizeof(float));
-                        cblas_scopy(rows * cols, temp_data, 1, data, 1);
-                        
-                        free(temp_data);
-                        temp_data = NULL;
+                        data = alignedRealloc(data, rows * cols, r * c);
                     }
                     
                     if (clear) {
@@ -500,14 +704,15 @@ namespace pkm {
                     
                     bAllocated = true;
                 } else if (r != rows || c != cols) {
+                    size_t old_size = rows * cols;
                     rows = r;
                     cols = c;
                     if (bUserData) {
-                        data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
+                        data = alignedMalloc(r * c);
                         bUserData = false;
                     }
                     else {
-                        data = (float *)realloc(data, MULTIPLE_OF_4(r * c) * sizeof(float));
+                        data = alignedRealloc(data, old_size, r * c);
                         
                         if(clear) {
                             vDSP_vclr(data, 1, rows * cols);
@@ -515,7 +720,7 @@ namespace pkm {
                     }
                 } else if (r == rows && c == cols) {
                     if (bUserData) {
-                        data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
+                        data = alignedMalloc(r * c);
                         bUserData = false;
                     }
                     
@@ -524,7 +729,7 @@ namespace pkm {
                     }
                 }
             } else {
-                data = (float *)malloc(MULTIPLE_OF_4(r * c) * sizeof(float));
+                data = alignedMalloc(r * c);
                 rows = r;
                 cols = c;
                 
@@ -549,7 +754,7 @@ namespace pkm {
             
             releaseMemory();
             
-            data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+            data = alignedMalloc(rows * cols);
             
             bAllocated = true;
             bUserData = false;
@@ -557,7 +762,7 @@ namespace pkm {
             
                 // set every element to 0
             if (clear) {
-                vDSP_vclr(data, 1, MULTIPLE_OF_4(rows * cols));
+                vDSP_vclr(data, 1, rows * cols);
             }
         }
         
@@ -572,7 +777,7 @@ namespace pkm {
                 longerp_mat[i] = factor * i;
             }
             
-            float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(new_size));
+            float *new_data = alignedMalloc(new_size);
             
             vDSP_vlint(data, longerp_mat.data, 1, new_data, 1, new_size, old_size);
             free(data);
@@ -618,7 +823,7 @@ namespace pkm {
         
             // like rescale, but 2D information preserved..
         void longerpolate(size_t r, size_t c) {
-            float *new_data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(r * c));
+            float *new_data = alignedMalloc(r * c);
             
             vImage_Buffer src = {(void *)data, (vImagePixelCount)rows,
                 (vImagePixelCount)cols,
@@ -702,7 +907,7 @@ namespace pkm {
             
             releaseMemory();
             
-            data = (float *)malloc(MULTIPLE_OF_4(rows * cols) * sizeof(float));
+            data = alignedMalloc(rows * cols);
             
             bAllocated = true;
             bUserData = false;
@@ -760,8 +965,7 @@ namespace pkm {
                 if (!m.isEmpty()) {
                     if (m.cols == cols) {
                             // add more rows, since the columns are the same dimension
-                        float *temp_data =
-                        (float *)malloc((rows + m.rows) * cols * sizeof(float));
+                        float *temp_data = alignedMalloc((rows + m.rows) * cols);
                         
                         cblas_scopy(rows * cols, data, 1, temp_data, 1);
                         
@@ -785,7 +989,7 @@ namespace pkm {
                             // is not empty)
                         else {
                                 // extend along column dimension
-                            data = (float *)realloc(data, (cols + m.cols) * sizeof(float));
+                            data = alignedRealloc(data, cols, cols + m.cols);
                             cblas_scopy(m.cols, m.data, 1, data + cols, 1);
                             cols += m.cols;
                         }
@@ -819,13 +1023,12 @@ namespace pkm {
                                "columns in Mat as length of std::vector!\n");
                         return;
                     }
-                    data = (float *)realloc(
-                                            data, MULTIPLE_OF_4((rows + 1) * cols) * sizeof(float));
+                    data = alignedRealloc(data, rows * cols, (rows + 1) * cols);
                     cblas_scopy(cols, m, 1, data + (rows * cols), 1);
                     rows++;
                 } else {
                     cols = size;
-                    data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(cols));
+                    data = alignedMalloc(cols);
                     cblas_scopy(cols, m, 1, data, 1);
                     rows = 1;
                     bAllocated = true;
@@ -848,8 +1051,7 @@ namespace pkm {
                            "number of columns in Mat as length of std::vector!\n");
                     return;
                 }
-                data = (float *)realloc(data,
-                                        MULTIPLE_OF_4((rows + 1) * cols) * sizeof(float));
+                data = alignedRealloc(data, rows * cols, (rows + 1) * cols);
                 cblas_scopy(cols, &(m[0]), 1, data + (rows * cols), 1);
                 rows++;
             } else {
@@ -873,8 +1075,7 @@ namespace pkm {
                            "std::vector!\n");
                     return;
                 }
-                data = (float *)realloc(
-                                        data, MULTIPLE_OF_4((rows + m.size()) * cols) * sizeof(float));
+                data = alignedRealloc(data, rows * cols, (rows + m.size()) * cols);
                 for (long i = 0; i < m.size(); i++) {
                     cblas_scopy(cols, &(m[i][0]), 1, data + ((rows + i) * cols), 1);
                 }
@@ -964,16 +1165,16 @@ namespace pkm {
 #endif
                 // are we removing the last row (or only row)?
             if (i == (rows - 1)) {
+                data = alignedRealloc(data, rows * cols, (rows - 1) * cols);
                 rows--;
-                realloc(data, sizeof(float) * MULTIPLE_OF_4(rows * cols));
             }
                 // we have to preserve the memory after the deleted row
             else {
                 size_t numRowsToCopy = rows - i - 1;
                 float *temp_data = (float *)malloc(sizeof(float) * numRowsToCopy * cols);
                 cblas_scopy(numRowsToCopy * cols, row(i + 1), 1, temp_data, 1);
+                data = alignedRealloc(data, rows * cols, (rows - 1) * cols);
                 rows--;
-                realloc(data, sizeof(float) * MULTIPLE_OF_4(rows * cols));
                 cblas_scopy(cols * numRowsToCopy, temp_data, 1, row(i), 1);
                 free(temp_data);
                 temp_data = NULL;
@@ -997,17 +1198,34 @@ namespace pkm {
             return submat;
         }
         
+            // columns are not contiguous, so this always copies (withCopy is
+            // kept for symmetry with rowRange); use getColRangeView() to read
+            // them in place
         inline Mat colRange(size_t start, size_t end, bool withCopy = true) {
 #ifdef DEBUG
             assert(cols >= end);
 #endif
-            setTranspose();
-            Mat submat(end - start, cols, row(start), withCopy);
-            setTranspose();
-            submat.setTranspose();
+            Mat submat;
+            getColRangeView(start, end).copyTo(submat);
             return submat;
         }
         
+        inline MatView getColRangeView(size_t start, size_t end) const {
+#ifdef DEBUG
+            assert(start <= end && cols >= end);
+#endif
+            return MatView(data + start, rows, end - start, cols, 1);
+        }
+        
+        inline MatView getView() const {
+            return MatView(data, rows, cols, cols, 1);
+        }
+        
+            // transposed read access without moving any data
+        inline MatView getTransposeView() const {
+            return MatView(data, cols, rows, 1, cols);
+        }
+        
             // copy data longo the matrix
         void copy(const Mat rhs) {
 #ifdef DEBUG
@@ -1234,19 +1452,44 @@ namespace pkm {
                 print("[Warning]: Transposing user data!");
             }
 #endif
-            if (rows == 1 || cols == 1) {
-                size_t tempvar = cols;
-                cols = rows;
-                rows = tempvar;
-            } else {
-                float *temp_data = (float *)malloc(sizeof(float) * rows * cols);
+            if (rows == cols) {
+                transposeSquareInPlace(data, rows);
+            } else if (rows != 1 && cols != 1) {
+                float *temp_data = alignedMalloc(rows * cols);
                 vDSP_mtrans(data, 1, temp_data, 1, cols, rows);
-                cblas_scopy(rows * cols, temp_data, 1, data, 1);
-                free(temp_data);
-                temp_data = NULL;
-                size_t tempvar = cols;
-                cols = rows;
-                rows = tempvar;
+                if (bUserData) {
+                        // the caller owns data, so the result has to go back into it
+                    cblas_scopy(rows * cols, temp_data, 1, data, 1);
+                    free(temp_data);
+                } else {
+                        // otherwise just adopt the transposed buffer
+                    free(data);
+                    data = temp_data;
+                }
+            }
+            size_t tempvar = cols;
+            cols = rows;
+            rows = tempvar;
+        }
+        
+            // transpose an n x n row-major matrix in place by swapping pairs of
+            // PKM_TRANSPOSE_BLOCK square tiles across the diagonal, so both the
+            // row-wise and the column-wise side of each swap stay in cache
+        static void transposeSquareInPlace(float *a, size_t n) {
+            const size_t B = PKM_TRANSPOSE_BLOCK;
+            for (size_t ii = 0; ii < n; ii += B) {
+                size_t i_end = MIN(ii + B, n);
+                for (size_t jj = ii; jj < n; jj += B) {
+                    size_t j_end = MIN(jj + B, n);
+                    for (size_t i = ii; i < i_end; i++) {
+                        float *row_i = a + i * n;
+                        for (size_t j = (jj == ii ? i + 1 : jj); j < j_end; j++) {
+                            float temp = row_i[j];
+                            row_i[j] = a[j * n + i];
+                            a[j * n + i] = temp;
+                        }
+                    }
+                }
             }
         }
         
@@ -1268,8 +1511,7 @@ namespace pkm {
                 size_t diagonal_elements = std::max<size_t>(rows, cols);
                 
                     // create a square matrix
-                float *temp_data = (float *)malloc(diagonal_elements * diagonal_elements *
-                                                   sizeof(float));
+                float *temp_data = alignedMalloc(diagonal_elements * diagonal_elements);
                 
                     // set values to 0
                 vDSP_vclr(temp_data, 1, diagonal_elements * diagonal_elements);
@@ -1425,34 +1667,45 @@ namespace pkm {
             return val;
         }
         
+            // vDSP_normalize with a NULL output only computes the mean and
+            // (population) std dev, in a single pass over buf
         static float var(const float *buf, size_t size, size_t stride = 1) {
-            float m = mean(buf, size, stride);
-            float v = 0;
-            float sqr = 0;
-            const float *p = buf;
-            size_t a = size;
-            while (a) {
-                sqr = (*p - m);
-                p += stride;
-                v += sqr * sqr;
-                a--;
-            }
-            return v / (float)size;
+            float m, s;
+            vDSP_normalize(buf, stride, NULL, 1, &m, &s, size);
+            return s * s;
         }
         
         static float stddev(const float *buf, size_t size, size_t stride = 1) {
-            float m = mean(buf, size, stride);
-            float v = 0;
-            float sqr = 0;
-            const float *p = buf;
-            size_t a = size;
-            while (a) {
-                sqr = (*p - m);
-                p += stride;
-                v += sqr * sqr;
-                a--;
+            float m, s;
+            vDSP_normalize(buf, stride, NULL, 1, &m, &s, size);
+            return s;
+        }
+        
+            // mean and population variance of every column of a row-major
+            // rows x cols buffer in one pass.  rather than striding down each
+            // column, this walks the rows in memory order and applies Welford's
+            // update to a whole row at a time:
+            //     delta = x - mean
+            //     mean += delta / n
+            //     m2   += delta^2 * (n - 1) / n
+            // scratch must hold cols floats
+        static void meanAndVarOfCols(const float *buf, size_t rows, size_t cols,
+                                     float *mean, float *var, float *scratch) {
+            vDSP_vclr(mean, 1, cols);
+            vDSP_vclr(var, 1, cols);
+            for (size_t r = 0; r < rows; r++) {
+                const float *row = buf + r * cols;
+                float inv_n = 1.0f / (float)(r + 1);
+                float weight = (float)r * inv_n;
+                vDSP_vsub(mean, 1, row, 1, scratch, 1, cols);
+                vDSP_vsma(scratch, 1, &inv_n, mean, 1, mean, 1, cols);
+                vDSP_vsq(scratch, 1, scratch, 1, cols);
+                vDSP_vsma(scratch, 1, &weight, var, 1, var, 1, cols);
+            }
+            if (rows > 0) {
+                float n = rows;
+                vDSP_vsdiv(var, 1, &n, var, 1, cols);
             }
-            return sqrtf(v / (float)size);
         }
         
         float rms() {
@@ -1530,10 +1783,9 @@ namespace pkm {
                     return *this;
                 }
                 Mat newMat(1, cols);
-                
-                for (long i = 0; i < cols; i++) {
-                    newMat.data[i] = var(data + i, rows, cols);
-                }
+                float *scratch = alignedMalloc(cols * 2);
+                meanAndVarOfCols(data, rows, cols, scratch, newMat.data, scratch + cols);
+                free(scratch);
                 return newMat;
             } else {
                 if (cols == 1) {
@@ -1557,10 +1809,11 @@ namespace pkm {
                     return *this;
                 }
                 Mat newMat(1, cols);
-                
-                for (size_t i = 0; i < cols; i++) {
-                    newMat.data[i] = stddev(data + i, rows, cols);
-                }
+                float *scratch = alignedMalloc(cols * 2);
+                meanAndVarOfCols(data, rows, cols, scratch, newMat.data, scratch + cols);
+                free(scratch);
+                int n = (int)cols;
+                vvsqrtf(newMat.data, newMat.data, &n);
                 return newMat;
             } else {
                 if (cols == 1) {
@@ -1601,6 +1854,31 @@ namespace pkm {
                 return newMat;
             }
         }
+            
+            // same as mean(row_major) but writes into an already allocated
+            // 1 x cols (or rows x 1) matrix, e.g. one drawn from a frame Arena
+        void mean(Mat &result, bool row_major = true) const {
+#ifdef DEBUG
+            assert(data != NULL);
+            assert(result.data != NULL);
+            assert(rows > 0 && cols > 0);
+#endif
+            if (row_major) {
+#ifdef DEBUG
+                assert(result.size() == cols);
+#endif
+                for (size_t i = 0; i < cols; i++) {
+                    result.data[i] = mean(data + i, rows, cols);
+                }
+            } else {
+#ifdef DEBUG
+                assert(result.size() == rows);
+#endif
+                for (size_t i = 0; i < rows; i++) {
+                    result.data[i] = mean(data + i * cols, cols, 1);
+                }
+            }
+        }
         
         inline void zNormalize() {
             float mean, stddev;
@@ -1616,23 +1894,23 @@ namespace pkm {
         }
         
         inline void zNormalizeEachCol() {
-            float mean, stddev;
-            float sumval, sumsquareval;
-            size_t size = rows;
-            if (size > 1) {
-                for (size_t i = 0; i < cols; i++) {
-                    vDSP_sve(data + i, cols, &sumval, size);
-                    vDSP_svesq(data + i, cols, &sumsquareval, size);
-                    mean = sumval / (float)size;
-                    stddev = sqrtf(sumsquareval / (float)size - mean * mean) + EPSILON;
-                    
-                        // subtract mean
-                    float rhs = -mean;
-                    vDSP_vsadd(data + i, cols, &rhs, data + i, cols, size);
-                    
-                        // divide by std dev
-                    vDSP_vsdiv(data + i, cols, &stddev, data + i, cols, size);
+            if (rows > 1) {
+                float *mean = alignedMalloc(cols * 3);
+                float *stddev = mean + cols;
+                meanAndVarOfCols(data, rows, cols, mean, stddev, stddev + cols);
+                
+                int n = (int)cols;
+                float eps = EPSILON;
+                vvsqrtf(stddev, stddev, &n);
+                vDSP_vsadd(stddev, 1, &eps, stddev, 1, cols);
+                
+                    // (x - mean) / stddev, one contiguous row at a time
+                for (size_t r = 0; r < rows; r++) {
+                    float *row = data + r * cols;
+                    vDSP_vsub(mean, 1, row, 1, row, 1, cols);
+                    vDSP_vdiv(stddev, 1, row, 1, row, 1, cols);
                 }
+                free(mean);
             }
         }
         
@@ -1656,32 +1934,20 @@ namespace pkm {
             meanMat.reset(1, cols);
             stddevMat.reset(1, cols);
             
-            float mean, stddev;
-            float sumval, sumsquareval;
-            size_t size = rows;
-            if (size == 1) {
+            if (rows == 1) {
                 cblas_scopy(cols, data, 1, meanMat.data, 1);
                 stddevMat.setTo(1.0);
-            } else if (size > 1) {
-                for (size_t i = 0; i < cols; i++) {
-                    vDSP_sve(data + i, cols, &sumval, size);
-                    vDSP_svesq(data + i, cols, &sumsquareval, size);
-                    mean = sumval / (float)size;
-                    stddev = sqrtf(sumsquareval / (float)size - mean * mean);
-                    
-                    meanMat[i] = mean;
-                    stddevMat[i] = stddev;
-                }
+            } else if (rows > 1) {
+                float *scratch = alignedMalloc(cols);
+                meanAndVarOfCols(data, rows, cols, meanMat.data, stddevMat.data, scratch);
+                free(scratch);
+                int n = (int)cols;
+                vvsqrtf(stddevMat.data, stddevMat.data, &n);
             }
         }
         
         inline void getMeanAndStdDev(float &mean, float &stddev) const {
-            float sumval, sumsquareval;
-            size_t size = rows * cols;
-            vDSP_sve(data, 1, &sumval, size);
-            vDSP_svesq(data, 1, &sumsquareval, size);
-            mean = sumval / (float)size;
-            stddev = sqrtf(sumsquareval / (float)size - mean * mean);
+            vDSP_normalize(data, 1, NULL, 1, &mean, &stddev, rows * cols);
         }
         
             // rescale the values in each row to their maximum
@@ -2119,7 +2385,7 @@ namespace pkm {
             fp = fopen(filename.c_str(), "r");
             if (fp) {
                 fscanf(fp, "%lu %lu\n", &rows, &cols);
-                data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(rows * cols));
+                data = alignedMalloc(rows * cols);
                 for (long i = 0; i < rows; i++) {
                     for (long j = 0; j < cols; j++) {
                         fscanf(fp, "%f, ", &(data[i * cols + j]));
@@ -2145,7 +2411,7 @@ namespace pkm {
             if (fp) {
                 rows = r;
                 cols = c;
-                data = (float *)malloc(sizeof(float) * MULTIPLE_OF_4(rows * cols));
+                data = alignedMalloc(rows * cols);
                 for (long i = 0; i < rows; i++) {
                     for (long j = 0; j < cols; j++) {
                         fscanf(fp, "%f, ", &(data[i * cols + j]));
@@ -2189,6 +2455,89 @@ namespace pkm {
             }
         }
     };
+    
+    inline void MatView::copyTo(Mat &dst) const {
+        if (dst.rows != rows || dst.cols != cols || dst.data == NULL) {
+            dst.reset(rows, cols);
+        }
+        copyTo(dst.data);
+    }
+    
+        // per-column mean and std dev over the last n rows pushed into a
+        // circular history.  the running sums are updated with the incoming and
+        // outgoing row on every insert, so reading the statistics costs O(cols)
+        // instead of a sweep over the whole history.  the sums are recomputed
+        // from the history each time it wraps so that float drift cannot build up.
+        //
+        // as with Mat::getMeanAndStdDev(), the statistics are over the whole
+        // window, which starts out filled with zeros.
+    class RollingStats {
+    public:
+        RollingStats() {}
+        
+        void setup(size_t history_rows, size_t cols = 1) {
+            history.reset(history_rows, cols, 0.0f);
+            sum.assign(cols, 0.0);
+            sum_sq.assign(cols, 0.0);
+        }
+        
+        inline void insertRow(const float *buf) {
+#ifdef DEBUG
+            assert(history.data != NULL);
+#endif
+            const float *old_row = history.row(history.current_row);
+            for (size_t i = 0; i < history.cols; i++) {
+                double x = buf[i], y = old_row[i];
+                sum[i] += x - y;
+                sum_sq[i] += x * x - y * y;
+            }
+            history.insertRowCircularly(buf);
+            if (history.current_row == 0) {
+                resync();
+            }
+        }
+        
+        inline void getMeanAndStdDev(float &mean, float &stddev, size_t col = 0) const {
+            double n = history.rows;
+            double m = sum[col] / n;
+            double v = sum_sq[col] / n - m * m;
+            mean = m;
+            stddev = v > 0.0 ? sqrt(v) : 0.0;
+        }
+        
+        inline void getMeanAndStdDev(Mat &meanMat, Mat &stddevMat) const {
+            if (meanMat.size() != history.cols) {
+                meanMat.reset(1, history.cols);
+            }
+            if (stddevMat.size() != history.cols) {
+                stddevMat.reset(1, history.cols);
+            }
+            for (size_t i = 0; i < history.cols; i++) {
+                getMeanAndStdDev(meanMat.data[i], stddevMat.data[i], i);
+            }
+        }
+        
+        const Mat &getHistory() const {
+            return history;
+        }
+        
+    private:
+        void resync() {
+            std::fill(sum.begin(), sum.end(), 0.0);
+            std::fill(sum_sq.begin(), sum_sq.end(), 0.0);
+            for (size_t r = 0; r < history.rows; r++) {
+                const float *row = history.row(r);
+                for (size_t i = 0; i < history.cols; i++) {
+                    double x = row[i];
+                    sum[i] += x;
+                    sum_sq[i] += x * x;
+                }
+            }
+        }
+        
+        Mat history;
+        std::vector<double> sum, sum_sq;
+    };
 };
 
 typedef pkm::Mat pkmMatrix;
@@ -19,17 +19,14 @@ public:
         fft = make_shared<pkmFFT>(fft_size);
         magnitudes.resize(1, fft_size / 2);
         phases.resize(1, fft_size / 2);
-        buffer.resize(1, fft_size);
         
         ofSoundStreamSetup(0, 1, 44100, frame_size, 3);
         
     }
     
     void update() {
-        if (recorder.isRecorded()) {
-            recorder.copyAlignedData(buffer.data);
-        }
-        fft->forward(0, buffer.data, magnitudes.data, phases.data);
+            // until the recorder has filled up, the start of the window is zeros
+        fft->forward(0, recorder.getAlignedData(), magnitudes.data, phases.data);
         
         stft.push_back(magnitudes);
         if (stft.size() > n_windows) {
@@ -62,7 +59,7 @@ private:
     int frame_size, fft_size, n_windows;
     
     shared_ptr<pkmFFT> fft;
-    pkmMatrix magnitudes, phases, buffer;
+    pkmMatrix magnitudes, phases;
     pkmCircularRecorder recorder;
     std::deque<pkmMatrix> stft;
 };
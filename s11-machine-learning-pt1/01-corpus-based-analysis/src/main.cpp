@@ -29,26 +29,31 @@
 #include "pkmCircularRecorder.h"
 #include "pkmAudioFeatures.h"
 #include "pkmMatrix.h"
-
-class Recording {
-public:
-    Recording(pkmMatrix buf, pkmMatrix feats) {
-        buffer = buf;
-        features = feats;
-    }
-    pkmMatrix buffer, features;
-};
+#include "pkmCorpusStore.h"
 
 class Corpus {
 public:
     void setup(int segment_size = 2048){
         analyzer.setup(44100, segment_size);
+        
+            // recordings are analysed on the corpus' own thread, with their
+            // own analyzer, so that matching can carry on while the corpus grows
+        recording_analyzer.setup(44100, segment_size);
+        corpora.setup(segment_size, 13, [this](const float *audio, float *features) {
+            recording_analyzer.computeLFCCF((float *)audio, features, 13);
+        });
+        
+            // scratch space for one matching frame: the features of the
+            // incoming audio, reset every time we match
+        frame_arena.setup(13);
     }
     
-    float * getNearestRecording(float *buf, int size) {
-        pkmMatrix buffer(1, size, buf);
-        pkmMatrix features(1, 13);
-        analyzer.computeLFCCF(buffer.data, features.data, 13);
+    const float * getNearestRecording(float *buf, int size) {
+            // called once per audio callback, so anything we drew from the
+            // arena last time is no longer needed
+        frame_arena.reset();
+        pkmMatrix features(1, 13, frame_arena);
+        analyzer.computeLFCCF(buf, features.data, 13);
         
             // look at every single recording's features
             // calculate the distance to it
@@ -56,10 +61,14 @@ public:
         float best_distance = HUGE_VALF;
         int best_idx = 0;
 
-        for(int recording_i = 0; recording_i < corpora.size(); recording_i++) {
+            // only recordings that have finished being analysed count; more
+            // may arrive while we look
+        int n_recordings = corpora.size();
+        for(int recording_i = 0; recording_i < n_recordings; recording_i++) {
+            const float *recording_features = corpora.getFeatures(recording_i);
             float this_distance = 0;
             for(int feature_i = 0; feature_i < 13; feature_i++){
-                this_distance += abs(features[feature_i] - corpora[recording_i].features[feature_i]);
+                this_distance += abs(features[feature_i] - recording_features[feature_i]);
             }
             if (this_distance < best_distance) {
                 best_distance = this_distance;
@@ -67,28 +76,27 @@ public:
             }
         }
         
-        if (corpora.size()) {
-            return corpora[best_idx].buffer.data;
+        if (n_recordings) {
+            return corpora.getAudio(best_idx);
         }
         else {
             return NULL;
         }
     }
     
+        // safe to call from audioIn: the audio is queued, and its features
+        // are calculated later on the corpus' thread
     void addRecording(float *buf, int size){
-        pkmMatrix buffer(1, size, buf);
-        pkmMatrix features(1, 13);
-        analyzer.computeLFCCF(buffer.data, features.data, 13);
-        Recording r(buffer, features);
-        corpora.push_back(r);
+        corpora.push(buf);
     }
     
     int size() {
         return corpora.size();
     }
 private:
-    pkmAudioFeatures analyzer;
-    vector<Recording> corpora;
+    pkmAudioFeatures analyzer, recording_analyzer;
+    pkm::Arena frame_arena;
+    pkmCorpusStore corpora;
 };
 
 class ofApp : public ofBaseApp {
@@ -131,7 +139,7 @@ public:
                 // get 2048 samples of audio and
                 // play back the nearest audio segments
                 // in my corpus
-            float *recording = corpus.getNearestRecording(buffer.data, size);
+            const float *recording = corpus.getNearestRecording(buffer.data, size);
             for (int i = 0; i < size; i++) {
                 buf[i] = recording[i];
             }
@@ -245,7 +245,7 @@ void pkmAudioFeatures::createDCT()
 	
 }
 
-void pkmAudioFeatures::computeMelFeatures(float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
+void pkmAudioFeatures::computeMelFeatures(const float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
 {
     // should window input buffer before FFT
 	fft->forward(0, input, fft_magnitudes, fft_phases);
@@ -268,8 +268,8 @@ void pkmAudioFeatures::computeMelFeatures(float *input, float *output, int numFi
         int a = 0;
         float *ptr1 = 0;
         
-        // log amplitude
-        a = cqtN;
+        // log amplitude (only of the filters we wrote to output)
+        a = numFilters == -1 ? cqtN : numFilters;
         ptr1 = output;
         while( a-- ){
             float f = *ptr1;
@@ -11,6 +11,10 @@
     - find the k-NN, NN - find the nearest audio segment based on
       the smallest distance to every possible audio feature.
     - playback the nearest segment(s).
+ 3. browsing:
+    - lay the recordings out in 2-d with t-SNE, updating the layout as it
+      converges and as new recordings arrive
+    - play back the recording nearest the mouse
  
  extend to do, e.g.:
     mfcc, delta mfcc, delta delta mfcc features
@@ -32,27 +36,34 @@
 #include "pkmCircularRecorder.h"
 #include "pkmAudioFeatures.h"
 #include "pkmMatrix.h"
-#include "ofxTSNE.h"
-
-class Recording {
-public:
-    Recording(pkmMatrix buf, pkmMatrix feats) {
-        buffer = buf;
-        features = feats;
-    }
-    pkmMatrix buffer, features;
-};
+#include "pkmCorpusStore.h"
+#include "pkmTSNE.h"
+#include "pkmPointGrid.h"
+#include "pkmTripleBuffer.h"
 
 class Corpus {
 public:
     void setup(int segment_size = 2048){
         analyzer.setup(44100, segment_size);
+        
+            // recordings are analysed on the corpus' own thread, with their
+            // own analyzer, so that matching can carry on while the corpus grows
+        recording_analyzer.setup(44100, segment_size);
+        corpora.setup(segment_size, 13, [this](const float *audio, float *features) {
+            recording_analyzer.computeLFCCF((float *)audio, features, 13);
+        });
+        
+            // scratch space for one matching frame: the features of the
+            // incoming audio, reset every time we match
+        frame_arena.setup(13);
     }
     
-    float * getNearestRecording(float *buf, int size) {
-        pkmMatrix buffer(1, size, buf);
-        pkmMatrix features(1, 13);
-        analyzer.computeLFCCF(buffer.data, features.data, 13);
+    const float * getNearestRecording(float *buf, int size) {
+            // called once per audio callback, so anything we drew from the
+            // arena last time is no longer needed
+        frame_arena.reset();
+        pkmMatrix features(1, 13, frame_arena);
+        analyzer.computeLFCCF(buf, features.data, 13);
         
             // look at every single recording's features
             // calculate the distance to it
@@ -60,10 +71,14 @@ public:
         float best_distance = HUGE_VALF;
         int best_idx = 0;
 
-        for(int recording_i = 0; recording_i < corpora.size(); recording_i++) {
+            // only recordings that have finished being analysed count; more
+            // may arrive while we look
+        int n_recordings = corpora.size();
+        for(int recording_i = 0; recording_i < n_recordings; recording_i++) {
+            const float *recording_features = corpora.getFeatures(recording_i);
             float this_distance = 0;
             for(int feature_i = 0; feature_i < 13; feature_i++){
-                this_distance += abs(features[feature_i] - corpora[recording_i].features[feature_i]);
+                this_distance += abs(features[feature_i] - recording_features[feature_i]);
             }
             if (this_distance < best_distance) {
                 best_distance = this_distance;
@@ -71,37 +86,112 @@ public:
             }
         }
         
-        if (corpora.size()) {
-            return corpora[best_idx].buffer.data;
+        if (n_recordings) {
+            return corpora.getAudio(best_idx);
         }
         else {
             return NULL;
         }
     }
     
+        // safe to call from audioIn: the audio is queued, and its features
+        // are calculated later on the corpus' thread
     void addRecording(float *buf, int size){
-        pkmMatrix buffer(1, size, buf);
-        pkmMatrix features(1, 13);
-        analyzer.computeLFCCF(buffer.data, features.data, 13);
-        Recording r(buffer, features);
-        corpora.push_back(r);
+        corpora.push(buf);
     }
     
     int size() {
         return corpora.size();
     }
     
-    float * getFeatures(int i){
-        return corpora[i].features.data;
+    const float * getFeatures(int i){
+        return corpora.getFeatures(i);
+    }
+    
+    const float * getAudio(int i){
+        return corpora.getAudio(i);
+    }
+    
+private:
+    pkmAudioFeatures analyzer, recording_analyzer;
+    pkm::Arena frame_arena;
+    pkmCorpusStore corpora;
+};
+
+    // draws every point of the layout with a single call: positions and
+    // colours live in a vbo on the gpu, drawn as GL_POINTS, and only the
+    // parts that change are sent again
+class ScatterPlot {
+public:
+    ScatterPlot() {
+        n_points = 0;
+        capacity = 0;
+        highlighted = -1;
+        color = ofFloatColor(200 / 255.0, 100 / 255.0, 100 / 255.0);
+        highlight_color = ofFloatColor(1, 1, 1);
+    }
+    
+        // xy holds x, y in [0, 1] for each point
+    void setPositions(const vector<float> &xy) {
+        int n = xy.size() / 2;
+        if (n > capacity) {
+                // grow by doubling so that a corpus growing a few points at a
+                // time does not reallocate the buffers every frame
+            capacity = max(n, max(2 * capacity, 1024));
+            colors.assign(capacity, color);
+            if (highlighted >= 0 && highlighted < n) {
+                colors[highlighted] = highlight_color;
+            }
+            vector<float> positions(capacity * 2, 0.0f);
+            copy(xy.begin(), xy.end(), positions.begin());
+            vbo.setVertexData(positions.data(), 2, capacity, GL_DYNAMIC_DRAW);
+            vbo.setColorData(colors.data(), capacity, GL_DYNAMIC_DRAW);
+        }
+        else if (n > 0) {
+                // every point moves, but the buffer stays where it is
+            vbo.getVertexBuffer().updateData(0, sizeof(float) * n * 2, xy.data());
+        }
+        n_points = n;
+    }
+    
+        // change the colour of point idx (and put back the last one)
+    void setHighlighted(int idx) {
+        if (idx == highlighted) {
+            return;
+        }
+        if (highlighted >= 0 && highlighted < capacity) {
+            setColor(highlighted, color);
+        }
+        highlighted = idx;
+        if (highlighted >= 0 && highlighted < capacity) {
+            setColor(highlighted, highlight_color);
+        }
     }
     
-    float * getAudio(int i){
-        return corpora[i].buffer.data;
+    void draw(float width, float height, float point_size = 8) {
+        if (n_points == 0) {
+            return;
+        }
+        glPointSize(point_size);
+        glEnable(GL_POINT_SMOOTH);
+        ofPushMatrix();
+        ofScale(width, height);
+        vbo.draw(GL_POINTS, 0, n_points);
+        ofPopMatrix();
+        glDisable(GL_POINT_SMOOTH);
     }
     
 private:
-    pkmAudioFeatures analyzer;
-    vector<Recording> corpora;
+    void setColor(int idx, const ofFloatColor &c) {
+        colors[idx] = c;
+        vbo.getColorBuffer().updateData(sizeof(ofFloatColor) * idx,
+                                        sizeof(ofFloatColor), &colors[idx]);
+    }
+    
+    ofVbo vbo;
+    vector<ofFloatColor> colors;
+    ofFloatColor color, highlight_color;
+    int n_points, capacity, highlighted;
 };
 
 class ofApp : public ofBaseApp {
@@ -111,6 +201,7 @@ public:
         is_recording = false;
         
         best_idx = -1;
+        setMouse(0, 0);
         
         width = 500;
         height = 500;
@@ -121,23 +212,41 @@ public:
         
         corpus.setup(2048);
         
+            // the layout is worked out on its own thread, and we pick up
+            // each new version of it in update()
+        tsne.setup(13);
+        n_embedded = 0;
+        
         ofSoundStreamSetup(1, 2, 44100, 2048, 3);
     }
     
     void update() {
+            // hand any new recordings to the t-SNE; they are placed next to
+            // their nearest neighbours rather than starting the layout over
+        int n_recordings = corpus.size();
+        for (int rec_i = n_embedded; rec_i < n_recordings; rec_i++) {
+            tsne.addPoints(corpus.getFeatures(rec_i), 1);
+        }
+        n_embedded = n_recordings;
+        
+        if (tsne.getLayout(pts)) {
+                // audioOut looks points up in a grid built from its own copy of
+                // the layout.  the grid is rebuilt in a slot of the triple
+                // buffer that audioOut isn't using and then swapped in whole,
+                // so audioOut never sees one half written, and never frees
+                // or locks anything to pick it up.
+            audio_grids.getWriteBuffer().build(pts.data(), pts.size() / 2);
+            audio_grids.publish();
+            
+            scatter.setPositions(pts);
+        }
+        scatter.setHighlighted(best_idx);
     }
     
     void draw() {
         
-        for (int rec_i = 0; rec_i < pts.size(); rec_i++) {
-            double x = pts[rec_i][0] * width;
-            double y = pts[rec_i][1] * height;
-            if(rec_i == best_idx)
-                ofSetColor(255);
-            else
-                ofSetColor(200, 100, 100);
-            ofDrawCircle(x, y, 4);
-        }
+        ofSetColor(255);
+        scatter.draw(width, height);
         
         ofDrawBitmapString(ofToString(corpus.size()), 20, 20);
     }
@@ -157,23 +266,44 @@ public:
     void audioOut(float *buf, int size, int ch) {
         if (is_matching) {
             
-            float best_distance = HUGE_VALF;
-            
-            for(int rec_i = 0; rec_i < corpus.size(); rec_i++) {
-                float this_distance = abs(pts[rec_i][0] - mouseX / (float)width) + abs(pts[rec_i][1] - mouseY / (float)height);
-                if (this_distance < best_distance) {
-                    best_distance = this_distance;
-                    best_idx = rec_i;
+                // the corpus may have grown since the last layout, but only
+                // the recordings it laid out have a position
+            const pkmPointGrid &grid = audio_grids.read();
+            if (grid.size()) {
+                uint64_t mouse = mouse_position.load(std::memory_order_relaxed);
+                float x = (int32_t)(mouse >> 32) / (float)width;
+                float y = (int32_t)(mouse & 0xffffffff) / (float)height;
+                int nearest = grid.nearest(x, y);
+                if (nearest >= 0) {
+                    best_idx = nearest;
                 }
             }
             
-            float *audio = corpus.getAudio(best_idx);
-            for (int i = 0; i < size; i++) {
-                buf[i] = audio[i];
+            int idx = best_idx;
+            if (idx >= 0) {
+                const float *audio = corpus.getAudio(idx);
+                for (int i = 0; i < size; i++) {
+                    buf[i] = audio[i];
+                }
             }
         }
     }
     
+    void mouseMoved(int x, int y) {
+        setMouse(x, y);
+    }
+    
+    void mouseDragged(int x, int y, int button) {
+        setMouse(x, y);
+    }
+    
+        // x and y packed into one atomic, so audioOut always sees a position
+        // the mouse was really at
+    void setMouse(int x, int y) {
+        mouse_position.store(((uint64_t)(uint32_t)x << 32) | (uint32_t)y,
+                             std::memory_order_relaxed);
+    }
+    
     void keyPressed(int k) {
         if(k == 'r') {
             is_recording = !is_recording;
@@ -186,27 +316,26 @@ public:
                 is_recording = false;
         }
         else if(k == ' ') {
-            vector<vector<float>> features;
-            
-            for (int rec_i = 0; rec_i < corpus.size(); rec_i++) {
-                vector<float> this_feature;
-                float *f = corpus.getFeatures(rec_i);
-                for (int feat_i = 0; feat_i < 13; feat_i++) {
-                    this_feature.push_back(f[feat_i]);
-                }
-                features.push_back(this_feature);
-            }
-            
-            pts = tsne.run(features, 2);
+                // start the layout again from scratch, with every recording
+                // so far (update() hands them over)
+            tsne.setup(13);
+            n_embedded = 0;
         }
     }
     
     
 private:
     
-    ofxTSNE tsne;
-    vector<vector<double>> pts;
-    int best_idx;
+    pkmTSNE tsne;
+    int n_embedded;
+    
+        // x, y of each recording in [0, 1] for drawing, and a grid over
+        // a copy of them for audioOut
+    vector<float> pts;
+    ScatterPlot scatter;
+    pkmTripleBuffer<pkmPointGrid> audio_grids;
+    std::atomic<uint64_t> mouse_position;
+    std::atomic<int> best_idx;
     
     pkmMatrix buffer;
     
@@ -0,0 +1,190 @@
+/*
+ *  pkmCorpusStore.h
+ *
+ *  Append-only store of fixed-size audio segments and their features that
+ *  can grow while it is being searched.
+ *
+ *  Segments live in chunks of chunk_size entries which are never moved or
+ *  freed once written, so a pointer returned by getAudio()/getFeatures()
+ *  stays valid for the life of the store.  size() is published with
+ *  release/acquire ordering: every entry below it is complete.
+ *
+ *  Adding is split in two so that the audio callback never waits:
+ *
+ *  - push() (one producer, e.g. audioIn) copies the audio into a small
+ *    preallocated queue and returns; if the queue is full the segment is
+ *    dropped and counted.
+ *  - a worker thread moves queued segments into the chunks, calls the
+ *    feature function on them, and only then bumps size().
+ *
+ *  Any number of threads may read entries below size() at the same time.
+ *  The feature function runs on the worker thread, so it should use its own
+ *  analysis objects rather than ones shared with the readers.
+ *
+ *  Usage:
+ *
+ *  pkmCorpusStore store;
+ *  store.setup(2048, 13, [&](const float *audio, float *features) {
+ *      // computeLFCCF only reads its input
+ *      analyzer.computeLFCCF((float *)audio, features, 13);
+ *  });
+ *  store.push(buf);                          // audio thread
+ *  for (size_t i = 0; i < store.size(); i++) // any thread
+ *      distance(store.getFeatures(i), ...);
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "pkmMatrix.h"
+
+#ifndef PKM_CACHE_LINE
+#define PKM_CACHE_LINE 64
+#endif
+
+class pkmCorpusStore {
+ public:
+  typedef std::function<void(const float *audio, float *features)> Extractor;
+
+  pkmCorpusStore()
+      : mAudioSize(0), mFeatureSize(0), mChunkSize(0), mQueueSize(0),
+        mEntrySize(0), mSize(0), mQueueHead(0), mQueueTail(0), mDropped(0),
+        mRunning(false) {}
+  ~pkmCorpusStore() {
+    stop();
+    for (size_t i = 0; i < mChunks.size(); i++) free(mChunks[i]);
+  }
+
+  // segments of audio_size samples with feature_size features each, at
+  // most max_chunks * chunk_size of them.  queue_size segments may wait for
+  // the worker before push() starts dropping.
+  void setup(int audio_size, int feature_size, Extractor extractor,
+             int chunk_size = 256, int max_chunks = 4096, int queue_size = 64) {
+    stop();
+    for (size_t i = 0; i < mChunks.size(); i++) free(mChunks[i]);
+
+    mAudioSize = audio_size;
+    mFeatureSize = feature_size;
+    mEntrySize = PKM_ALIGNED_COUNT(audio_size) + PKM_ALIGNED_COUNT(feature_size);
+    mChunkSize = chunk_size;
+    mExtractor = extractor;
+
+    // the table of chunks is sized once, so readers can index it while the
+    // worker fills in new chunk pointers
+    mChunks.assign(max_chunks, (float *)NULL);
+
+    mQueueSize = queue_size;
+    mQueue.assign((size_t)queue_size * audio_size, 0.0f);
+    mSize = 0;
+    mQueueHead = mQueueTail = 0;
+    mDropped = 0;
+
+    mRunning = true;
+    mThread = std::thread(&pkmCorpusStore::work, this);
+  }
+
+  // producer: queue one segment of audio_size samples.  false if it was
+  // dropped because the worker is behind or the store is full.
+  bool push(const float *audio) {
+    long head = mQueueHead.load(std::memory_order_relaxed);
+    if (head - mQueueTail.load(std::memory_order_acquire) >= mQueueSize ||
+        mSize.load(std::memory_order_relaxed) + (head - mQueueTail.load()) >=
+            capacity()) {
+      mDropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    memcpy(&mQueue[(head % mQueueSize) * mAudioSize], audio,
+           sizeof(float) * mAudioSize);
+    mQueueHead.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // number of complete entries
+  size_t size() const { return mSize.load(std::memory_order_acquire); }
+
+  const float *getAudio(size_t i) const { return entry(i); }
+
+  const float *getFeatures(size_t i) const {
+    return entry(i) + PKM_ALIGNED_COUNT(mAudioSize);
+  }
+
+  int getAudioSize() const { return mAudioSize; }
+
+  int getFeatureSize() const { return mFeatureSize; }
+
+  // segments waiting for feature extraction
+  long getNumPending() const {
+    return mQueueHead.load() - mQueueTail.load();
+  }
+
+  long getNumDropped() const { return mDropped.load(); }
+
+  size_t capacity() const { return mChunks.size() * mChunkSize; }
+
+  // finish the queued segments and stop the worker
+  void stop() {
+    if (!mThread.joinable()) return;
+    mRunning = false;
+    mThread.join();
+  }
+
+ private:
+  float *entry(size_t i) const {
+    return mChunks[i / mChunkSize] + (i % mChunkSize) * mEntrySize;
+  }
+
+  void work() {
+    while (true) {
+      bool running = mRunning.load(std::memory_order_acquire);
+      long tail = mQueueTail.load(std::memory_order_relaxed);
+      long head = mQueueHead.load(std::memory_order_acquire);
+      if (tail == head) {
+        if (!running) return;
+        usleep(2000);
+        continue;
+      }
+
+      size_t i = mSize.load(std::memory_order_relaxed);
+      size_t chunk = i / mChunkSize;
+      if (mChunks[chunk] == NULL) {
+        mChunks[chunk] = pkm::alignedMalloc(mChunkSize * mEntrySize);
+        if (mChunks[chunk] == NULL) return;
+      }
+
+      float *audio = entry(i);
+      memcpy(audio, &mQueue[(tail % mQueueSize) * mAudioSize],
+             sizeof(float) * mAudioSize);
+      mQueueTail.store(tail + 1, std::memory_order_release);
+      mExtractor(audio, audio + PKM_ALIGNED_COUNT(mAudioSize));
+
+      mSize.store(i + 1, std::memory_order_release);
+    }
+  }
+
+  int mAudioSize, mFeatureSize, mChunkSize, mQueueSize;
+  size_t mEntrySize;
+  Extractor mExtractor;
+
+  // each chunk holds mChunkSize entries of audio then features
+  std::vector<float *> mChunks;
+
+  // segments pushed but not yet stored
+  std::vector<float> mQueue;
+
+  std::atomic<size_t> mSize;
+  char mPadding0[PKM_CACHE_LINE];
+  std::atomic<long> mQueueHead;
+  char mPadding1[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mQueueTail;
+  char mPadding2[PKM_CACHE_LINE - sizeof(std::atomic<long>)];
+  std::atomic<long> mDropped;
+  std::atomic<bool> mRunning;
+  std::thread mThread;
+};
@@ -0,0 +1,110 @@
+/*
+ *  pkmPointGrid.h
+ *
+ *  Uniform grid over a set of 2-d points in [0, 1] x [0, 1] for nearest
+ *  point queries.
+ *
+ *  build() buckets the points with a counting sort into a grid of about
+ *  two points per cell, keeping each cell's points (and their positions)
+ *  next to each other in memory.  nearest() searches outwards from the
+ *  query's cell one ring of cells at a time, and stops as soon as no
+ *  unvisited cell can hold anything closer, so a query looks at a handful
+ *  of points on average however many there are.  Distances are L1, as the
+ *  browser has always used.
+ *
+ *  A built grid is only read by nearest(), so one thread can build a new
+ *  grid while others query the old one.
+ *
+ *  Usage:
+ *
+ *  pkmPointGrid grid;
+ *  grid.build(xy, n_points);  // x, y pairs
+ *  int idx = grid.nearest(mouse_x, mouse_y);
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+class pkmPointGrid {
+ public:
+  pkmPointGrid() : mCells(0) {}
+
+  void build(const float *xy, int n) {
+    mCells = 1;
+    while (mCells < 1024 && mCells * mCells * 2 < n) mCells++;
+
+    mCellStart.assign(mCells * mCells + 1, 0);
+    vector<int> cell(n);
+    for (int i = 0; i < n; i++) {
+      cell[i] = cellOf(xy[i * 2], xy[i * 2 + 1]);
+      mCellStart[cell[i] + 1]++;
+    }
+    for (int c = 0; c < mCells * mCells; c++) mCellStart[c + 1] += mCellStart[c];
+
+    vector<int> fill(mCellStart.begin(), mCellStart.end() - 1);
+    mIndex.resize(n);
+    mXY.resize(n * 2);
+    for (int i = 0; i < n; i++) {
+      int at = fill[cell[i]]++;
+      mIndex[at] = i;
+      mXY[at * 2] = xy[i * 2];
+      mXY[at * 2 + 1] = xy[i * 2 + 1];
+    }
+  }
+
+  int size() const { return (int)mIndex.size(); }
+
+  // index (into the points given to build()) of the point nearest (x, y),
+  // or -1 if there are none
+  int nearest(float x, float y) const {
+    if (mIndex.empty()) return -1;
+    int cx = clampCell(x), cy = clampCell(y);
+    float cell_width = 1.0f / mCells;
+    float best = HUGE_VALF;
+    int best_idx = -1;
+    for (int r = 0; r < mCells; r++) {
+      // rings 0 .. r - 1 are done, and anything outside them is at least
+      // r - 1 cell widths away
+      if (r > 0 && best <= (r - 1) * cell_width) break;
+      for (int j = cy - r; j <= cy + r; j++) {
+        if (j < 0 || j >= mCells) continue;
+        // the top and bottom rows of the ring whole, the sides only at
+        // their two ends
+        int step = (j == cy - r || j == cy + r) ? 1 : 2 * r;
+        for (int i = cx - r; i <= cx + r; i += step) {
+          if (i < 0 || i >= mCells) continue;
+          int c = j * mCells + i;
+          for (int k = mCellStart[c]; k < mCellStart[c + 1]; k++) {
+            float d = fabsf(mXY[k * 2] - x) + fabsf(mXY[k * 2 + 1] - y);
+            if (d < best) {
+              best = d;
+              best_idx = mIndex[k];
+            }
+          }
+        }
+      }
+    }
+    return best_idx;
+  }
+
+ private:
+  int clampCell(float v) const {
+    int c = (int)(v * mCells);
+    return c < 0 ? 0 : (c >= mCells ? mCells - 1 : c);
+  }
+
+  int cellOf(float x, float y) const {
+    return clampCell(y) * mCells + clampCell(x);
+  }
+
+  int mCells;
+  // the points of cell c are [mCellStart[c], mCellStart[c + 1])
+  vector<int> mCellStart;
+  vector<int> mIndex;  // original index of each bucketed point
+  vector<float> mXY;   // bucketed positions
+};
@@ -0,0 +1,484 @@
+/*
+ *  pkmTSNE.h
+ *
+ *  Barnes-Hut t-SNE (van der Maaten, 2014) to 2 dimensions that runs on its
+ *  own thread, takes new points while it is running, and hands out the
+ *  layout as it converges.
+ *
+ *  - Affinities use the k = 3 * perplexity nearest neighbours of each point.
+ *    Neighbour lists are kept between additions: a new point is compared
+ *    against every point once, and only the points whose lists it enters
+ *    have their affinities recalculated.
+ *  - Repulsion is approximated with a quadtree, so an iteration costs
+ *    O(N log N) rather than O(N^2).
+ *  - A new point starts at the affinity-weighted mean of its neighbours'
+ *    positions, so the existing layout only has to settle around it rather
+ *    than start again.  Early exaggeration is only used for the first batch.
+ *
+ *  Usage:
+ *
+ *  pkmTSNE tsne;
+ *  tsne.setup(13);
+ *  tsne.addPoints(features, n_points);  // any time, from one thread
+ *  vector<float> xy;
+ *  if (tsne.getLayout(xy)) {            // x, y pairs scaled to [0, 1]
+ *      ...
+ *  }
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class pkmTSNE {
+ public:
+  pkmTSNE()
+      : mDims(0), mPerplexity(30), mTheta(0.5f), mK(90), mMaxIterations(0),
+        mN(0), mIteration(0), mSinceAbsorb(0), mFirstBatch(false),
+        mRunning(false), mAdded(0), mVersion(0), mTakenVersion(0),
+        mRandom(1) {}
+  ~pkmTSNE() { stop(); }
+
+  // points of dims features.  iterations is how long to keep optimising
+  // after the last points were added.
+  void setup(int dims, float perplexity = 30.0f, float theta = 0.5f,
+             int iterations = 1000) {
+    stop();
+    mDims = dims;
+    mPerplexity = perplexity;
+    mTheta = theta;
+    mK = (int)(3 * perplexity);
+    mMaxIterations = iterations;
+    mN = 0;
+    mIteration = mSinceAbsorb = 0;
+    mAdded = 0;
+    mX.clear();
+    mY.clear();
+    mUpdate.clear();
+    mGains.clear();
+    mNeighbours.clear();
+    mDistances.clear();
+    mNeighbourCount.clear();
+    mConditional.clear();
+    mPending.clear();
+    mLayout.clear();
+    mVersion = mTakenVersion = 0;
+
+    mRunning = true;
+    mThread = std::thread(&pkmTSNE::work, this);
+  }
+
+  // queue count points of dims features each (row-major)
+  void addPoints(const float *features, int count) {
+    std::lock_guard<std::mutex> lock(mPendingMutex);
+    mPending.insert(mPending.end(), features, features + count * mDims);
+    mAdded += count;
+  }
+
+  // number of points queued or embedded
+  int size() {
+    std::lock_guard<std::mutex> lock(mPendingMutex);
+    return mAdded;
+  }
+
+  // copy the latest layout into xy (x, y per point, each in [0, 1]) if it
+  // has changed since the last call
+  bool getLayout(vector<float> &xy) {
+    std::lock_guard<std::mutex> lock(mLayoutMutex);
+    if (mVersion == mTakenVersion) return false;
+    xy = mLayout;
+    mTakenVersion = mVersion;
+    return true;
+  }
+
+  void stop() {
+    if (!mThread.joinable()) return;
+    mRunning = false;
+    mThread.join();
+  }
+
+ private:
+  //////////////////////////////////////////////////////////////////////////
+  // worker
+
+  void work() {
+    while (mRunning) {
+      // points arriving one at a time are taken in batches, so that
+      // recalculating P does not crowd out the optimisation
+      bool idle = mN < 2 || mIteration >= mMaxIterations;
+      if ((idle || mSinceAbsorb >= 25) && absorbPending()) {
+        mIteration = mSinceAbsorb = 0;
+        idle = mN < 2;
+      }
+      if (idle) {
+        usleep(10000);
+        continue;
+      }
+      step();
+      mIteration++;
+      mSinceAbsorb++;
+      if (mIteration % 5 == 0 || mIteration == mMaxIterations) publish();
+    }
+  }
+
+  // move queued points into the embedding; true if there were any
+  bool absorbPending() {
+    vector<float> pending;
+    {
+      std::lock_guard<std::mutex> lock(mPendingMutex);
+      if (mPending.empty()) return false;
+      pending.swap(mPending);
+    }
+    int first = mN;
+    int count = (int)(pending.size() / mDims);
+    mFirstBatch = first == 0;
+
+    mX.insert(mX.end(), pending.begin(), pending.end());
+    mY.resize((first + count) * 2);
+    mUpdate.resize((first + count) * 2, 0.0f);
+    mGains.resize((first + count) * 2, 1.0f);
+    mNeighbours.resize((size_t)(first + count) * mK);
+    mDistances.resize((size_t)(first + count) * mK);
+    mNeighbourCount.resize(first + count, 0);
+    mConditional.resize((size_t)(first + count) * mK);
+
+    vector<char> dirty(first + count, 0);
+    for (int i = first; i < first + count; i++) {
+      const float *xi = &mX[(size_t)i * mDims];
+      for (int j = 0; j < i; j++) {
+        const float *xj = &mX[(size_t)j * mDims];
+        float d = 0;
+        for (int k = 0; k < mDims; k++) d += (xi[k] - xj[k]) * (xi[k] - xj[k]);
+        insertNeighbour(i, j, d);
+        if (insertNeighbour(j, i, d)) dirty[j] = 1;
+      }
+      dirty[i] = 1;
+      mN = i + 1;
+    }
+    for (int i = 0; i < mN; i++) {
+      if (dirty[i]) computeConditional(i);
+    }
+    symmetrize();
+
+    // place the new points among their already placed neighbours
+    std::normal_distribution<float> jitter(0.0f, 1e-4f);
+    for (int i = first; i < mN; i++) {
+      float x = 0, y = 0, w = 0;
+      for (int n = 0; n < mNeighbourCount[i]; n++) {
+        int j = mNeighbours[(size_t)i * mK + n];
+        if (j >= first) continue;
+        float p = mConditional[(size_t)i * mK + n];
+        x += p * mY[j * 2];
+        y += p * mY[j * 2 + 1];
+        w += p;
+      }
+      mY[i * 2] = (w > 0 ? x / w : 0) + jitter(mRandom);
+      mY[i * 2 + 1] = (w > 0 ? y / w : 0) + jitter(mRandom);
+    }
+    return true;
+  }
+
+  // keep i's k nearest neighbours sorted by distance; true if j got in
+  bool insertNeighbour(int i, int j, float d) {
+    int *idx = &mNeighbours[(size_t)i * mK];
+    float *dist = &mDistances[(size_t)i * mK];
+    int &n = mNeighbourCount[i];
+    if (n == mK && d >= dist[n - 1]) return false;
+    int at = n < mK ? n++ : n - 1;
+    while (at > 0 && dist[at - 1] > d) {
+      dist[at] = dist[at - 1];
+      idx[at] = idx[at - 1];
+      at--;
+    }
+    dist[at] = d;
+    idx[at] = j;
+    return true;
+  }
+
+  // p(j|i) over i's neighbours, with the gaussian width found by bisection
+  // so that the entropy matches log(perplexity)
+  void computeConditional(int i) {
+    const float *dist = &mDistances[(size_t)i * mK];
+    float *p = &mConditional[(size_t)i * mK];
+    int n = mNeighbourCount[i];
+    if (n == 0) return;
+    double target = log(mPerplexity < n ? mPerplexity : (double)n);
+    double beta = 1.0, lo = -HUGE_VAL, hi = HUGE_VAL;
+    for (int iter = 0; iter < 200; iter++) {
+      double sum = 0, h = 0;
+      for (int k = 0; k < n; k++) {
+        // distances relative to the nearest keep exp() in range
+        p[k] = (float)exp(-beta * (dist[k] - dist[0]));
+        sum += p[k];
+        h += beta * (dist[k] - dist[0]) * p[k];
+      }
+      h = h / sum + log(sum);
+      for (int k = 0; k < n; k++) p[k] = (float)(p[k] / sum);
+      if (fabs(h - target) < 1e-5) break;
+      if (h > target) {
+        lo = beta;
+        beta = hi == HUGE_VAL ? beta * 2 : (beta + hi) / 2;
+      } else {
+        hi = beta;
+        beta = lo == -HUGE_VAL ? beta / 2 : (beta + lo) / 2;
+      }
+    }
+  }
+
+  // P = (P + P') / sum, as compressed rows
+  void symmetrize() {
+    vector<pair<long, float> > entries;
+    entries.reserve((size_t)mN * mK * 2);
+    for (int i = 0; i < mN; i++) {
+      for (int k = 0; k < mNeighbourCount[i]; k++) {
+        int j = mNeighbours[(size_t)i * mK + k];
+        float p = mConditional[(size_t)i * mK + k];
+        entries.push_back(make_pair((long)i * mN + j, p));
+        entries.push_back(make_pair((long)j * mN + i, p));
+      }
+    }
+    sort(entries.begin(), entries.end());
+
+    mRowStart.assign(mN + 1, 0);
+    mCols.clear();
+    mValues.clear();
+    double total = 0;
+    for (size_t e = 0; e < entries.size(); e++) {
+      if (e > 0 && entries[e].first == entries[e - 1].first) {
+        mValues.back() += entries[e].second;
+      } else {
+        mCols.push_back((int)(entries[e].first % mN));
+        mValues.push_back(entries[e].second);
+        mRowStart[entries[e].first / mN + 1]++;
+      }
+      total += entries[e].second;
+    }
+    for (int i = 0; i < mN; i++) mRowStart[i + 1] += mRowStart[i];
+    for (size_t v = 0; v < mValues.size(); v++) mValues[v] = (float)(mValues[v] / total);
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // gradient descent
+
+  void step() {
+    const bool exaggerate = mFirstBatch && mIteration < 250;
+    const float exaggeration = exaggerate ? 12.0f : 1.0f;
+    const float momentum = mIteration < 250 ? 0.5f : 0.8f;
+    const float eta = 200.0f;
+
+    buildTree();
+
+    // repulsion, and the normalisation Z of the student-t kernel
+    mRepulsive.assign(mN * 2, 0.0f);
+    double z = 0;
+    for (int i = 0; i < mN; i++) z += repulsion(i, &mRepulsive[i * 2]);
+
+    for (int i = 0; i < mN; i++) {
+      float yi = mY[i * 2], yj = mY[i * 2 + 1];
+      float ax = 0, ay = 0;
+      for (int e = mRowStart[i]; e < mRowStart[i + 1]; e++) {
+        int j = mCols[e];
+        float dx = yi - mY[j * 2], dy = yj - mY[j * 2 + 1];
+        float q = mValues[e] / (1.0f + dx * dx + dy * dy);
+        ax += q * dx;
+        ay += q * dy;
+      }
+      float grad[2] = {exaggeration * ax - (float)(mRepulsive[i * 2] / z),
+                       exaggeration * ay - (float)(mRepulsive[i * 2 + 1] / z)};
+      for (int d = 0; d < 2; d++) {
+        float &gain = mGains[i * 2 + d];
+        float &update = mUpdate[i * 2 + d];
+        gain = (grad[d] > 0) != (update > 0) ? gain + 0.2f : gain * 0.8f;
+        if (gain < 0.01f) gain = 0.01f;
+        update = momentum * update - eta * gain * 4.0f * grad[d];
+      }
+    }
+
+    float mean[2] = {0, 0};
+    for (int i = 0; i < mN; i++) {
+      mY[i * 2] += mUpdate[i * 2];
+      mY[i * 2 + 1] += mUpdate[i * 2 + 1];
+      mean[0] += mY[i * 2];
+      mean[1] += mY[i * 2 + 1];
+    }
+    for (int i = 0; i < mN; i++) {
+      mY[i * 2] -= mean[0] / mN;
+      mY[i * 2 + 1] -= mean[1] / mN;
+    }
+  }
+
+  struct Node {
+    float cx, cy, half;  // square cell
+    float mx, my;        // centre of mass
+    int count;
+    int child;  // first of four children, or -1 for a leaf
+  };
+
+  void buildTree() {
+    float lo[2] = {HUGE_VALF, HUGE_VALF}, hi[2] = {-HUGE_VALF, -HUGE_VALF};
+    for (int i = 0; i < mN; i++) {
+      for (int d = 0; d < 2; d++) {
+        lo[d] = min(lo[d], mY[i * 2 + d]);
+        hi[d] = max(hi[d], mY[i * 2 + d]);
+      }
+    }
+    Node root;
+    root.cx = (lo[0] + hi[0]) / 2;
+    root.cy = (lo[1] + hi[1]) / 2;
+    root.half = max(hi[0] - lo[0], hi[1] - lo[1]) / 2 + 1e-5f;
+    root.mx = root.my = 0;
+    root.count = 0;
+    root.child = -1;
+    mTree.clear();
+    mTree.push_back(root);
+    mLeafPoint.assign(1, -1);
+    for (int i = 0; i < mN; i++) insert(i);
+  }
+
+  void insert(int i) {
+    float x = mY[i * 2], y = mY[i * 2 + 1];
+    int node = 0;
+    while (true) {
+      Node &n = mTree[node];
+      n.mx = (n.mx * n.count + x) / (n.count + 1);
+      n.my = (n.my * n.count + y) / (n.count + 1);
+      n.count++;
+      if (n.child < 0) {
+        if (n.count == 1) {
+          mLeafPoint[node] = i;
+          return;
+        }
+        // coincident points share a leaf rather than splitting forever
+        if (n.half < 1e-6f) return;
+        split(node);
+        int old = mLeafPoint[node];
+        mLeafPoint[node] = -1;
+        int c = quadrant(node, mY[old * 2], mY[old * 2 + 1]);
+        mTree[c].mx = mY[old * 2];
+        mTree[c].my = mY[old * 2 + 1];
+        mTree[c].count = 1;
+        mLeafPoint[c] = old;
+      }
+      node = quadrant(node, x, y);
+    }
+  }
+
+  void split(int node) {
+    int first = (int)mTree.size();
+    Node parent = mTree[node];
+    float h = parent.half / 2;
+    for (int q = 0; q < 4; q++) {
+      Node c;
+      c.cx = parent.cx + (q & 1 ? h : -h);
+      c.cy = parent.cy + (q & 2 ? h : -h);
+      c.half = h;
+      c.mx = c.my = 0;
+      c.count = 0;
+      c.child = -1;
+      mTree.push_back(c);
+      mLeafPoint.push_back(-1);
+    }
+    mTree[node].child = first;
+  }
+
+  int quadrant(int node, float x, float y) const {
+    const Node &n = mTree[node];
+    return n.child + (x > n.cx ? 1 : 0) + (y > n.cy ? 2 : 0);
+  }
+
+  // sum over j != i of q_ij^2 Z^2 (y_i - y_j) into force; returns the
+  // contribution to Z
+  double repulsion(int i, float *force) {
+    float x = mY[i * 2], y = mY[i * 2 + 1];
+    double z = 0;
+    mStack.clear();
+    mStack.push_back(0);
+    while (!mStack.empty()) {
+      const Node &n = mTree[mStack.back()];
+      mStack.pop_back();
+      if (n.count == 0) continue;
+      float dx = x - n.mx, dy = y - n.my;
+      float d2 = dx * dx + dy * dy;
+      bool leaf = n.child < 0;
+      if (leaf || 4 * n.half * n.half < mTheta * mTheta * d2) {
+        float count = (float)n.count;
+        // a leaf at our own position holds ourselves
+        if (leaf && d2 < 1e-12f) count -= 1;
+        if (count <= 0) continue;
+        float q = 1.0f / (1.0f + d2);
+        z += count * q;
+        force[0] += count * q * q * dx;
+        force[1] += count * q * q * dy;
+      } else {
+        for (int c = 0; c < 4; c++) mStack.push_back(n.child + c);
+      }
+    }
+    return z;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // output
+
+  void publish() {
+    float lo[2] = {HUGE_VALF, HUGE_VALF}, hi[2] = {-HUGE_VALF, -HUGE_VALF};
+    for (int i = 0; i < mN; i++) {
+      for (int d = 0; d < 2; d++) {
+        lo[d] = min(lo[d], mY[i * 2 + d]);
+        hi[d] = max(hi[d], mY[i * 2 + d]);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mLayoutMutex);
+    mLayout.resize(mN * 2);
+    for (int i = 0; i < mN; i++) {
+      for (int d = 0; d < 2; d++) {
+        float range = hi[d] - lo[d];
+        mLayout[i * 2 + d] = range > 0 ? (mY[i * 2 + d] - lo[d]) / range : 0.5f;
+      }
+    }
+    mVersion++;
+  }
+
+  int mDims;
+  float mPerplexity, mTheta;
+  int mK, mMaxIterations;
+
+  // worker state
+  int mN, mIteration, mSinceAbsorb;
+  bool mFirstBatch;
+  vector<float> mX;                // N x dims inputs
+  vector<float> mY, mUpdate, mGains;  // N x 2
+  vector<int> mNeighbours;         // N x k, nearest first
+  vector<float> mDistances;        // squared, N x k
+  vector<int> mNeighbourCount;
+  vector<float> mConditional;      // p(j|i), N x k
+  vector<int> mRowStart, mCols;    // symmetric P
+  vector<float> mValues;
+  vector<Node> mTree;
+  vector<int> mLeafPoint;
+  vector<int> mStack;
+  vector<float> mRepulsive;
+
+  std::atomic<bool> mRunning;
+  std::thread mThread;
+
+  std::mutex mPendingMutex;
+  vector<float> mPending;
+  int mAdded;
+
+  std::mutex mLayoutMutex;
+  vector<float> mLayout;
+  long mVersion, mTakenVersion;
+
+  std::mt19937 mRandom;
+};
@@ -3,17 +3,19 @@
  
  1. recording:
     - load a corpus of sound
-    - perform onset detection
+    - perform onset detection (spectral flux)
     - store as new audio segment
     - window segment
  2. analysis:
     - find mean MFCCs of each segment
     - "cluster" audio features
     - describe each audio segment by its cluster, e.g. segment 120 belongs to cluster 3
-    - build transition matrix describing how often there is a transition between each possible cluster
-    - convert transition matrix to probabilities by dividing by its sum
+    - count how often each cluster follows each of the last few clusters (a
+      "variable order" markov model), storing only the transitions we've seen
+    - convert the counts to probabilities as tables we can sample from quickly
  3. synthesis:
-    - sample from the transition matrix probabilities to play back an audio segment
+    - sample the next cluster from the probabilities given the clusters we just
+      played, and play back an audio segment from that cluster
  
  */
 
@@ -23,7 +25,11 @@
 #include "pkmCircularRecorder.h"
 #include "pkmAudioFeatures.h"
 #include "pkmMatrix.h"
-#include "ofxLearn.h"
+#include "pkmKMeans.h"
+#include "pkmMarkovModel.h"
+#include "pkmOnsetDetector.h"
+#include "pkmAudioSlab.h"
+#include "pkmTripleBuffer.h"
 
 ////////////////////////////////////////////////////////////////////////////
 class AudioSegmenter {
@@ -33,78 +39,99 @@ public:
     
     void setup(int sample_rate = 44100,
                int frame_size = 1024,
-               int min_samples_per_segment = 11025)
+               int min_samples_per_segment = 11025,
+               int max_minutes = 30)
     {
         this->sample_rate = sample_rate;
         this->frame_size = frame_size;
         this->min_samples_per_segment = min_samples_per_segment;
-        rms_values = pkmMatrix(44100 / frame_size, 1);
+        onsets.setup(sample_rate);
+        
+            // everything we record goes one after the other into a single
+            // buffer that never moves, and each segment is just where it
+            // starts in that buffer and how long it is.  so nothing is copied
+            // when a segment ends, however many we have.
+        recording.setup((size_t)sample_rate * 60 * max_minutes);
+        segment_start = 0;
+        segments.clear();
     }
     
     bool segment(float *input, int buffer_size) {
         bool segmented = false;
         
-            // add all the audio input values
-        float total = 0;
-        for (int i = 0; i < buffer_size; i++) {
-                // we add the "square" of each value so that negative numbers
-                // become positive.  this is like thinking of the "magnitude"
-            total = total + (input[i] * input[i]);
+            // once the recording is full there is nothing more to segment
+        if (recording.isFull()) {
+            return false;
         }
-            // the "mean" part of the RMS, we divide by the number of audio input samples
-            // we added in the for loop above
-        total = total / (float)buffer_size;
         
-            // the "root" part of RMS, we take the square root to get our RMS reading for the
-            // current chunk of audio input values
-        float rms = sqrt(total);
+            // the onset detector looks at how much each frequency has grown
+            // since a moment ago, and finds the moments where that growth
+            // stands out from the last few.  that catches soft or pitched
+            // onsets as well as loud ones.  it tells us where each one was
+            // to within a few samples, a little after it happened.
+        onsets.process(input, buffer_size);
         
-            // calculate the basic statistics of the rms values
-        float average_rms, std_rms;
-        rms_values.getMeanAndStdDev(average_rms, std_rms);
+            // keep the audio
+        recording.append(input, buffer_size);
         
-            // now we see if the current value is outside the mean + variance
-            // basic statistics tells us a normally distributed function
-            // has a mean and a deviation where 97% of the data is explained by
-            // 3 standard deviations.  we use this principle here in detecting
-            // the the current rms reading is outside this probability
-        float min_rms = 0.01;
-        if (rms > (average_rms + 2.0 * std_rms) &&
-            rms > min_rms &&
-            current_segment.size() > min_samples_per_segment)
-        {
-            stored_segments.push_back(current_segment);
-            current_segment = pkmMatrix();
+            // every onset starts a new segment, so long as the current one
+            // is long enough.  onsets are counted from the first sample we
+            // recorded, just like positions in the recording.
+        pkmOnsetDetector::Onset onset;
+        while (onsets.popOnset(onset)) {
+            long length = onset.sample - segment_start;
+            if (length < min_samples_per_segment) {
+                continue;
+            }
+            
+            pkmAudioSlab::View v = { (size_t)segment_start, (size_t)length };
+            segments.push_back(v);
+            segment_start = onset.sample;
             segmented = true;
         }
         
-            // add current frame of audio to current segment
-        current_segment.push_back(input, buffer_size);
-        
-            // add the current rms value
-        rms_values.insertRowCircularly(&rms);
-        
         return segmented;
     }
     
+        // the last segment as rows of frame_size samples.  this is a view of
+        // the recording rather than a copy, and stays valid for as long as the
+        // segmenter does.
     pkmMatrix getLastSegment() {
-        return stored_segments.back();
+        return recording.getMatrix(segments.back(), frame_size);
+    }
+    
+        // the most segments the recording can be cut into
+    int getMaxSegments() {
+        return (int)(recording.capacity() / min_samples_per_segment) + 1;
     }
     
 private:
     int                     sample_rate, frame_size, min_samples_per_segment;
-    pkmMatrix               rms_values;
-    pkmMatrix               current_segment;
-    vector<pkmMatrix>       stored_segments;
+    pkmOnsetDetector        onsets;
+    pkmAudioSlab            recording;
+    long                    segment_start;
+    vector<pkmAudioSlab::View> segments;
+};
+
+
+////////////////////////////////////////////////////////////////////////////
+    // where a recording's samples are, as rows of frames.  they live in the
+    // segmenter's slab and never move, so a copy of this stays valid however
+    // many recordings are added after it.
+struct Segment {
+    const float *data;
+    int rows, cols;
 };
 
 
 ////////////////////////////////////////////////////////////////////////////
 class Recording {
 public:
-    Recording(pkmMatrix buf, pkmMatrix feats) {
-        buffer = buf;
-        features = feats;
+        // copying a matrix that views other memory shares that memory, so
+        // the buffer here is the segmenter's recording, not a copy of it
+    Recording(const pkmMatrix &buf, const pkmMatrix &feats)
+    :   buffer(buf), features(feats)
+    {
     }
     pkmMatrix buffer, features;
 };
@@ -116,32 +143,42 @@ public:
     Corpus() {
     }
     
-    void setup(int sample_rate, int frame_size) {
+        // room for max_recordings is set aside here, so adding a recording on
+        // the audio thread never moves the ones other threads are reading
+    void setup(int sample_rate, int frame_size, int max_recordings) {
         analyzer.setup(sample_rate, frame_size);
+        summary = pkmMatrix(1, 4 * 13);
+        corpora.reserve(max_recordings);
+        n_recordings = 0;
     }
     
-    void addRecording(pkmMatrix recording) {
-        pkmMatrix features;
-        for (int row_i = 0; row_i < recording.rows; row_i++) {
-            pkmMatrix this_features(1, 13);
-            analyzer.computeLFCCF(recording.row(row_i), this_features.data, 13);
-            features.push_back(this_features);
+    void addRecording(const pkmMatrix &recording) {
+        if (corpora.size() == corpora.capacity()) {
+            return;
         }
-        pkmMatrix combined_feature = features.rowRange(0, 1);
-        combined_feature.push_back(features.mean());
-        Recording r(recording, combined_feature);
+        
+            // the features of every frame of the recording in one go, summarised
+            // as the first frame's features, their mean, their variance and how
+            // much they change.  we describe the recording by the first two,
+            // which sit next to each other at the start of the summary.
+        analyzer.computeLFCCBatchF(recording.data, recording.rows, NULL, 13, summary.data);
+        Recording r(recording, pkmMatrix(1, 2 * 13, summary.data, true));
         corpora.push_back(r);
+        n_recordings.store(corpora.size(), std::memory_order_release);
     }
     
+        // recordings added so far.  any thread may read corpora below this.
     int size() {
-        return corpora.size();
+        return n_recordings.load(std::memory_order_acquire);
     }
     
 private:
     pkmAudioFeatures analyzer;
+    pkmMatrix summary;
 
 protected:
     vector<Recording> corpora;
+    atomic<int> n_recordings;
 };
 
 
@@ -149,94 +186,132 @@ protected:
 class MarkovCorpus : public Corpus {
 public:
     MarkovCorpus() {
-        current_cluster = 0;
-        previous_cluster = 0;
+        n_history = 0;
         setNumClusters(10);
+        setOrder(2);
     }
     
     void setNumClusters(int n) {
         n_clusters = n;
     }
     
+        // how many previous clusters the next one depends on (at most 3)
+    void setOrder(int order) {
+        markov.setup(order);
+        clusters.clear();
+    }
+    
     void cluster() {
-            // use the ofxlearn kmeans object
-        ofxLearnKMeans kmeans;
-        kmeans.setNumClusters(n_clusters);
-        
-            // gather all features in the correct format (double precision)
-        for(int i = 0; i < corpora.size(); i++) {
-            vector<double> features;
-            features.resize(corpora[i].features.size());
-            corpora[i].features.copyToDouble(&(features[0]));
-            
-                // add each feature to the kmeans class
-            kmeans.addSample(features);
+        int n_corpora = size();
+        if (n_corpora == 0) {
+            return;
         }
         
-            // now train with all the data we just added
-        kmeans.train();
-        
-            // get the cluster centers (which cluster does each segment belong to)
-        clusters = kmeans.getClusters();
+            // gather all features into one matrix, a row per recording
+        int n_features = corpora[0].features.size();
+        pkmMatrix features(n_corpora, n_features);
+        for(int i = 0; i < n_corpora; i++) {
+            cblas_scopy(n_features, corpora[i].features.data, 1, features.row(i), 1);
+        }
         
-            // we'll create a "transition matrix" or "transition table" which says
-            // from any given "cluster", how likely are we to go to another "cluster"
-        transition_table = pkmMatrix(n_clusters, n_clusters, 0.0f);
+            // now train with all the data we just gathered.  the kmeans object
+            // remembers its cluster centers, so after recording some more we
+            // start from where we were rather than from scratch.  very large
+            // corpora use mini-batches of recordings rather than all of them.
+        kmeans.setNumClusters(n_clusters);
+        if (features.rows > 20000) {
+            kmeans.trainMiniBatch(features.data, features.rows, features.cols);
+        }
+        else {
+            kmeans.train(features.data, features.rows, features.cols);
+        }
         
-            // we'll also store all the recordings that belong to any given cluster
-        lut.resize(0); lut.resize(n_clusters);
+            // which cluster does each segment belong to.  if the recordings we
+            // already had kept their clusters, only the new ones need adding
+            // to the markov model; otherwise it is counted again from scratch.
+        const vector<int> &labels = kmeans.getClusters();
+        size_t first = clusters.size();
+        if (first > labels.size() || !equal(clusters.begin(), clusters.end(), labels.begin())) {
+            markov.clear();
+            first = 0;
+        }
         
-            // we'll loop through all our recordings, see which cluster they belong to
-            // and create our transition table based on which cluster we end up
-            // transitioning to.
-        int prev_cluster = -1;
-        for(int i = 0; i < corpora.size(); i++) {
-            cout << clusters[i] << endl;
-            
-                // keep a look up table which says which recordings (i) belong to
-                // the current cluster (clusters[i]).
-            lut[clusters[i]].push_back(i);
-            
-            if(prev_cluster != -1) {
-                    // each time we observe a transition from the previous cluster
-                    // to the current cluster, we increment that position in the matrix
-                    // by 1.
-                transition_table.row(prev_cluster)[clusters[i]] += 1;
-            }
-            prev_cluster = clusters[i];
+            // each recording follows the one before it, so adding the clusters
+            // in order counts every transition between them (and between
+            // longer runs of them, up to the model's order).  only the
+            // contexts that saw something new have their tables rebuilt.
+        for(size_t i = first; i < labels.size(); i++) {
+            markov.add(labels[i]);
         }
+        markov.update();
+        clusters = labels;
         
-            // we will normalize by rows, so each row can be treated as probabilities
-        transition_table.divideEachVecBySum(true);
+            // the audio thread samples from a copy, along with a look up table
+            // of where the recordings in each cluster are.  it only ever reads
+            // that copy, never corpora, and the triple buffer hands it over
+            // without the audio thread freeing anything or clustering again
+            // changing what it is reading.
+        Chain &chain = chains.getWriteBuffer();
+        chain.model = markov;
+        chain.lut.resize(n_clusters);
+        for(int i = 0; i < n_clusters; i++) {
+            chain.lut[i].clear();
+        }
+        for(int i = 0; i < clusters.size(); i++) {
+            const pkmMatrix &buffer = corpora[i].buffer;
+            Segment s = { buffer.data, (int)buffer.rows, (int)buffer.cols };
+            chain.lut[clusters[i]].push_back(s);
+        }
+        chains.publish();
         
-            // this will just print to the console so we can see what it looks like
-        transition_table.print();
+        cout << "clusters: " << n_clusters << ", contexts: " << markov.getNumContexts() << endl;
     }
     
+        // pick the next cluster given the ones picked before it, or -1 if
+        // nothing has been clustered yet.  allocates nothing, so it is safe
+        // to call from the audio thread, which is the only one that may.
     int transition() {
-        pkmMatrix row = transition_table.rowRange(previous_cluster, previous_cluster + 1);
-        float r = (rand() % 100) / 100.0;
-        float cumsum = 0;
-        for(int c = 0; c < row.cols; c++) {
-            cumsum += row[c];
-            if(r < cumsum) {
-                previous_cluster = c;
-                return c;
-            }
+        const Chain &chain = chains.read();
+        int c = chain.model.next(history, n_history, random);
+        if (c < 0) {
+            return -1;
         }
+        if (n_history == pkmMarkovModel::kMaxOrder) {
+            memmove(history, history + 1, sizeof(int) * (n_history - 1));
+            n_history--;
+        }
+        history[n_history++] = c;
+        return c;
     }
     
-    pkmMatrix sample(int cluster) {
-        int rand_idx = rand() % lut[cluster].size();
-        return corpora[lut[cluster][rand_idx]].buffer;
+        // a random recording from the cluster, with no data if there is none.
+        // like transition(), for the audio thread only.
+    Segment sample(int cluster) {
+        Segment s = { NULL, 0, 0 };
+        const Chain &chain = chains.read();
+        if (cluster < 0 || cluster >= chain.lut.size() || chain.lut[cluster].empty()) {
+            return s;
+        }
+        const vector<Segment> &members = chain.lut[cluster];
+        return members[random.below(members.size())];
     }
     
 private:
-    int previous_cluster, current_cluster;
+    struct Chain {
+        pkmMarkovModel model;
+        vector<vector<Segment>> lut;
+    };
+    
     int n_clusters;
+    pkmKMeans kmeans;
     vector<int> clusters;
-    vector<vector<int>> lut;
-    pkmMatrix transition_table;
+    pkmMarkovModel markov;
+    pkmTripleBuffer<Chain> chains;
+    
+        // used only by the audio thread
+    pkmMarkovModel::Random random;
+    int history[pkmMarkovModel::kMaxOrder];
+    int n_history;
 };
 
 
@@ -246,6 +321,10 @@ public:
     void setup() {
         is_synthesizing = false;
         is_recording = false;
+        restart = false;
+        segment.data = NULL;
+        segment.rows = segment.cols = 0;
+        current_frame = 0;
         
         sample_rate = 44100;
         frame_size = 512;
@@ -254,8 +333,8 @@ public:
         height = 500;
         ofSetWindowShape(width, height);
         
-        corpus.setup(sample_rate, frame_size);
         segmenter.setup(sample_rate, frame_size);
+        corpus.setup(sample_rate, frame_size, segmenter.getMaxSegments());
         ofSoundStreamSetup(1, 1, sample_rate, frame_size, 3);
     }
     
@@ -278,18 +357,14 @@ public:
 
     void audioOut(float *buf, int size, int ch) {
         if(is_synthesizing) {
-            if(current_frame < segment.rows) {
-                for (int i = 0; i < size; i++) {
-                    buf[i] = segment.row(current_frame)[i];
-                }
-                current_frame++;
-            }
-            else {
-                corpus.transition();
-                segment = corpus.sample();
+            if(restart.exchange(false) || segment.data == NULL || current_frame >= segment.rows) {
+                current_cluster = corpus.transition();
+                segment = corpus.sample(current_cluster);
                 current_frame = 0;
+            }
+            if(segment.data != NULL) {
                 for (int i = 0; i < size; i++) {
-                    buf[i] = segment.row(current_frame)[i];
+                    buf[i] = segment.data[current_frame * segment.cols + i];
                 }
                 current_frame++;
             }
@@ -311,10 +386,11 @@ public:
             corpus.cluster();
         }
         else if(k == ' ') {
-            current_cluster = corpus.transition();
-            segment = corpus.sample(current_cluster);
-            is_synthesizing = true;
+                // the audio thread picks the next segment when it sees this,
+                // so only it ever samples from the corpus
             is_recording = false;
+            restart = true;
+            is_synthesizing = true;
         }
     }
     
@@ -324,13 +400,16 @@ private:
     
     AudioSegmenter segmenter;
     MarkovCorpus corpus;
-    pkmMatrix segment;
+    Segment segment;
     int current_cluster, current_frame;
     
     int width, height;
     
     bool is_synthesizing;
     bool is_recording;
+    
+        // set by the space bar to have audioOut start a new segment
+    atomic<bool> restart;
 };
 
 
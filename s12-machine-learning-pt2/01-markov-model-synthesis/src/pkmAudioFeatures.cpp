@@ -45,6 +45,7 @@
 
 pkmAudioFeatures::pkmAudioFeatures() {
     is_setup = false;
+    batchMagnitudes = batchCQT = batchLFCC = batchPrevious = NULL;
 }
 
 void pkmAudioFeatures::setup(int sample_rate, int fft_size)
@@ -54,6 +55,7 @@ void pkmAudioFeatures::setup(int sample_rate, int fft_size)
 	
 	setupCepstral();
     setupChromagram();
+    setupBatch();
     
     is_setup = true;
 }
@@ -70,7 +72,7 @@ pkmAudioFeatures::~pkmAudioFeatures()
         free(cqtVector);
         free(dctVector);
         
-        free(fft);
+        delete fft;
         free(fft_magnitudes);
         free(fft_phases);
         
@@ -85,6 +87,10 @@ pkmAudioFeatures::~pkmAudioFeatures()
         free(note);
         free(chroma);
     }
+    free(batchMagnitudes);
+    free(batchCQT);
+    free(batchLFCC);
+    free(batchPrevious);
 }
 
 void pkmAudioFeatures::setupCepstral()
@@ -245,7 +251,7 @@ void pkmAudioFeatures::createDCT()
 	
 }
 
-void pkmAudioFeatures::computeMelFeatures(float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
+void pkmAudioFeatures::computeMelFeatures(const float *input, float *output, int numFilters, bool computeLogAmplitude, bool computeNormalization, bool computeDeltaFeatures)
 {
     // should window input buffer before FFT
 	fft->forward(0, input, fft_magnitudes, fft_phases);
@@ -268,8 +274,8 @@ void pkmAudioFeatures::computeMelFeatures(float *input, float *output, int numFi
         int a = 0;
         float *ptr1 = 0;
         
-        // log amplitude
-        a = cqtN;
+        // log amplitude (only of the filters we wrote to output)
+        a = numFilters == -1 ? cqtN : numFilters;
         ptr1 = output;
         while( a-- ){
             float f = *ptr1;
@@ -341,6 +347,90 @@ void pkmAudioFeatures::computeLFCCF(float *input, float *output, int numLFCCS)
 	
 }
 
+void pkmAudioFeatures::setupBatch()
+{
+    free(batchMagnitudes);
+    free(batchCQT);
+    free(batchLFCC);
+    free(batchPrevious);
+    batchMagnitudes = (float *)malloc(sizeof(float) * kBatchFrames * fftOutN);
+    batchCQT = (float *)malloc(sizeof(float) * kBatchFrames * cqtN);
+    batchLFCC = (float *)malloc(sizeof(float) * kBatchFrames * dctN);
+    batchPrevious = (float *)malloc(sizeof(float) * dctN);
+}
+
+void pkmAudioFeatures::computeLFCCBatchF(const float *frames, int n_frames, float *features, int numLFCCS, float *summary)
+{
+    if (numLFCCS == -1)
+        numLFCCS = dctN;
+    if (n_frames < 1) {
+        if (summary)
+            memset(summary, 0, sizeof(float) * 4 * numLFCCS);
+        return;
+    }
+    
+    float *first = summary, *mean = summary + numLFCCS, *var = summary + 2 * numLFCCS, *delta = summary + 3 * numLFCCS;
+    if (summary) {
+        vDSP_vclr(mean, 1, 3 * numLFCCS);
+    }
+    
+    // a block of frames at a time, so the scratch never has to grow
+    for (int start = 0; start < n_frames; start += kBatchFrames) {
+        int n = n_frames - start < kBatchFrames ? n_frames - start : kBatchFrames;
+        const float *block = frames + (size_t)start * fftN;
+        
+        // spectrum of every frame
+        for (int i = 0; i < n; i++) {
+            fft->forward(0, block + (size_t)i * fftN, batchMagnitudes + (size_t)i * fftOutN, fft_phases);
+        }
+        
+        // constant-Q bands of every frame at once
+        vDSP_mmul(batchMagnitudes, 1, CQT, 1, batchCQT, 1, n, cqtN, fftOutN);
+        
+        // LFCC
+        size_t a = (size_t)n * cqtN;
+        float *ptr1 = batchCQT;
+        while( a-- ){
+            float f = *ptr1;
+            *ptr1++ = f == 0 ? 0 : log10f( f*f );
+        }
+        vDSP_mmul(batchCQT, 1, DCT, 1, batchLFCC, 1, n, dctN, cqtN);
+        float norm = dctN;
+        vDSP_vsdiv(batchLFCC, 1, &norm, batchLFCC, 1, n * dctN);
+        
+        // copy out the features and summarise them in the same pass over the
+        // frames, with a running mean and variance (Welford).  the change
+        // into a block's first frame is from the last frame of the block
+        // before, which is kept in batchPrevious.
+        if (summary && start == 0) {
+            cblas_scopy(numLFCCS, batchLFCC, 1, first, 1);
+        }
+        for (int i = 0; i < n; i++) {
+            const float *x = batchLFCC + (size_t)i * dctN;
+            const float *previous = i > 0 ? x - dctN : batchPrevious;
+            if (features) {
+                cblas_scopy(numLFCCS, x, 1, features + (size_t)(start + i) * numLFCCS, 1);
+            }
+            if (summary) {
+                float w = 1.0f / (start + i + 1);
+                for (int j = 0; j < numLFCCS; j++) {
+                    float d = x[j] - mean[j];
+                    mean[j] += d * w;
+                    var[j] += d * (x[j] - mean[j]);
+                    if (start + i > 0)
+                        delta[j] += fabsf(x[j] - previous[j]);
+                }
+            }
+        }
+        cblas_scopy(dctN, batchLFCC + (size_t)(n - 1) * dctN, 1, batchPrevious, 1);
+    }
+    if (summary) {
+        float frames_n = n_frames, changes_n = n_frames > 1 ? n_frames - 1 : 1;
+        vDSP_vsdiv(var, 1, &frames_n, var, 1, numLFCCS);
+        vDSP_vsdiv(delta, 1, &changes_n, delta, 1, numLFCCS);
+    }
+}
+
 void pkmAudioFeatures::compute24DimAudioFeaturesF(float *inputSignal, float *outputFeatures)
 {
     // write 12 features for Mel and another 12 for Delta Mel
@@ -113,7 +113,7 @@ public:
 	~pkmAudioFeatures();
     
     // 12 features + 12 optional delta
-    void computeMelFeatures(float *inputSignal,
+    void computeMelFeatures(const float *inputSignal,
                             float *outputFeatures,
                             int numFilters = -1,
                             bool computeLogAmplitude = true,
@@ -126,6 +126,19 @@ public:
 	void computeLFCCFromMagnitudesF(float *fftMagnitudes, float *outputFeatures, int numLFCCS=-1);
 	void computeLFCCFromMagnitudesD(float *fftMagnitudes, double *outputFeatures, int numLFCCS = -1);
     
+    // LFCCs of n_frames consecutive frames of fft_size samples (e.g. the rows
+    // of a segment) in one call.  the spectra of all the frames go through
+    // the constant-Q and DCT matrices as two matrix products, rather than two
+    // vector products per frame.  they go through kBatchFrames at a time,
+    // in scratch set aside by setup(), so a segment of any length is
+    // analysed without allocating (e.g. on the audio thread).
+    // features (n_frames x numLFCCS) may be NULL if only the summary is
+    // wanted.  summary, if not NULL, gets 4 x numLFCCS values: the first
+    // frame's features, their mean, their variance, and the mean absolute
+    // change from one frame to the next.
+    void computeLFCCBatchF(const float *frames, int n_frames, float *features,
+                           int numLFCCS = -1, float *summary = NULL);
+    
     void computeChromagramF(float *inputSignal, float *outputFeatures, bool calculateDeltaFeatures = false);
     void computeChromagramFromMagnitudesF(float *fftMagnitudes, float *outputFeatures, bool calculateDeltaFeatures = false);
     
@@ -166,6 +179,12 @@ private:
     
 	void createLogFreqMap();
 	void createDCT();
+    
+    // frames analysed at once by computeLFCCBatchF
+    static const int kBatchFrames = 128;
+    
+    // set aside the batch scratch for kBatchFrames frames
+    void setupBatch();
 	
 	float			*sample_data,
 					*powerSpectrum;
@@ -195,6 +214,11 @@ private:
 	float			*fft_magnitudes,
 					*fft_phases;
     
+    float           *batchMagnitudes,                           // n x fftOutN
+                    *batchCQT,                                  // n x cqtN
+                    *batchLFCC,                                 // n x dctN
+                    *batchPrevious;                             // dctN
+    
     float           *previousLFCCs;
     float           *previousDeltaLFCCs;
     
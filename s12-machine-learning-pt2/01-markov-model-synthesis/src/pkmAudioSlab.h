@@ -0,0 +1,103 @@
+/*
+ *  pkmAudioSlab.h
+ *
+ *  One contiguous, append-only buffer for everything recorded in a
+ *  session, so that segments of it can be handed around as (offset,
+ *  length) views instead of copies.
+ *
+ *  The whole capacity is reserved as address space up front with mmap, and
+ *  the system only commits pages as they are first written to.  The slab
+ *  therefore never moves or reallocates while it grows: a pointer into it
+ *  stays valid for the life of the slab, and recording an hour costs
+ *  nothing until the hour has been recorded.
+ *
+ *  append() is meant for one writer (e.g. audioIn).  size() is published
+ *  with release/acquire ordering, so any thread may read samples below it.
+ *
+ *  Usage:
+ *
+ *  pkmAudioSlab slab;
+ *  slab.setup(44100 * 60 * 30);           // up to 30 minutes
+ *  slab.append(input, buffer_size);        // audio thread
+ *  pkmAudioSlab::View v = {start, length};
+ *  pkmMatrix segment = slab.getMatrix(v, frame_size);  // no copy
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <atomic>
+#include "pkmMatrix.h"
+
+class pkmAudioSlab {
+ public:
+  // a run of samples in the slab
+  struct View {
+    size_t offset;
+    size_t length;
+  };
+
+  pkmAudioSlab() : mData(NULL), mCapacity(0), mSize(0) {}
+  ~pkmAudioSlab() { release(); }
+
+  // reserve room for max_samples; false if the address space could not be
+  // reserved.  anything already recorded is discarded.
+  bool setup(size_t max_samples) {
+    release();
+    int flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void *p = mmap(NULL, max_samples * sizeof(float), PROT_READ | PROT_WRITE,
+                   flags, -1, 0);
+    if (p == MAP_FAILED) {
+      printf("[pkmAudioSlab]: could not reserve %zu samples\n", max_samples);
+      return false;
+    }
+    mData = (float *)p;
+    mCapacity = max_samples;
+    mSize = 0;
+    return true;
+  }
+
+  // writer: add n samples to the end.  returns how many fit.
+  size_t append(const float *samples, size_t n) {
+    size_t size = mSize.load(std::memory_order_relaxed);
+    if (n > mCapacity - size) n = mCapacity - size;
+    memcpy(mData + size, samples, sizeof(float) * n);
+    mSize.store(size + n, std::memory_order_release);
+    return n;
+  }
+
+  // samples recorded so far
+  size_t size() const { return mSize.load(std::memory_order_acquire); }
+
+  size_t capacity() const { return mCapacity; }
+
+  bool isFull() const { return size() == mCapacity; }
+
+  const float *getData(size_t offset = 0) const { return mData + offset; }
+
+  // the view as rows of frame_size samples (any remainder is left off),
+  // sharing the slab's memory.  copies of the matrix share it too, but
+  // assigning it to another matrix with = makes a copy.
+  pkmMatrix getMatrix(const View &view, size_t frame_size) const {
+    return pkmMatrix(view.length / frame_size, frame_size,
+                     mData + view.offset, false);
+  }
+
+ private:
+  void release() {
+    if (mData != NULL) munmap(mData, mCapacity * sizeof(float));
+    mData = NULL;
+    mCapacity = 0;
+    mSize = 0;
+  }
+
+  float *mData;
+  size_t mCapacity;
+  std::atomic<size_t> mSize;
+};
@@ -0,0 +1,338 @@
+/*
+ *  pkmKMeans.h
+ *
+ *  k-means over a contiguous rows x cols float matrix.
+ *
+ *  - train() is Lloyd's algorithm with Hamerly's bounds: each point keeps an
+ *    upper bound on the distance to its centre and a lower bound on the
+ *    distance to any other, and both are only loosened by how far the
+ *    centres move.  Most points are never compared with every centre after
+ *    the first pass.
+ *  - trainMiniBatch() follows Sculley (2010): each step moves the centres
+ *    toward a random batch of points, with a per-centre learning rate, then
+ *    every point is assigned once at the end.  For large corpora it gets
+ *    close to train() at a fraction of the cost.
+ *  - The passes over all points are split across threads.
+ *  - Centres are seeded with k-means++ the first time.  Training again with
+ *    the same k and dimensionality (e.g. after more recordings) starts from
+ *    the previous centres, which usually converge in a few iterations.
+ *    reset() forgets them.
+ *
+ *  Usage:
+ *
+ *  pkmKMeans kmeans;
+ *  kmeans.setNumClusters(10);
+ *  kmeans.train(features.data, features.rows, features.cols);
+ *  const vector<int> &clusters = kmeans.getClusters();
+ *
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class pkmKMeans {
+ public:
+  pkmKMeans() : mK(1), mCols(0), mRandom(1) {
+    mThreads = (int)std::thread::hardware_concurrency();
+    if (mThreads < 1) mThreads = 1;
+  }
+
+  void setNumClusters(int k) {
+    if (k != mK) reset();
+    mK = k;
+  }
+
+  int getNumClusters() const { return mK; }
+
+  // forget the current centres, so the next train() seeds afresh
+  void reset() { mCentroids.clear(); }
+
+  // full k-means; returns the number of iterations used
+  int train(const float *data, int rows, int cols, int max_iterations = 100) {
+    if (!prepare(data, rows, cols)) return 0;
+
+    vector<float> upper(rows), lower(rows), nearest_other(mK), moved(mK);
+    vector<float> sums(mK * cols);
+    vector<int> counts(mK);
+
+    // the first pass compares every point with every centre
+    computeCentreDistances(nearest_other);
+    parallelFor(rows, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        assignFully(data + (size_t)i * cols, mClusters[i], upper[i], lower[i]);
+      }
+    });
+
+    int iteration = 0;
+    for (; iteration < max_iterations; iteration++) {
+      if (!updateCentroids(data, rows, sums, counts, upper, moved)) break;
+
+      // loosen the bounds by how far the centres moved
+      int farthest = 0, second = -1;
+      for (int j = 1; j < mK; j++) {
+        if (moved[j] > moved[farthest]) {
+          second = farthest;
+          farthest = j;
+        } else if (second < 0 || moved[j] > moved[second]) {
+          second = j;
+        }
+      }
+      computeCentreDistances(nearest_other);
+
+      std::atomic<int> changed(0);
+      parallelFor(rows, [&](int begin, int end) {
+        int local_changed = 0;
+        for (int i = begin; i < end; i++) {
+          int a = mClusters[i];
+          upper[i] += moved[a];
+          lower[i] -= a == farthest ? (second >= 0 ? moved[second] : 0)
+                                    : moved[farthest];
+          float bound = max(nearest_other[a], lower[i]);
+          if (upper[i] <= bound) continue;
+          // tighten the upper bound before giving up on the shortcut
+          const float *x = data + (size_t)i * cols;
+          upper[i] = sqrtf(distance(x, &mCentroids[(size_t)a * cols]));
+          if (upper[i] <= bound) continue;
+          assignFully(x, mClusters[i], upper[i], lower[i]);
+          if (mClusters[i] != a) local_changed++;
+        }
+        changed += local_changed;
+      });
+      if (changed == 0) {
+        iteration++;
+        break;
+      }
+    }
+    return iteration;
+  }
+
+  // mini-batch k-means, then a final assignment of every point
+  void trainMiniBatch(const float *data, int rows, int cols,
+                      int batch_size = 1024, int iterations = 100) {
+    if (!prepare(data, rows, cols)) return;
+
+    vector<long> seen(mK, 0);
+    vector<int> batch(batch_size), batch_cluster(batch_size);
+    std::uniform_int_distribution<int> pick(0, rows - 1);
+    for (int it = 0; it < iterations; it++) {
+      for (int b = 0; b < batch_size; b++) batch[b] = pick(mRandom);
+      parallelFor(batch_size, [&](int begin, int end) {
+        for (int b = begin; b < end; b++) {
+          float u, l;
+          assignFully(data + (size_t)batch[b] * cols, batch_cluster[b], u, l);
+        }
+      });
+      for (int b = 0; b < batch_size; b++) {
+        int j = batch_cluster[b];
+        float rate = 1.0f / ++seen[j];
+        float *c = &mCentroids[(size_t)j * cols];
+        const float *x = data + (size_t)batch[b] * cols;
+        for (int d = 0; d < cols; d++) c[d] += rate * (x[d] - c[d]);
+      }
+    }
+
+    parallelFor(rows, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        float u, l;
+        assignFully(data + (size_t)i * cols, mClusters[i], u, l);
+      }
+    });
+  }
+
+  // cluster of each row of the last training set
+  const vector<int> &getClusters() const { return mClusters; }
+
+  // k x cols centres
+  const float *getCentroids() const { return mCentroids.data(); }
+
+  // nearest centre to one point
+  int predict(const float *x) const {
+    int best = 0;
+    float u, l;
+    assignFully(x, best, u, l);
+    return best;
+  }
+
+ private:
+  bool prepare(const float *data, int rows, int cols) {
+    if (rows < 1 || mK < 1) return false;
+    if (cols != mCols || (int)mCentroids.size() != mK * cols) {
+      mCols = cols;
+      seed(data, rows);
+    }
+    mClusters.assign(rows, 0);
+    return true;
+  }
+
+  // greedy k-means++: each further centre is the best of a few points drawn
+  // with probability proportional to their squared distance from the
+  // centres chosen so far
+  void seed(const float *data, int rows) {
+    mCentroids.assign((size_t)mK * mCols, 0.0f);
+    int trials = 2 + (int)log((double)mK);
+    vector<double> d2(rows), candidate_d2(rows), best_d2(rows);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    int chosen = std::uniform_int_distribution<int>(0, rows - 1)(mRandom);
+    const float *first = data + (size_t)chosen * mCols;
+    memcpy(&mCentroids[0], first, sizeof(float) * mCols);
+    double total = 0;
+    for (int i = 0; i < rows; i++) {
+      d2[i] = distance(data + (size_t)i * mCols, first);
+      total += d2[i];
+    }
+
+    for (int j = 1; j < mK; j++) {
+      double best_total = HUGE_VAL;
+      for (int t = 0; t < trials; t++) {
+        double r = uniform(mRandom) * total;
+        int c = rows - 1;
+        for (int i = 0; i < rows; i++) {
+          r -= d2[i];
+          if (r <= 0) {
+            c = i;
+            break;
+          }
+        }
+        // the potential if c were added
+        const float *x = data + (size_t)c * mCols;
+        double candidate_total = 0;
+        for (int i = 0; i < rows; i++) {
+          candidate_d2[i] =
+              min(d2[i], (double)distance(data + (size_t)i * mCols, x));
+          candidate_total += candidate_d2[i];
+        }
+        if (candidate_total < best_total) {
+          best_total = candidate_total;
+          chosen = c;
+          best_d2.swap(candidate_d2);
+        }
+      }
+      memcpy(&mCentroids[(size_t)j * mCols], data + (size_t)chosen * mCols,
+             sizeof(float) * mCols);
+      d2.swap(best_d2);
+      total = best_total;
+    }
+  }
+
+  // move the centres to the mean of their points.  empty clusters take
+  // the point farthest from its centre.  false if nothing moved.
+  bool updateCentroids(const float *data, int rows, vector<float> &sums,
+                       vector<int> &counts, const vector<float> &upper,
+                       vector<float> &moved) {
+    fill(sums.begin(), sums.end(), 0.0f);
+    fill(counts.begin(), counts.end(), 0);
+    for (int i = 0; i < rows; i++) {
+      int a = mClusters[i];
+      float *s = &sums[(size_t)a * mCols];
+      const float *x = data + (size_t)i * mCols;
+      for (int d = 0; d < mCols; d++) s[d] += x[d];
+      counts[a]++;
+    }
+    bool any = false;
+    vector<float> next(mCols);
+    vector<char> taken;
+    for (int j = 0; j < mK; j++) {
+      float *c = &mCentroids[(size_t)j * mCols];
+      if (counts[j] > 0) {
+        for (int d = 0; d < mCols; d++) {
+          next[d] = sums[(size_t)j * mCols + d] / counts[j];
+        }
+      } else {
+        // the bounds stay valid however far a centre jumps, since moved[]
+        // accounts for it
+        taken.resize(rows, 0);
+        int far = -1;
+        for (int i = 0; i < rows; i++) {
+          if (!taken[i] && (far < 0 || upper[i] > upper[far])) far = i;
+        }
+        if (far < 0) far = 0;
+        taken[far] = 1;
+        memcpy(&next[0], data + (size_t)far * mCols, sizeof(float) * mCols);
+      }
+      moved[j] = sqrtf(distance(c, &next[0]));
+      if (moved[j] > 0) any = true;
+      memcpy(c, &next[0], sizeof(float) * mCols);
+    }
+    return any;
+  }
+
+  // half the distance from each centre to its nearest other centre: a
+  // point closer than that to its own centre cannot be nearer another
+  void computeCentreDistances(vector<float> &nearest_other) const {
+    for (int j = 0; j < mK; j++) nearest_other[j] = HUGE_VALF;
+    for (int j = 0; j < mK; j++) {
+      for (int m = j + 1; m < mK; m++) {
+        float d = 0.5f * sqrtf(distance(&mCentroids[(size_t)j * mCols],
+                                        &mCentroids[(size_t)m * mCols]));
+        nearest_other[j] = min(nearest_other[j], d);
+        nearest_other[m] = min(nearest_other[m], d);
+      }
+    }
+  }
+
+  // nearest and second nearest centre distances, compared with every centre
+  void assignFully(const float *x, int &cluster, float &upper,
+                   float &lower) const {
+    float best = HUGE_VALF, second = HUGE_VALF;
+    int best_j = 0;
+    for (int j = 0; j < mK; j++) {
+      float d = distance(x, &mCentroids[(size_t)j * mCols]);
+      if (d < best) {
+        second = best;
+        best = d;
+        best_j = j;
+      } else if (d < second) {
+        second = d;
+      }
+    }
+    cluster = best_j;
+    upper = sqrtf(best);
+    lower = sqrtf(second);
+  }
+
+  // squared euclidean distance
+  float distance(const float *a, const float *b) const {
+    float acc[4] = {0, 0, 0, 0};
+    int d = 0;
+    for (; d + 4 <= mCols; d += 4) {
+      for (int k = 0; k < 4; k++) {
+        acc[k] += (a[d + k] - b[d + k]) * (a[d + k] - b[d + k]);
+      }
+    }
+    for (; d < mCols; d++) acc[0] += (a[d] - b[d]) * (a[d] - b[d]);
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+  }
+
+  // run fn over [0, n) in one contiguous range per thread; small jobs stay
+  // on the calling thread
+  template <typename F>
+  void parallelFor(int n, F fn) {
+    int threads = min(mThreads, n / 2048);
+    if (threads <= 1) {
+      fn(0, n);
+      return;
+    }
+    vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+      pool.push_back(std::thread(fn, (int)((long)n * t / threads),
+                                 (int)((long)n * (t + 1) / threads)));
+    }
+    fn(0, n / threads);
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+  }
+
+  int mK, mCols, mThreads;
+  vector<float> mCentroids;
+  vector<int> mClusters;
+  std::mt19937 mRandom;
+};
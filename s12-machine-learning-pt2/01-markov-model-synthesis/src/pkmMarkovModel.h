@@ -0,0 +1,230 @@
+/*
+ *  pkmMarkovModel.h
+ *
+ *  Variable-order Markov model over integer states (e.g. cluster labels).
+ *
+ *  - add() appends one state to the training sequence and counts the
+ *    transition into it from every context of length 0 .. max order that
+ *    precedes it.
+ *  - Only contexts and successors that have actually been seen are stored:
+ *    each context holds a short list of its successors and their counts,
+ *    so memory grows with the number of distinct transitions rather than
+ *    with the number of states squared.
+ *  - update() rebuilds the alias tables (Walker/Vose) of the contexts that
+ *    changed since the last update() and leaves the rest alone.
+ *  - next() picks the longest context that matches the recent history and
+ *    has been seen at least min_count times, falling back to shorter ones,
+ *    and samples a successor from its alias table in constant time.  It is
+ *    const and allocates nothing, so it can run on the audio thread on a
+ *    model nobody is adding to.
+ *
+ *  Contexts are packed into 64-bit keys, so the maximum order is 3 and
+ *  states must be below 2^20.
+ *
+ *  Usage:
+ *
+ *  pkmMarkovModel markov;
+ *  markov.setup(2);
+ *  for (int i = 0; i < n; i++) markov.add(labels[i]);
+ *  markov.update();
+ *
+ *  pkmMarkovModel::Random random;
+ *  int history[2] = {a, b};  // oldest first
+ *  int c = markov.next(history, 2, random);
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class pkmMarkovModel {
+ public:
+  static const int kMaxOrder = 3;
+  static const int kStateBits = 20;
+
+  // xoshiro128+ seeded through splitmix64: fast, small, and with none of
+  // rand()'s coarse resolution
+  class Random {
+   public:
+    Random(uint64_t seed = 5489u) { setSeed(seed); }
+
+    void setSeed(uint64_t seed) {
+      for (int i = 0; i < 2; i++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        mState[i] = z ^ (z >> 31);
+      }
+    }
+
+    uint64_t operator()() {
+      uint64_t s0 = mState[0], s1 = mState[1];
+      uint64_t result = s0 + s1;
+      s1 ^= s0;
+      mState[0] = ((s0 << 24) | (s0 >> 40)) ^ s1 ^ (s1 << 16);
+      mState[1] = (s1 << 37) | (s1 >> 27);
+      return result;
+    }
+
+    // uniform in [0, 1) with 53 bits of resolution
+    double uniform() { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+
+    // uniform in [0, n)
+    int below(int n) { return (int)(uniform() * n); }
+
+   private:
+    uint64_t mState[2];
+  };
+
+  pkmMarkovModel() : mOrder(1), mMinCount(2), mLength(0) {}
+
+  // contexts of up to max_order states.  higher order contexts seen fewer
+  // than min_count times are skipped in favour of shorter ones, so a small
+  // corpus does not just replay itself.
+  void setup(int max_order = 1, int min_count = 2) {
+    mOrder = max(0, min(max_order, (int)kMaxOrder));
+    mMinCount = max(1, min_count);
+    clear();
+  }
+
+  void clear() {
+    mContexts.clear();
+    mDirty.clear();
+    mRecent.clear();
+    mLength = 0;
+  }
+
+  int getOrder() const { return mOrder; }
+
+  // number of states added so far
+  long getLength() const { return mLength; }
+
+  size_t getNumContexts() const { return mContexts.size(); }
+
+  // append one state to the training sequence
+  void add(int state) {
+    for (int o = 0; o <= (int)mRecent.size(); o++) {
+      uint64_t key = contextKey(mRecent.data() + mRecent.size() - o, o);
+      Context &c = mContexts[key];
+      size_t s = 0;
+      while (s < c.next.size() && c.next[s] != state) s++;
+      if (s == c.next.size()) {
+        c.next.push_back(state);
+        c.count.push_back(0);
+      }
+      c.count[s]++;
+      c.total++;
+      if (!c.dirty) {
+        c.dirty = true;
+        mDirty.push_back(key);
+      }
+    }
+    if (mOrder > 0) {
+      if ((int)mRecent.size() == mOrder) mRecent.erase(mRecent.begin());
+      mRecent.push_back(state);
+    }
+    mLength++;
+  }
+
+  // rebuild the sampling tables of every context changed by add()
+  void update() {
+    for (size_t i = 0; i < mDirty.size(); i++) {
+      Context &c = mContexts[mDirty[i]];
+      buildAlias(c);
+      c.dirty = false;
+    }
+    mDirty.clear();
+  }
+
+  // sample the state following history[0 .. length - 1] (oldest first).
+  // -1 if nothing has been added.
+  int next(const int *history, int length, Random &random) const {
+    for (int o = min(length, mOrder); o >= 0; o--) {
+      auto it = mContexts.find(contextKey(history + length - o, o));
+      if (it == mContexts.end() || it->second.prob.empty()) continue;
+      const Context &c = it->second;
+      if (o > 1 && c.total < mMinCount) continue;
+      double u = random.uniform() * c.prob.size();
+      int i = (int)u;
+      return (u - i) < c.prob[i] ? c.next[i] : c.next[c.alias[i]];
+    }
+    return -1;
+  }
+
+  // probability of state after history under the context next() would use
+  float probability(const int *history, int length, int state) const {
+    for (int o = min(length, mOrder); o >= 0; o--) {
+      auto it = mContexts.find(contextKey(history + length - o, o));
+      if (it == mContexts.end() || it->second.total == 0) continue;
+      const Context &c = it->second;
+      if (o > 1 && c.total < mMinCount) continue;
+      for (size_t s = 0; s < c.next.size(); s++) {
+        if (c.next[s] == state) return (float)c.count[s] / c.total;
+      }
+      return 0;
+    }
+    return 0;
+  }
+
+ private:
+  struct Context {
+    Context() : total(0), dirty(false) {}
+    vector<int> next;      // successors seen after this context
+    vector<long> count;    // how often each was seen
+    long total;
+    // alias table: slot i gives next[i] with probability prob[i], and
+    // next[alias[i]] otherwise
+    vector<float> prob;
+    vector<int> alias;
+    bool dirty;
+  };
+
+  static uint64_t contextKey(const int *states, int order) {
+    uint64_t key = (uint64_t)order << 60;
+    for (int i = 0; i < order; i++) {
+      key |= (uint64_t)(states[i] & ((1 << kStateBits) - 1)) << (kStateBits * i);
+    }
+    return key;
+  }
+
+  // Vose's alias method
+  void buildAlias(Context &c) {
+    int n = (int)c.next.size();
+    c.prob.resize(n);
+    c.alias.resize(n);
+    mSmall.clear();
+    mLarge.clear();
+    for (int i = 0; i < n; i++) {
+      c.prob[i] = (float)((double)c.count[i] * n / c.total);
+      c.alias[i] = i;
+      (c.prob[i] < 1.0f ? mSmall : mLarge).push_back(i);
+    }
+    while (!mSmall.empty() && !mLarge.empty()) {
+      int s = mSmall.back(), l = mLarge.back();
+      mSmall.pop_back();
+      c.alias[s] = l;
+      c.prob[l] -= 1.0f - c.prob[s];
+      if (c.prob[l] < 1.0f) {
+        mLarge.pop_back();
+        mSmall.push_back(l);
+      }
+    }
+    // whatever is left over is 1 up to rounding
+    for (size_t i = 0; i < mSmall.size(); i++) c.prob[mSmall[i]] = 1.0f;
+    for (size_t i = 0; i < mLarge.size(); i++) c.prob[mLarge[i]] = 1.0f;
+  }
+
+  int mOrder, mMinCount;
+  long mLength;
+  unordered_map<uint64_t, Context> mContexts;
+  vector<uint64_t> mDirty;  // keys of contexts whose tables are stale
+  vector<int> mRecent;      // the last mOrder states added
+  vector<int> mSmall, mLarge;
+};